@@ -212,6 +212,47 @@ WVTEST_MAIN("ssl inbuf after read error")
 #endif
 
 
+WVTEST_MAIN("ssl bulk transfer")
+{
+    WvX509Mgr x509("cn=random_stupid_dn", 1024);
+    WvIStreamList list;
+    WvSSLStream *s1, *s2;
+    sslloop(list, x509, s1, s2);
+
+    // a mix of tiny writes, which get collected into bigger records, and
+    // huge ones, which are more than the socket can take at once
+    const size_t total = 1024*1024;
+    unsigned char *out = new unsigned char[total];
+    for (size_t i = 0; i < total; i++)
+	out[i] = (i * 7 + i / 251) & 0xff;
+    const size_t sizes[] = { 1, 10, 100, 5000, 70000 };
+
+    static unsigned char in[100000];
+    size_t written = 0, got = 0;
+    bool same = true;
+    for (int i = 0; got < total && s2->isok() && i < 10000; i++)
+    {
+	if (written < total)
+	{
+	    size_t n = sizes[i % 5];
+	    if (n > total - written)
+		n = total - written;
+	    written += s1->write(out + written, n);
+	}
+	list.runonce(10);
+
+	size_t n = s2->read(in, sizeof(in));
+	if (n && memcmp(in, out + got, n))
+	    same = false;
+	got += n;
+    }
+    WVPASSEQ(written, total);
+    WVPASSEQ(got, total);
+    WVPASS(same);
+    delete[] out;
+}
+
+
 static void do_transfer(WvSSLStream *ssl)
 {
     char buf[1024];
@@ -355,3 +396,137 @@ WVTEST_MAIN("sslcert moniker creation")
 
     WVRELEASE(dumb);
 }
+
+
+static WvX509Mgr *resume_cert = NULL;
+static WvSSLStream *resume_server = NULL;
+
+static void resume_reply(WvSSLStream *ssl)
+{
+    const char *line = ssl->getline(0);
+    if (line && !strcmp(line, "hello"))
+	ssl->print("hi\n");
+}
+
+
+static void resume_accept(WvIStreamList *list, IWvStream *conn)
+{
+    resume_server = new WvSSLStream(conn, resume_cert, 0, true);
+    resume_server->setcallback(wv::bind(resume_reply, resume_server));
+    list->append(resume_server, true, "ssl server");
+}
+
+
+WVTEST_MAIN("ssl session resumption")
+{
+    signal(SIGPIPE, SIG_IGN);
+    WvSSLStream::flush_contexts();
+    resume_cert = new WvX509Mgr("cn=random_stupid_dn", 1024);
+
+    WvIStreamList list;
+    WvTCPListener l(WvIPPortAddr("127.0.0.1", 0));
+    WVPASS(l.isok());
+    l.onaccept(wv::bind(resume_accept, &list, _1));
+    list.append(&l, false, "listener");
+    WvIPPortAddr addr("127.0.0.1", l.src()->port);
+
+    // the first connection does a full handshake, and the next ones can
+    // resume its session, even though each connection gets its own
+    // stream at both ends.
+    for (int i = 0; i < 3; i++)
+    {
+	resume_server = NULL;
+	WvSSLStream *c = new WvSSLStream(new WvTCPConn(addr), NULL);
+	list.append(c, false, "ssl client");
+	c->print("hello\n");
+
+	const char *line = NULL;
+	for (int tries = 0; !line && c->isok() && tries < 500; tries++)
+	{
+	    list.runonce(10);
+	    line = c->getline(0);
+	}
+	WVPASSEQ(line, "hi");
+	WVPASS(resume_server);
+	WVPASSEQ(c->session_reused(), i > 0);
+	if (resume_server)
+	    WVPASSEQ(resume_server->session_reused(), i > 0);
+
+	list.unlink(c);
+	WVRELEASE(c);
+	if (resume_server)
+	    resume_server->close();
+	list.runonce(10);
+    }
+
+    list.zap();
+    WVRELEASE(resume_cert);
+    WvSSLStream::flush_contexts();
+}
+
+
+WVTEST_MAIN("ssl handshake threads")
+{
+    signal(SIGPIPE, SIG_IGN);
+    WvSSLStream::flush_contexts();
+    WvSSLStream::set_handshake_threads(2);
+    unsigned long steps = WvSSLStream::threaded_handshakes();
+    resume_cert = new WvX509Mgr("cn=random_stupid_dn", 1024);
+
+    WvIStreamList list;
+    WvTCPListener l(WvIPPortAddr("127.0.0.1", 0));
+    WVPASS(l.isok());
+    l.onaccept(wv::bind(resume_accept, &list, _1));
+    list.append(&l, false, "listener");
+    WvIPPortAddr addr("127.0.0.1", l.src()->port);
+
+    // a bunch of clients all connect at once, and a second round can still
+    // resume the sessions the first one got in the worker threads.
+    const int num = 5;
+    for (int round = 0; round < 2; round++)
+    {
+	WvSSLStream *c[num];
+	for (int i = 0; i < num; i++)
+	{
+	    c[i] = new WvSSLStream(new WvTCPConn(addr), NULL);
+	    list.append(c[i], false, "ssl client");
+	    c[i]->print("hello\n");
+	}
+
+	int answers = 0;
+	bool got[num];
+	memset(got, 0, sizeof(got));
+	for (int tries = 0; answers < num && tries < 500; tries++)
+	{
+	    list.runonce(10);
+	    for (int i = 0; i < num; i++)
+	    {
+		const char *line = c[i]->getline(0);
+		if (!got[i] && line && !strcmp(line, "hi"))
+		{
+		    got[i] = true;
+		    answers++;
+		}
+	    }
+	}
+	WVPASSEQ(answers, num);
+	if (round)
+	    WVPASS(c[num - 1]->session_reused());
+
+	// both ends of every connection did at least one step in a thread
+	WVPASS(WvSSLStream::threaded_handshakes() >= steps + 2 * num);
+	steps = WvSSLStream::threaded_handshakes();
+
+	for (int i = 0; i < num; i++)
+	{
+	    list.unlink(c[i]);
+	    WVRELEASE(c[i]);
+	}
+	list.runonce(10);
+    }
+
+    list.zap();
+    WVRELEASE(resume_cert);
+    WvSSLStream::set_handshake_threads(0);
+    WvSSLStream::flush_contexts();
+}
@@ -4,12 +4,16 @@
  */
 #define OPENSSL_NO_KRB5
 #include "wvsslstream.h"
+#include "wvaddr.h"
 #include "wvx509mgr.h"
 #include "wvcrypto.h"
 #include "wvlistener.h"
 #include "wvstrutils.h"
 #include "wvmoniker.h"
 #include "wvlinkerhack.h"
+#include "wvhashtable.h"
+#include "wvlinklist.h"
+#include "wvworkerpool.h"
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <assert.h>
@@ -22,11 +26,13 @@
 #   include <errno.h>
 #  endif
 # endif
+#include <pthread.h>
 #else
 #undef errno
 #define errno GetLastError()
 #undef EAGAIN
 #define EAGAIN WSAEWOULDBLOCK
+#define WVSSL_NO_THREADS
 #endif
 
 WV_LINK(WvSSLStream);
@@ -38,9 +44,12 @@ static IWvStream *creator(WvStringParm s, IObject *_obj)
 
 static IWvStream *screator(WvStringParm s, IObject *_obj)
 {
-    return new WvSSLStream(IWvStream::create(s, _obj), 
-	   new WvX509Mgr(encode_hostname_as_DN(fqdomainname()), 1024),
-	   0, true);
+    // one self-signed certificate is enough for all the connections, and
+    // then they can share an SSL context too.
+    static WvX509Mgr *servcert = NULL;
+    if (!servcert)
+	servcert = new WvX509Mgr(encode_hostname_as_DN(fqdomainname()), 1024);
+    return new WvSSLStream(IWvStream::create(s, _obj), servcert, 0, true);
 }
 
 struct WvTclParseValues
@@ -154,6 +163,8 @@ static WvMoniker<IWvListener> lreg("ssl", listener);
 static WvMoniker<IWvListener> lsslcertreg("sslcert", sslcertlistener);
 
 #define MAX_BOUNCE_AMOUNT (16384) // 1 SSLv3/TLSv1 record
+#define COALESCE_LIMIT (MAX_BOUNCE_AMOUNT / 4) // smaller writes get collected
+#define READ_BUFFER_LEN (65536)   // how much to read from the socket at once
 
 static int ssl_stream_count = 0;
 
@@ -164,43 +175,89 @@ static int wv_verify_cb(int preverify_ok, X509_STORE_CTX *ctx)
    return 1;
 }
 
-WvSSLGlobalValidateCallback WvSSLStream::global_vcb = 0;
 
-WvSSLStream::WvSSLStream(IWvStream *_slave, WvX509Mgr *_x509,
-    WvSSLValidateCallback _vcb, bool _is_server) :
-    WvStreamClone(_slave),
-    debug(WvString("WvSSLStream %s", ++ssl_stream_count), WvLog::Debug5),
-    write_bouncebuf(MAX_BOUNCE_AMOUNT), write_eat(0),
-    read_bouncebuf(MAX_BOUNCE_AMOUNT), read_pending(false)
+#define MAX_IDLE_CONTEXTS 8
+#define MAX_CLIENT_SESSIONS 256
+
+/** A session a client can offer the next time it connects to 'key' */
+struct WvSSLSession
 {
-    x509 = _x509;
-    if (x509)
-	x509->addRef(); // openssl may keep a pointer to this object
-    
-    vcb = _vcb;
-    if (!vcb && global_vcb)
-	vcb = wv::bind(global_vcb, _1, this);;
+    WvString key;
+    SSL_SESSION *sess;
 
-    is_server = _is_server;
-    ctx = NULL;
-    ssl = NULL;
-    //meth = NULL;
-    sslconnected = ssl_stop_read = ssl_stop_write = false;
-    
-    wvssl_init();
-    
-    if (x509 && !x509->isok())
+    WvSSLSession(WvStringParm _key, SSL_SESSION *_sess)
+	: key(_key), sess(_sess) {}
+    ~WvSSLSession()
+	{ SSL_SESSION_free(sess); }
+};
+
+DeclareWvDict(WvSSLSession, WvString, key);
+
+
+/**
+ * An SSL_CTX shared between all the streams with the same certificate and
+ * mode.  It's reference counted, but a few of them are kept around after
+ * their last stream goes away, so that their session caches are still
+ * there when the next connection comes along.
+ */
+class WvSSLContext
+{
+public:
+    WvString key;
+    SSL_CTX *ctx;
+    int refs;
+    unsigned long last_used;
+
+    /** Client side only: the last session for each server */
+    WvSSLSessionDict sessions;
+
+    WvSSLContext(WvStringParm _key, SSL_CTX *_ctx)
+	: key(_key), ctx(_ctx), refs(0), last_used(0), sessions(10)
+	{ wvssl_init(); }
+    ~WvSSLContext()
     {
-	seterr("Certificate + key pair invalid.");
-	return;
+	sessions.zap();
+	SSL_CTX_free(ctx);
+	wvssl_free();
     }
 
-    if (is_server && !x509)
+    static WvSSLContext *get(WvX509Mgr *x509, bool is_server, WvLog &debug,
+			     WvString &err);
+    static void release(WvSSLContext *c);
+
+    void save_session(WvStringParm server, SSL_SESSION *sess);
+    SSL_SESSION *find_session(WvStringParm server);
+    void forget_session(WvStringParm server);
+};
+
+DeclareWvList(WvSSLContext);
+
+static WvSSLContextList *contexts = NULL;
+static unsigned long context_uses = 0;
+
+
+WvSSLContext *WvSSLContext::get(WvX509Mgr *x509, bool is_server,
+				WvLog &debug, WvString &err)
+{
+    // the same certificate means the same context, even if it was loaded
+    // into a different WvX509Mgr
+    WvString key("%s/%s", is_server ? "server" : "client",
+		 x509 ? x509->get_fingerprint() : WvString(""));
+
+    if (contexts)
     {
-	seterr("Certificate not available: server mode not possible!");
-	return;
+	WvSSLContextList::Iter i(*contexts);
+	for (i.rewind(); i.next(); )
+	{
+	    if (i->key == key)
+	    {
+		i->refs++;
+		return i.ptr();
+	    }
+	}
     }
 
+    SSL_CTX *ctx;
     if (is_server)
     {
     	debug("Configured algorithms and methods for server mode.\n");
@@ -211,13 +268,10 @@ WvSSLStream::WvSSLStream(IWvStream *_slave, WvX509Mgr *_x509,
             ERR_print_errors_fp(stderr);
             debug("Can't get SSL context! Error: %s\n", 
                   ERR_reason_error_string(ERR_get_error()));
-	    seterr("Can't get SSL context!");
-	    return;
+	    err = "Can't get SSL context!";
+	    return NULL;
     	}
 	
-	// Allow SSL Writes to only write part of a request...
-	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
-
 	// Tell SSL to use 128 bit or better ciphers - this appears to
 	// be necessary for some reason... *sigh*
 	SSL_CTX_set_cipher_list(ctx, "HIGH");
@@ -228,12 +282,20 @@ WvSSLStream::WvSSLStream(IWvStream *_slave, WvX509Mgr *_x509,
 
 	if (!x509->bind_ssl(ctx))
 	{
-	    seterr("Unable to bind Certificate to SSL Context!");
-	    return;
+	    SSL_CTX_free(ctx);
+	    err = "Unable to bind Certificate to SSL Context!";
+	    return NULL;
 	}
 	
         SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER|SSL_VERIFY_CLIENT_ONCE, 
                                wv_verify_cb);
+
+	// Remember sessions (and hand out tickets) so clients can resume.
+	// openssl refuses to resume without a session id context when it's
+	// verifying peers.
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_set_session_id_context(ctx,
+		(const unsigned char *)"WvSSLStream", 11);
 	
 	debug("Server mode ready.\n");
     }
@@ -244,17 +306,272 @@ WvSSLStream::WvSSLStream(IWvStream *_slave, WvX509Mgr *_x509,
     	ctx = SSL_CTX_new(SSLv23_client_method());
     	if (!ctx)
     	{
-	    seterr("Can't get SSL context!");
-	    return;
+	    err = "Can't get SSL context!";
+	    return NULL;
     	}
         if (x509 && !x509->bind_ssl(ctx))
         {
-            seterr("Unable to bind Certificate to SSL Context!");
-            return;
+	    SSL_CTX_free(ctx);
+            err = "Unable to bind Certificate to SSL Context!";
+            return NULL;
         }
+
+	// we keep the sessions ourselves, by server address, since openssl
+	// doesn't know which session goes with which server.
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT
+				       | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, WvSSLStream::new_session_cb);
     }
+
+    // Allow SSL Writes to only write part of a request, and to retry
+    // from a different buffer (see uwrite())
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE
+		     | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+    // Read as much as the socket has, rather than one record at a time
+    SSL_CTX_set_read_ahead(ctx, 1);
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+    SSL_CTX_set_default_read_buffer_len(ctx, READ_BUFFER_LEN);
+#endif
+
+    if (!contexts)
+	contexts = new WvSSLContextList;
+    WvSSLContext *c = new WvSSLContext(key, ctx);
+    contexts->append(c, true);
+    c->refs++;
+    return c;
+}
+
+
+void WvSSLContext::release(WvSSLContext *c)
+{
+    if (--c->refs > 0)
+	return;
+    c->last_used = ++context_uses;
+
+    // forget the least recently used one if too many are sitting around
+    int idle = 0;
+    WvSSLContext *oldest = NULL;
+    WvSSLContextList::Iter i(*contexts);
+    for (i.rewind(); i.next(); )
+    {
+	if (i->refs)
+	    continue;
+	idle++;
+	if (!oldest || i->last_used < oldest->last_used)
+	    oldest = i.ptr();
+    }
+    if (idle > MAX_IDLE_CONTEXTS)
+	contexts->unlink(oldest);
+}
+
+
+void WvSSLContext::save_session(WvStringParm server, SSL_SESSION *sess)
+{
+    WvSSLSession *old = sessions[server];
+    if (old)
+	sessions.remove(old);
+    else if (sessions.count() >= MAX_CLIENT_SESSIONS)
+	sessions.zap();
+    sessions.add(new WvSSLSession(server, sess), true);
+}
+
+
+SSL_SESSION *WvSSLContext::find_session(WvStringParm server)
+{
+    WvSSLSession *s = sessions[server];
+    return s ? s->sess : NULL;
+}
+
+
+void WvSSLContext::forget_session(WvStringParm server)
+{
+    WvSSLSession *s = sessions[server];
+    if (s)
+	sessions.remove(s);
+}
+
+
+void WvSSLStream::flush_contexts()
+{
+    if (!contexts)
+	return;
+
+    WvSSLContextList::Iter i(*contexts);
+    for (i.rewind(); i.next(); )
+    {
+	if (!i->refs)
+	    i.xunlink();
+    }
+    if (contexts->isempty())
+    {
+	delete contexts;
+	contexts = NULL;
+    }
+}
+
+
+#define MAX_HANDSHAKE_ERRORS 4
+
+/** One step of a handshake, for a worker thread to do */
+class WvSSLHandshake : public WvWorkerJob
+{
+public:
+    SSL *ssl;
+    bool is_server;
+    int result, saved_errno;
+    unsigned long errors[MAX_HANDSHAKE_ERRORS + 1]; // zero-terminated
+
+    WvSSLHandshake(SSL *_ssl, bool _is_server)
+	: ssl(_ssl), is_server(_is_server), result(-1), saved_errno(0)
+	{ memset(errors, 0, sizeof(errors)); }
+    virtual void run();
+};
+
+
+void WvSSLHandshake::run()
+{
+    ERR_clear_error();
+    errno = 0;
+    if (is_server)
+	result = SSL_accept(ssl);
+    else
+	result = SSL_connect(ssl);
+    saved_errno = errno;
+
+    // the error queue belongs to this thread, so save what's in it
+    for (int i = 0; i < MAX_HANDSHAKE_ERRORS; i++)
+	errors[i] = ERR_get_error();
+    ERR_clear_error();
+#if !defined(WVSSL_NO_THREADS) && OPENSSL_VERSION_NUMBER < 0x10100000L
+    ERR_remove_thread_state(NULL);
+#endif
+}
+
+
+static int handshake_threads = 0;
+static WvWorkerPool hs_pool(0);
+
+
+#if !defined(WVSSL_NO_THREADS) && OPENSSL_VERSION_NUMBER < 0x10100000L
+// older versions of openssl have to be told how to lock things before
+// they're used from more than one thread.
+static pthread_mutex_t *ssl_locks = NULL;
+
+static void ssl_lock_cb(int mode, int n, const char *file, int line)
+{
+    if (mode & CRYPTO_LOCK)
+	pthread_mutex_lock(&ssl_locks[n]);
+    else
+	pthread_mutex_unlock(&ssl_locks[n]);
+}
+
+
+static unsigned long ssl_id_cb()
+{
+    return (unsigned long)pthread_self();
+}
+
+
+static void ssl_locking_init()
+{
+    if (ssl_locks || CRYPTO_get_locking_callback())
+	return; // somebody else already did it
+    ssl_locks = new pthread_mutex_t[CRYPTO_num_locks()];
+    for (int i = 0; i < CRYPTO_num_locks(); i++)
+	pthread_mutex_init(&ssl_locks[i], NULL);
+    CRYPTO_set_id_callback(ssl_id_cb);
+    CRYPTO_set_locking_callback(ssl_lock_cb);
+}
+#else
+static void ssl_locking_init()
+{
+}
+#endif
+
+
+void WvSSLStream::set_handshake_threads(int n)
+{
+    handshake_threads = n;
+    hs_pool.set_max_threads(n);
+}
+
+
+unsigned long WvSSLStream::threaded_handshakes()
+{
+    return hs_pool.jobs_run();
+}
+
+
+int WvSSLStream::new_session_cb(SSL *ssl, SSL_SESSION *sess)
+{
+    WvSSLStream *s = (WvSSLStream *)SSL_get_app_data(ssl);
+    if (!s || !s->shared || !s->session_key)
+	return 0; // openssl can free it
+
+    if (s->handshake)
+    {
+	// we're in a worker thread, and the cache isn't ours to touch
+	if (s->new_session)
+	    SSL_SESSION_free(s->new_session);
+	s->new_session = sess;
+	return 1;
+    }
+
+    s->shared->save_session(s->session_key, sess);
+    return 1; // it's ours now
+}
+
+
+WvSSLGlobalValidateCallback WvSSLStream::global_vcb = 0;
+
+WvSSLStream::WvSSLStream(IWvStream *_slave, WvX509Mgr *_x509,
+    WvSSLValidateCallback _vcb, bool _is_server) :
+    WvStreamClone(_slave),
+    debug(WvString("WvSSLStream %s", ++ssl_stream_count), WvLog::Debug5),
+    write_bouncebuf(MAX_BOUNCE_AMOUNT), write_started(false),
+    read_pending(false)
+{
+    x509 = _x509;
+    if (x509)
+	x509->addRef(); // openssl may keep a pointer to this object
+    
+    vcb = _vcb;
+    if (!vcb && global_vcb)
+	vcb = wv::bind(global_vcb, _1, this);;
+
+    is_server = _is_server;
+    ctx = NULL;
+    shared = NULL;
+    ssl = NULL;
+    //meth = NULL;
+    sslconnected = ssl_stop_read = ssl_stop_write = false;
+    threaded = false;
+    handshake = NULL;
+    new_session = NULL;
+    
+    wvssl_init();
     
-    //SSL_CTX_set_read_ahead(ctx, 1);
+    if (x509 && !x509->isok())
+    {
+	seterr("Certificate + key pair invalid.");
+	return;
+    }
+
+    if (is_server && !x509)
+    {
+	seterr("Certificate not available: server mode not possible!");
+	return;
+    }
+
+    WvString err;
+    shared = WvSSLContext::get(x509, is_server, debug, err);
+    if (!shared)
+    {
+	seterr(err);
+	return;
+    }
+    ctx = shared->ctx;
 
     ERR_clear_error();
     ssl = SSL_new(ctx);
@@ -263,6 +580,7 @@ WvSSLStream::WvSSLStream(IWvStream *_slave, WvX509Mgr *_x509,
     	seterr("Can't create SSL object!");
 	return;
     }
+    SSL_set_app_data(ssl, this);
 
     // If we set this, it seems we always verify the client... security hole,
     // no?  Well, if we don't set it, the server doesn't even ask the client
@@ -276,6 +594,12 @@ WvSSLStream::WvSSLStream(IWvStream *_slave, WvX509Mgr *_x509,
     connect_wants.readable = true;
     connect_wants.writable = true; // force ssl initiation ASAP
     connect_wants.isexception = false;
+
+    if (handshake_threads > 0)
+    {
+	ssl_locking_init();
+	threaded = hs_pool.open();
+    }
     debug("SSL stream initialized.\n");
 }
 
@@ -293,16 +617,16 @@ WvSSLStream::~WvSSLStream()
 }
 
 
-void WvSSLStream::printerr(WvStringParm func)
+void WvSSLStream::printerr(WvStringParm func, const unsigned long *errors)
 {
-    unsigned long l = ERR_get_error();
+    unsigned long l = errors ? *errors++ : ERR_get_error();
     char buf[121];      // man ERR_error_string says must be > 120.
 
     while (l)
     {
         ERR_error_string(l, buf);
         debug("%s error: %s\n", func, buf);
-        l = ERR_get_error();
+        l = errors ? *errors++ : ERR_get_error();
     }
 }
 
@@ -317,108 +641,79 @@ size_t WvSSLStream::uread(void *buf, size_t len)
     // the next time around unless we're sure there is nothing left
     read_pending = true;
     
+    // decrypt straight into the caller's buffer.  Once we have something,
+    // only keep going while openssl has the rest of a record on hand: when
+    // the other end disconnects, the next SSL_read() would give us an
+    // error before the caller gets the data we already have.  read_pending
+    // brings us back here for the next record.
     size_t total = 0;
-    for (;;)
+    while (total < len && (!total || SSL_pending(ssl) > 0))
     {
-        // handle SSL_read quirk
-        if (read_bouncebuf.used() != 0)
+	ERR_clear_error();
+        int result = SSL_read(ssl, (unsigned char *)buf + total, len - total);
+	// debug("<< SSL_read result %s for %s bytes\n", result, len - total);
+        if (result > 0)
         {
-            // copy out cached data
-            size_t amount = len < read_bouncebuf.used() ?
-                len : read_bouncebuf.used();
-            read_bouncebuf.move(buf, amount);
-
-            // locate next chunk in buffer
-            len -= amount;
-            total += amount;
-            if (len == 0)
-	    {
-		read_pending = false;
-                break;
-	    }
-            buf = (unsigned char *)buf + amount;
-	    
-	    // FIXME: this shouldn't be necessary, but it resolves weird
-	    // problems when the other end disconnects in the middle of
-	    // SSL negotiation, but only on emakela's machine.  I don't
-	    // know why.  -- apenwarr (2004/02/10)
-	    break;
+            total += result;
+            continue;
         }
 
-        // attempt to read
-        read_bouncebuf.zap(); // force use of same position in buffer
-        size_t avail = read_bouncebuf.free();
-        unsigned char *data = read_bouncebuf.alloc(avail);
-        
-	ERR_clear_error();
-        int result = SSL_read(ssl, data, avail);
-	// debug("<< SSL_read result %s for %s bytes (wanted %s)\n",
-	//      result, avail, len);
-        if (result <= 0)
-        {
-	    error_t err = errno;
-            read_bouncebuf.unalloc(avail);
-            int sslerrcode = SSL_get_error(ssl, result);
-	    switch (sslerrcode)
-            {
-                case SSL_ERROR_WANT_READ:
-		    debug("<< SSL_read() needs to wait for writable.\n");
-                    break; // wait for later
-                case SSL_ERROR_WANT_WRITE:
-		    debug("<< SSL_read() needs to wait for readable.\n");
-                    break; // wait for later
-                    
-                case SSL_ERROR_NONE:
-                    break; // no error, but can't make progress
-                    
-	        case SSL_ERROR_ZERO_RETURN:
-		    debug("<< EOF: zero return\n");
+	error_t err = errno;
+	int sslerrcode = SSL_get_error(ssl, result);
+	switch (sslerrcode)
+	{
+	    case SSL_ERROR_WANT_READ:
+		debug("<< SSL_read() needs to wait for writable.\n");
+		break; // wait for later
+	    case SSL_ERROR_WANT_WRITE:
+		debug("<< SSL_read() needs to wait for readable.\n");
+		break; // wait for later
 		
-		    // don't do this if we're returning nonzero!
-		    // (SSL has no way to do a one-way shutdown, so if SSL
-		    // detects a read problem, it's also a write problem.)
-		    if (!total) { noread(); nowrite(); }
-                    break;
-
-		case SSL_ERROR_SYSCALL:
-		    if (!err)
-		    {
-			if (result == 0)
-			{
-			    debug("<< EOF: syscall error "
-				  "(%s/%s, %s/%s) total=%s\n",
-				  stop_read, stop_write,
-				  isok(), cloned && cloned->isok(), total);
-			    
-			    // don't do this if we're returning nonzero!
-			    // (SSL has no way to do a one-way shutdown, so
-			    // if SSL detects a read problem, it's also a
-			    // write problem.)
-			    if (!total) { noread(); nowrite(); }
-			}
-		    }
-		    else
+	    case SSL_ERROR_NONE:
+		break; // no error, but can't make progress
+		
+	    case SSL_ERROR_ZERO_RETURN:
+		debug("<< EOF: zero return\n");
+	    
+		// don't do this if we're returning nonzero!
+		// (SSL has no way to do a one-way shutdown, so if SSL
+		// detects a read problem, it's also a write problem.)
+		if (!total) { noread(); nowrite(); }
+		break;
+
+	    case SSL_ERROR_SYSCALL:
+		if (!err)
+		{
+		    if (result == 0)
 		    {
-			debug("<< SSL_read() err=%s (%s)\n",
-			    err, strerror(err));
-			seterr_both(err, WvString("SSL read: %s",
-			    strerror(err)));
+			debug("<< EOF: syscall error "
+			      "(%s/%s, %s/%s) total=%s\n",
+			      stop_read, stop_write,
+			      isok(), cloned && cloned->isok(), total);
+			
+			// don't do this if we're returning nonzero!
+			// (SSL has no way to do a one-way shutdown, so
+			// if SSL detects a read problem, it's also a
+			// write problem.)
+			if (!total) { noread(); nowrite(); }
 		    }
-		    break;
-                    
-                default:
-                    printerr("SSL_read");
-                    seterr("SSL read error #%s", sslerrcode);
-                    break;
-            }
-            read_pending = false;
-            break; // wait for next iteration
-        }
-	// debug("<< read result was %s\n", result);
-	
-	if (result < 0)
-	    result = 0;
-        read_bouncebuf.unalloc(avail - result);
+		}
+		else
+		{
+		    debug("<< SSL_read() err=%s (%s)\n",
+			err, strerror(err));
+		    seterr_both(err, WvString("SSL read: %s",
+			strerror(err)));
+		}
+		break;
+		
+	    default:
+		printerr("SSL_read");
+		seterr("SSL read error #%s", sslerrcode);
+		break;
+	}
+	read_pending = false;
+	break; // wait for next iteration
     }
 
     // debug("<< read %s bytes (%s, %s)\n",
@@ -441,106 +736,41 @@ size_t WvSSLStream::uwrite(const void *buf, size_t len)
 //    debug(">> I want to write %s bytes.\n", len);
 
     size_t total = 0;
-    
-    // eat any data that was precached and already written
-    if (write_eat >= len)
+    while (len)
     {
-        write_eat -= len;
-        total = len;
-        len = 0;
-    }
-    else
-    {
-        buf = (const unsigned char *)buf + write_eat;
-        total = write_eat;
-        len -= write_eat;
-        write_eat = 0;
-    }
+	// small writes get collected into one record, which goes out when
+	// it's full or when we're about to select()
+	if (len < COALESCE_LIMIT && !write_started
+	    && len <= write_bouncebuf.free())
+	{
+	    write_bouncebuf.put(buf, len);
+	    total += len;
+	    if (!write_bouncebuf.free())
+		flush_bouncebuf();
+	    break;
+	}
 
-    // FIXME: WOW!!! Ummm... hope this never spins...
-    // 
-    for (;;) 
-    {
-        // handle SSL_write quirk
-        if (write_bouncebuf.used() == 0)
-        {
-            if (len == 0) break;
-
-            // copy new data into the bounce buffer only if empty
-            // if it were not empty, then SSL_write probably returned
-            // SSL_ERROR_WANT_WRITE on the previous call and we
-            // must invoke it with precisely the same arguments
-            size_t amount = len < write_bouncebuf.free() ?
-                len : write_bouncebuf.free();
-            write_bouncebuf.put(buf, amount);
-            // note: we don't adjust the total yet...
-        } // otherwise we use what we cached last time in bounce buffer
-        
-        // attempt to write
-        size_t used = write_bouncebuf.used();
-        const unsigned char *data = write_bouncebuf.get(used);
+	// anything collected earlier has to go first
+	if (!flush_bouncebuf())
+	    break;
+	if (len < COALESCE_LIMIT)
+	    continue; // there's room to collect it now
+
+	size_t amount = len < MAX_BOUNCE_AMOUNT ? len : MAX_BOUNCE_AMOUNT;
+	int result = ssl_write(buf, amount);
+	if (result == 0)
+	{
+	    // openssl has already started a record with this data, and
+	    // needs precisely the same data again next time.  Keep a copy,
+	    // since the caller won't necessarily give us the same thing.
+	    write_bouncebuf.put(buf, amount);
+	    write_started = true;
+	    total += amount;
+	    break;
+	}
+	else if (result < 0)
+	    break;
 
-        ERR_clear_error();
-        int result = SSL_write(ssl, data, used);
-	// debug("<< SSL_write result %s for %s bytes\n",
-	//      result, used);
-        if (result <= 0)
-        {
-            int sslerrcode = SSL_get_error(ssl, result);
-            write_bouncebuf.unget(used);
-            switch (sslerrcode)
-            {
-                case SSL_ERROR_WANT_READ:
-                    debug(">> SSL_write() needs to wait for readable.\n");
-                    break; // wait for later
-                case SSL_ERROR_WANT_WRITE:
-                    // debug(">> SSL_write() needs to wait for writable.\n");
-                    break; // wait for later
-                    
-	        case SSL_ERROR_SYSCALL:
-		    debug(">> ERROR: SSL_write() failed on socket error.\n");
-		    seterr(WvString("SSL write error: %s", strerror(errno)));
-		    break;
-	    
-	        // This case can cause truncated web pages... give more info
-	        case SSL_ERROR_SSL:
-		    debug(">> ERROR: SSL_write() failed on internal error.\n");
-		    seterr(WvString("SSL write error: %s", 
-				    ERR_error_string(ERR_get_error(), NULL)));
-		    break;
-		
-	        case SSL_ERROR_NONE:
-                    break; // no error, but can't make progress
-                    
-                case SSL_ERROR_ZERO_RETURN:
-		    debug(">> SSL_write zero return: EOF\n");
-                    close(); // EOF
-                    break;
-                    
-                default:
-                    printerr("SSL_write");
-                    seterr(WvString("SSL write error #%s", sslerrcode));
-                    break;
-            }
-            break; // wait for next iteration
-        }
-	else
-	    assert((size_t)result == used);
-        write_bouncebuf.zap(); // force use of same position in buffer
-        
-        // locate next chunk to be written
-        // note: we assume that initial contents of buf and of the
-        //       bouncebuf match since if we got SSL_ERROR_WANT_WRITE
-        //       we did not claim to actually have written the chunk
-        //       that we cached so we will have gotten it again here
-        if (size_t(result) >= len)
-        {
-            // if we cached more previously than we were given, claim
-            // we wrote what we got and remember to eat the rest later
-            write_eat = result - len;
-            total += len;
-            break;
-        }
         total += size_t(result);
         len -= size_t(result);
         buf = (const unsigned char *)buf + size_t(result);
@@ -550,10 +780,124 @@ size_t WvSSLStream::uwrite(const void *buf, size_t len)
     return total;
 }
 
+
+int WvSSLStream::ssl_write(const void *buf, size_t len)
+{
+    ERR_clear_error();
+    int result = SSL_write(ssl, buf, len);
+    // debug("<< SSL_write result %s for %s bytes\n", result, len);
+    if (result > 0)
+	return result;
+
+    int sslerrcode = SSL_get_error(ssl, result);
+    switch (sslerrcode)
+    {
+	case SSL_ERROR_WANT_READ:
+	    debug(">> SSL_write() needs to wait for readable.\n");
+	    return 0; // wait for later
+	case SSL_ERROR_WANT_WRITE:
+	    // debug(">> SSL_write() needs to wait for writable.\n");
+	    return 0; // wait for later
+	    
+	case SSL_ERROR_SYSCALL:
+	    debug(">> ERROR: SSL_write() failed on socket error.\n");
+	    seterr(WvString("SSL write error: %s", strerror(errno)));
+	    break;
+    
+	// This case can cause truncated web pages... give more info
+	case SSL_ERROR_SSL:
+	    debug(">> ERROR: SSL_write() failed on internal error.\n");
+	    seterr(WvString("SSL write error: %s", 
+			    ERR_error_string(ERR_get_error(), NULL)));
+	    break;
+	
+	case SSL_ERROR_NONE:
+	    return 0; // no error, but can't make progress
+	    
+	case SSL_ERROR_ZERO_RETURN:
+	    debug(">> SSL_write zero return: EOF\n");
+	    close(); // EOF
+	    break;
+	    
+	default:
+	    printerr("SSL_write");
+	    seterr(WvString("SSL write error #%s", sslerrcode));
+	    break;
+    }
+    return -1;
+}
+
+
+bool WvSSLStream::flush_bouncebuf()
+{
+    size_t used = write_bouncebuf.used();
+    if (!used)
+	return true;
+    if (!sslconnected || !ssl)
+	return false;
+
+    const unsigned char *data = write_bouncebuf.get(used);
+    int result = ssl_write(data, used);
+    if (result <= 0)
+    {
+	write_bouncebuf.unget(used);
+	if (result == 0)
+	    write_started = true; // must offer exactly this again
+	return false;
+    }
+
+    // a partial write is only possible if the peer asked for small
+    // records, and then the rest hasn't been started yet
+    write_bouncebuf.unget(used - result);
+    write_started = false;
+    if (write_bouncebuf.used())
+	return false;
+    write_bouncebuf.zap(); // start at the beginning of the buffer again
+    return true;
+}
+
+
+bool WvSSLStream::flush_internal(time_t msec_timeout)
+{
+    // the records we collected have to go before anything in outbuf
+    WvTime stoptime = msecadd(wvtime(), msec_timeout);
+    while (!flush_bouncebuf() && isok())
+    {
+	if (!msec_timeout)
+	    return false;
+	if (msec_timeout >= 0
+	  && (stoptime < wvtime() || !select(msec_timeout, false, true)))
+	    return false;
+    }
+    return WvStreamClone::flush_internal(msec_timeout);
+}
+
+
 void WvSSLStream::close()
 {
     debug("Closing SSL connection (ok=%s,sr=%s,sw=%s,child=%s).\n",
 	  isok(), stop_read, stop_write, cloned && cloned->isok());
+
+    // one last try at sending what we collected
+    flush_bouncebuf();
+
+    if (handshake)
+    {
+	// a worker thread is still using ssl, and it won't take long
+	hs_pool.wait(handshake);
+	delete handshake;
+	handshake = NULL;
+    }
+    if (new_session)
+    {
+	SSL_SESSION_free(new_session);
+	new_session = NULL;
+    }
+    if (threaded)
+    {
+	hs_pool.close();
+	threaded = false;
+    }
     
     if (ssl)
     {
@@ -566,9 +910,10 @@ void WvSSLStream::close()
     
     WvStreamClone::close();
     
-    if (ctx)
+    if (shared)
     {
-	SSL_CTX_free(ctx);
+	WvSSLContext::release(shared);
+	shared = NULL;
 	ctx = NULL;
     }
 }
@@ -580,6 +925,12 @@ bool WvSSLStream::isok() const
 }
 
 
+bool WvSSLStream::session_reused() const
+{
+    return ssl && !handshake && SSL_session_reused(ssl);
+}
+
+
 void WvSSLStream::noread()
 {
     // WARNING: openssl always needs two-way socket communications even for
@@ -599,6 +950,7 @@ void WvSSLStream::noread()
 void WvSSLStream::nowrite()
 {
     // WARNING: see note in noread()
+    flush_bouncebuf();
     ssl_stop_write = true;
     if (ssl_stop_read)
     {
@@ -612,15 +964,37 @@ void WvSSLStream::pre_select(SelectInfo &si)
 {
     SelectRequest oldwant = si.wants;
     bool oldinherit = si.inherit_request;
+
+    if (handshake)
+    {
+	// a worker thread has the socket, so wait for it instead
+	si.wants = SelectRequest(false, false);
+	si.inherit_request = true;
+	WvStream::pre_select(si);
+	int fd = hs_pool.getfd();
+	if (fd < 0 || hs_pool.isdone(handshake))
+	    si.msec_timeout = 0;
+	else
+	{
+	    FD_SET(fd, &si.read);
+	    if (fd > si.max_fd)
+		si.max_fd = fd;
+	}
+	si.inherit_request = oldinherit;
+	si.wants = oldwant;
+	return;
+    }
+
     if (!sslconnected)
     {
 	si.wants = connect_wants;
 	si.inherit_request = true; // ignore force_select() until connected
     }
+    else if (!flush_bouncebuf())
+	si.wants.writable = true; // a record still needs to go out
     
     // the SSL library might be keeping its own internal buffers
-    // or we might have left buffered data behind deliberately
-    if (si.wants.readable && (read_pending || read_bouncebuf.used()))
+    if (si.wants.readable && read_pending)
     {
 	// debug("pre_select: try reading again immediately.\n");
 	si.msec_timeout = 0;
@@ -639,6 +1013,29 @@ bool WvSSLStream::post_select(SelectInfo &si)
 {
     SelectRequest oldwant = si.wants;
     bool oldinherit = si.inherit_request;
+
+    if (handshake)
+    {
+	si.wants = SelectRequest(false, false);
+	si.inherit_request = true;
+	WvStream::post_select(si);
+	si.inherit_request = oldinherit;
+	si.wants = oldwant;
+
+	if (hs_pool.finished(handshake))
+	{
+	    WvSSLHandshake *job = handshake;
+	    handshake = NULL;
+	    if (new_session)
+	    {
+		shared->save_session(session_key, new_session);
+		new_session = NULL;
+	    }
+	    handshake_done(job->result, job->saved_errno, job->errors);
+	    delete job;
+	}
+	return false;
+    }
     
     if (!sslconnected)
     {
@@ -650,6 +1047,9 @@ bool WvSSLStream::post_select(SelectInfo &si)
     si.wants = oldwant;
     si.inherit_request = oldinherit;
 
+    if (sslconnected)
+	flush_bouncebuf();
+
     // SSL takes a few round trips to
     // initialize itself, and we mustn't block in the constructor, so keep
     // trying here... it is also turning into a rather cool place
@@ -661,6 +1061,18 @@ bool WvSSLStream::post_select(SelectInfo &si)
 	    cloned->iswritable(), si.wants.writable,
 	    si.msec_timeout);
 	
+	// the first time through, offer the last session we had with this
+	// server, if there was one
+	if (!is_server && connect_wants.writable && src())
+	{
+	    session_key = *src();
+	    SSL_SESSION *sess = shared->find_session(session_key);
+	    if (sess)
+	    {
+		debug("Trying to resume the last session.\n");
+		SSL_set_session(ssl, sess);
+	    }
+	}
 	connect_wants.writable = false;
 	
 	// for ssl streams to work, we have to be cloning a stream that
@@ -672,6 +1084,16 @@ bool WvSSLStream::post_select(SelectInfo &si)
 	SSL_set_fd(ssl, fd);
 //	debug("SSL connected on fd %s.\n", fd);
 	
+	if (threaded)
+	{
+	    // the key exchange is the slow part, so let a worker do it
+	    handshake = new WvSSLHandshake(ssl, is_server);
+	    if (hs_pool.submit(handshake))
+		return false;
+	    delete handshake;
+	    handshake = NULL;
+	}
+	
 	int err;
     
 	if (is_server)
@@ -683,68 +1105,83 @@ bool WvSSLStream::post_select(SelectInfo &si)
 	else
 	    err = SSL_connect(ssl);
 	
-	if (err < 0)
+	handshake_done(err, errno);
+	return false;
+    }
+
+    if ((si.wants.readable || readcb) && read_pending)
+	result = true;
+
+    return result;
+}
+
+
+void WvSSLStream::handshake_done(int err, int saved_errno,
+				 const unsigned long *errors)
+{
+    if (!isok())
+	return;
+
+    if (err < 0)
+    {
+	if (saved_errno == EAGAIN)
+	    debug("Still waiting for SSL negotiation.\n");
+	else
 	{
-	    if (errno == EAGAIN)
-		debug("Still waiting for SSL negotiation.\n");
-	    else if (!errno)
-            {
-                printerr(is_server ? "SSL_accept" : "SSL_connect");
+	    printerr(is_server ? "SSL_accept" : "SSL_connect", errors);
+	    if (!saved_errno)
 		seterr(WvString("SSL negotiation failed (%s)!", err));
-            }
 	    else
-            {
-                printerr(is_server ? "SSL_accept" : "SSL_connect");
-		seterr(errno);
-            }
+		seterr(saved_errno);
+
+	    // don't offer the same session next time
+	    if (!!session_key)
+		shared->forget_session(session_key);
 	}
-	else  // We're connected, so let's do some checks ;)
-	{
-	    debug("SSL connection using cipher %s.\n", SSL_get_cipher(ssl));
+    }
+    else  // We're connected, so let's do some checks ;)
+    {
+	debug("SSL connection using cipher %s.\n", SSL_get_cipher(ssl));
 
-	    WvX509 *peercert = new WvX509(SSL_get_peer_certificate(ssl));
-	    //Should we try to validate before storing, or not?
-	    if (peercert->isok() && peercert->validate())
-		setattr("peercert", peercert->encode(WvX509::CertPEM));
-	    if (!!vcb)
+	WvX509 *peercert = new WvX509(SSL_get_peer_certificate(ssl));
+	//Should we try to validate before storing, or not?
+	if (peercert->isok() && peercert->validate())
+	    setattr("peercert", peercert->encode(WvX509::CertPEM));
+	if (!!vcb)
+	{
+	    debug("SSL Peer is: %s\n", peercert->get_subject());
+	    if (peercert->isok() && peercert->validate() && vcb(peercert))
 	    {
-		debug("SSL Peer is: %s\n", peercert->get_subject());
-	    	if (peercert->isok() && peercert->validate() && vcb(peercert))
-	    	{
-                    setconnected(true);
-	    	    debug("SSL finished negotiating - certificate is valid.\n");
-	    	}
-	    	else
-	    	{
-		    if (!peercert->isok())
-			seterr("Peer cert: %s", peercert->errstr());
-		    else
-			seterr("Peer certificate is invalid!");
-	    	}
+		setconnected(true);
+		debug("SSL finished negotiating - certificate is valid.\n");
 	    }
 	    else
 	    {
-                setconnected(true);
-		debug("SSL finished negotiating "
-		      "- certificate validation disabled.\n");
-	    }	
-	    WVRELEASE(peercert);
-	} 
-	
-	return false;
-    }
-
-    if ((si.wants.readable || readcb)
-	&& (read_pending || read_bouncebuf.used()))
-	result = true;
-
-    return result;
+		if (!peercert->isok())
+		    seterr("Peer cert: %s", peercert->errstr());
+		else
+		    seterr("Peer certificate is invalid!");
+	    }
+	}
+	else
+	{
+	    setconnected(true);
+	    debug("SSL finished negotiating "
+		  "- certificate validation disabled.\n");
+	}	
+	WVRELEASE(peercert);
+    } 
 }
 
 
 void WvSSLStream::setconnected(bool conn)
 {
     sslconnected = conn;
-    if (conn) write(unconnected_buf);
+    if (conn)
+    {
+	// with read-ahead, the handshake may have swallowed some data
+	read_pending = true;
+	write(unconnected_buf);
+    }
 }
     
@@ -10,6 +10,7 @@
 #include "unitempgen.h"
 #include "uniconftree.h"
 #include "wvlog.h"
+#include "wvscatterhash.h"
 
 /**
  * A UniConf generator that adds a cache layer on top of another generator
@@ -19,6 +20,14 @@
  * that a read-only uniconfclient, when cached, will never actively contact
  * the uniconfdaemon.
  *
+ * In lazy mode (moniker prefix "lazycache:"), nothing is preloaded.
+ * Instead, each top-level branch is fetched from the inner generator with
+ * a single recursiveiterator() the first time anything inside it is
+ * asked for.  If 'max_keys' is nonzero, the least recently used branches
+ * are dropped again whenever more than that many keys are in memory.
+ * Branches that aren't in memory still get their notifications passed
+ * through.
+ *
  * **WARNING**
  * The cache *will* go out of date if used with a uniconfclient/daemon without
  * running a select loop.
@@ -30,11 +39,37 @@ protected:
     IUniConfGen *inner;
     bool refreshed_once; //< we cache forever, so no need to re-refresh()
 
+    /** A top-level branch that has been loaded in lazy mode. */
+    struct Branch
+    {
+        UniConfKey key;
+        size_t numkeys;
+        unsigned long lastused;
+
+        Branch(const UniConfKey &_key, size_t _numkeys)
+            : key(_key), numkeys(_numkeys), lastused(0)
+            { }
+    };
+    DeclareWvScatterDict(Branch, UniConfKey, key);
+
+    bool lazy;
+    size_t max_keys; //< 0 means no limit
+    bool root_loaded; //< the top-level keys are known
+    BranchDict branches;
+    size_t resident_keys;
+    unsigned long usecount;
+
     void loadtree(const UniConfKey &key = "");
     void deltacallback(const UniConfKey &key, WvStringParm value);
 
+    void fault_in(const UniConfKey &key);
+    void load_root();
+    size_t load_branch(const UniConfKey &branch);
+    void evict();
+    void store(const UniConfKey &key, WvStringParm value);
+
 public:
-    UniCacheGen(IUniConfGen *_inner);
+    UniCacheGen(IUniConfGen *_inner, bool _lazy = false, size_t _max_keys = 0);
     virtual ~UniCacheGen();
 
     /***** Overridden members *****/
@@ -43,6 +78,11 @@ public:
     virtual void commit();
     virtual void set(const UniConfKey &key, WvStringParm value);
     virtual WvString get(const UniConfKey &key);
+    virtual bool haschildren(const UniConfKey &key);
+    virtual Iter *iterator(const UniConfKey &key);
+
+    /** Returns true if the branch containing 'key' is in memory. */
+    bool isresident(const UniConfKey &key);
 };
 
 #endif // __UNICACHEGEN_H
@@ -0,0 +1,187 @@
+/* -*- Mode: C++ -*-
+ * Worldvisions Weaver Software:
+ *   Copyright (C) 1997-2002 Net Integration Technologies, Inc.
+ *
+ * UniConf low-level tree storage abstraction, optimized for size.
+ */
+#ifndef __UNICOMPACTTREE_H
+#define __UNICOMPACTTREE_H
+
+#include "uniconfkey.h"
+#include "wvtr1.h"
+#include "wvscatterhash.h"
+
+class UniCompactTreeBase;
+
+// parameters: a node (won't be NULL), userdata
+typedef wv::function<void(const UniCompactTreeBase*,
+			  void*)> UniCompactTreeBaseVisitor;
+// parameters: 1st node (may be NULL), 2nd node (may be NULL), userdata
+typedef wv::function<bool(const UniCompactTreeBase*,
+			  const UniCompactTreeBase*)> UniCompactTreeBaseComparator;
+
+/**
+ * A replacement for UniHashTreeBase, for use as the second parameter of
+ * UniConfTree, that needs a lot less memory per node:
+ *
+ * - Keys are interned, so every node named "foo" shares the same
+ *   UniConfKey instead of keeping its own copy.
+ * - Children live in a sorted array, and only get a hash table index
+ *   once there are more than HASH_THRESHOLD of them.
+ * - Nodes are carved out of big blocks instead of being allocated one
+ *   at a time, which saves the malloc() overhead.
+ *
+ * As a bonus, children are always iterated in sorted order.  Don't add
+ * or remove children of a node while iterating over them.
+ */
+class UniCompactTreeBase
+{
+public:
+    class Container;
+
+protected:
+    typedef UniCompactTreeBaseVisitor BaseVisitor;
+    typedef UniCompactTreeBaseComparator BaseComparator;
+
+public:
+    ~UniCompactTreeBase();
+
+    /** Returns the key field. */
+    const UniConfKey &key() const
+        { return xname->key; }
+
+    /** Returns true if the node has children. */
+    bool haschildren() const;
+
+    static void *operator new(size_t size);
+    static void operator delete(void *p, size_t size);
+
+protected:
+    UniCompactTreeBase(UniCompactTreeBase *parent, const UniConfKey &key);
+
+    UniConfKey _fullkey(const UniCompactTreeBase *ancestor = NULL) const;
+    UniCompactTreeBase *_find(const UniConfKey &key) const;
+    UniCompactTreeBase *_findchild(const UniConfKey &key) const;
+
+    static bool _recursivecompare(
+        const UniCompactTreeBase *a, const UniCompactTreeBase *b,
+        const UniCompactTreeBaseComparator &comparator);
+
+    static void _recursive_unsorted_visit(
+        const UniCompactTreeBase *a,
+        const UniCompactTreeBaseVisitor &visitor, void *userdata,
+	bool preorder, bool postorder);
+
+    UniCompactTreeBase *xparent; /*!< the parent of this subtree */
+    Container *xchildren; /*!< the sorted children, or NULL if none */
+
+private:
+    /** A key shared by all the nodes with exactly the same name. */
+    struct Name
+    {
+        WvString str;
+        UniConfKey key;
+        unsigned int refs;
+
+        Name(WvStringParm _str) : str(_str), key(_str), refs(0)
+            { }
+    };
+
+    struct NameAccessor
+    {
+        static const WvString *get_key(const Name *obj)
+            { return &obj->str; }
+    };
+    typedef WvScatterHash<Name, WvString, NameAccessor> NameTable;
+    static NameTable *names;
+
+    static Name *intern(const UniConfKey &key);
+    static void release(Name *name);
+
+    void _setparent(UniCompactTreeBase *parent);
+    UniCompactTreeBase *_root() const;
+
+    /** Called by a child to link itself to this node. */
+    void link(UniCompactTreeBase *node);
+
+    /** Called by a child to unlink itself from this node. */
+    void unlink(UniCompactTreeBase *node);
+
+    Name *xname;   /*!< the (shared) name of this entry */
+
+protected:
+    class Iter;
+    friend class Iter;
+
+    // the children are always sorted, so this is the same thing
+    typedef Iter SortedIter;
+};
+
+
+/**
+ * The children of a UniCompactTreeBase node, kept sorted by key.
+ */
+class UniCompactTreeBase::Container
+{
+    struct Accessor
+    {
+        static const UniConfKey *get_key(const UniCompactTreeBase *obj)
+            { return &obj->key(); }
+    };
+    typedef WvScatterHash<UniCompactTreeBase, UniConfKey, Accessor> Index;
+
+    UniCompactTreeBase **vec;
+    unsigned int used, size;
+    Index *index; /*!< only exists if used > HASH_THRESHOLD */
+
+    /** Returns the slot where 'key' is, or where it should be inserted. */
+    unsigned int search(const UniConfKey &key, bool &found) const;
+
+public:
+    enum { HASH_THRESHOLD = 16 };
+
+    Container();
+    ~Container();
+
+    size_t count() const
+        { return used; }
+    bool isempty() const
+        { return !used; }
+
+    UniCompactTreeBase *operator[] (const UniConfKey &key) const;
+    void add(UniCompactTreeBase *node);
+    void remove(UniCompactTreeBase *node);
+
+    /** Iterates over the children in sorted order. */
+    class Iter
+    {
+        const Container *c;
+        unsigned int i;
+    public:
+        Iter(const Container *_c) : c(_c), i(0)
+            { }
+        Iter(const Container &_c) : c(&_c), i(0)
+            { }
+
+        void rewind()
+            { i = 0; }
+        bool cur() const
+            { return c && i > 0 && i <= c->used; }
+        bool next()
+            { i++; return cur(); }
+        UniCompactTreeBase *ptr() const
+            { return c->vec[i-1]; }
+
+        WvIterStuff(UniCompactTreeBase);
+    };
+    friend class Iter;
+};
+
+
+class UniCompactTreeBase::Iter : public UniCompactTreeBase::Container::Iter
+{
+public:
+    Iter(UniCompactTreeBase &b) : Container::Iter(b.xchildren) { }
+};
+
+#endif //__UNICOMPACTTREE_H
@@ -453,6 +453,10 @@ public:
         return true;
     }
     
+    /** Returns true if the children come out sorted by key. */
+    bool sorted() const
+        { return it->sorted(); }
+    
     // FIXME: this is a speed optimization only.  Don't use this unless
     // you're apenwarr.  It will change.
     WvString _value() const
@@ -539,6 +543,10 @@ private:
  * to be of use here.  The main problem is that UniConf::Iter and company
  * return pointers to temporary objects whereas WvSorter assumes that the
  * pointers will remain valid for the lifetime of the iterator.
+ *
+ * If the generator already returns the keys in the order we want (see
+ * UniConfGen::Iter::sorted()), SortedIter just walks them directly,
+ * without copying or sorting anything.
  */
 class UniConf::SortedIterBase : public UniConf::IterBase
 {
@@ -557,6 +565,7 @@ private:
     Comparator xcomparator;
     int index;
     int count;
+    UniConf::Iter *direct; /*!< already sorted, so just use this */
     
     void _purge();
     void _rewind();
@@ -572,6 +581,8 @@ protected:
             xkeys.push_back(*i);
         _rewind();
     }
+
+    void populate(UniConf::Iter &i);
 };
 
 
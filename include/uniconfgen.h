@@ -9,6 +9,7 @@
  
 #include "uniconfpair.h"
 #include "wvcallbacklist.h"
+#include "wvscatterhash.h"
 #include "wvtr1.h"
 
 class UniConfGen;
@@ -192,6 +193,20 @@ DEFINE_IID(IUniConfGen, {0x7ca76e98, 0xb694, 0x43ca,
     {0xb0, 0x56, 0x8b, 0x9d, 0xde, 0x9a, 0xbe, 0x9f}});
 
 
+/** The newest pending delta for a key, and when it was queued */
+struct UniConfPendingDelta
+{
+    UniConfKey key;
+    UniConfPair *pair;
+    unsigned int seq;
+
+    UniConfPendingDelta(const UniConfKey &_key, UniConfPair *_pair,
+			unsigned int _seq)
+	: key(_key), pair(_pair), seq(_seq) { }
+};
+
+DeclareWvScatterDict(UniConfPendingDelta, UniConfKey, key);
+
 /**
  * A default implementation of IUniConfGen, providing various handy features
  * that save trouble when implementing typical generators.
@@ -206,6 +221,10 @@ class UniConfGen : public IUniConfGen
     WvCallbackList<UniConfGenCallback> cblist;
     int hold_nesting;
     UniConfPairList deltas;
+    UniConfPendingDeltaDict *delta_index;
+    unsigned int delta_seq;
+
+    bool parent_changed_since(const UniConfKey &key, unsigned int seq);
     
 protected:
     /** Creates a UniConfGen object. */
@@ -347,6 +366,13 @@ public:
      * but maybe your generator has a more efficient way.
      */
     virtual WvString value() const = 0;
+
+    /**
+     * Returns true if next() returns the keys in UniConfKey::compareto()
+     * order, so that anyone who wants them sorted doesn't have to.
+     */
+    virtual bool sorted() const
+        { return false; }
 };
 
 
@@ -363,6 +389,7 @@ public:
     virtual bool next() { return false; }
     virtual UniConfKey key() const { return UniConfKey::EMPTY; }
     virtual WvString value() const { return WvString(); }
+    virtual bool sorted() const { return true; }
 };
 
 
@@ -37,25 +37,86 @@
  */
 class UniConfKey
 {
-    class Segment : public WvString
+    /**
+     * An interned path segment.  All the segments with exactly the same
+     * name share one Name, and all the Names that differ only in case
+     * share the same 'folded' Name, so comparing two segments is just
+     * comparing two pointers.
+     */
+    struct Name
+    {
+        WvString str;
+        Name *folded; /*!< the all-lowercase version of this Name */
+        unsigned int hash;
+        unsigned int refs;
+        bool wild;
+    };
+    class NameTable;
+    static NameTable *names;
+
+    static Name *intern(WvStringParm str);
+    static void free_name(Name *name);
+    static void release(Name *name)
+    {
+        if (--name->refs == 0)
+            free_name(name);
+    }
+
+    class Segment
     {
+        Name *name; /*!< NULL for the empty segment */
     public:
         Segment() :
-            WvString(WvString::empty)
+            name(NULL)
         {
         }
         Segment(WvStringParm str) :
-            WvString((!str)? WvString::empty: str)
+            name(intern(str))
         {
         }
         Segment(const Segment &segment) :
-            WvString(segment)
+            name(segment.name)
+        {
+            if (name)
+                name->refs++;
+        }
+        ~Segment()
+        {
+            if (name)
+                release(name);
+        }
+        Segment &operator= (const Segment &segment)
         {
+            if (segment.name)
+                segment.name->refs++;
+            if (name)
+                release(name);
+            name = segment.name;
+            return *this;
         }
         
+        bool operator! () const
+        {
+            return !name;
+        }
         bool iswild() const
         {
-            return *this == "*" || *this == "...";
+            return name && name->wild;
+        }
+        const WvString &str() const
+        {
+            return name ? name->str : WvString::empty;
+        }
+        unsigned int hash() const
+        {
+            return name ? name->hash : 0;
+        }
+        
+        /** Returns true if the segments are equal, ignoring case. */
+        bool sameas(const Segment &segment) const
+        {
+            return (name ? name->folded : NULL)
+                == (segment.name ? segment.name->folded : NULL);
         }
     };
 
@@ -167,6 +228,16 @@ class UniConfKey
     void normalize();
     UniConfKey &collapse();
 
+    /** Returns true if the first n segments of both keys are equal. */
+    bool samesegments(const UniConfKey &other, int n) const
+    {
+        for (int i = 0; i < n; ++i)
+            if (!store->segments[left + i].sameas(
+                    other.store->segments[other.left + i]))
+                return false;
+        return true;
+    }
+
 public:
     static UniConfKey EMPTY; /*!< represents "" (root) */
     static UniConfKey ANY;   /*!< represents "*" */
@@ -433,7 +504,8 @@ public:
      * Returns: true in that case
      */
     bool operator== (const UniConfKey &other) const
-        { return compareto(other) == 0; }
+        { return right - left == other.right - other.left
+                && samesegments(other, right - left); }
         
     /**
      * Determines if two paths are unequal.
@@ -441,7 +513,7 @@ public:
      * Returns: true in that case
      */
     bool operator!= (const UniConfKey &other) const
-        { return compareto(other) != 0; }
+        { return !(*this == other); }
 
     /**
      * Determines if this path precedes the other lexicographically.
@@ -141,6 +141,8 @@ private:
      *   key - the key that changed
      */
     void deletioncheck(UniWatchInfoTree *node, const UniConfKey &key);
+    void deletioncheck(UniWatchInfoTree *top, UniWatchInfoTree *node,
+		       const UniConfKey &key);
 
     /** Prunes a branch of the watch tree. */
     void prune(UniWatchInfoTree *node);
@@ -9,6 +9,7 @@
 
 #include "uniconfkey.h"
 #include "unihashtree.h"
+#include "unicompacttree.h"
 #include "wvtr1.h"
 
 /**
@@ -18,9 +19,11 @@
  * Someday this could be further abstracted into a generic WvTreeDict.
  *
  * "Sub" is the name of the concrete subclass of UniConfTree.
+ * "Base" is the node storage: UniHashTreeBase, or UniCompactTreeBase if
+ * you have lots of nodes and care more about memory than speed.
  */
-template<class Sub>
-class UniConfTree : public UniHashTreeBase
+template<class Sub, class Base = UniHashTreeBase>
+class UniConfTree : public Base
 {
    
 public:
@@ -29,7 +32,7 @@ public:
 
     /** Creates a node and links it to a subtree, if parent is non-NULL */
     UniConfTree(Sub *parent, const UniConfKey &key) :
-        UniHashTreeBase(parent, key)
+        Base(parent, key)
         { }
 
     /** Destroy this node's contents and children. */
@@ -42,25 +45,25 @@ public:
 
     /** Reparents this node. */
     void setparent(Sub *parent)
-        { UniHashTreeBase::_setparent(parent); }
+        { Base::_setparent(parent); }
     
     /** Returns a pointer to the root node of the tree. */
     Sub *root() const
-        { return static_cast<Sub*>(UniHashTreeBase::_root()); }
+        { return static_cast<Sub*>(Base::_root()); }
     
     /**
      * Returns full path of this node relative to an ancestor.
      * If ancestor is NULL, returns the root.
      */
     UniConfKey fullkey(const Sub *ancestor = NULL) const
-        { return UniHashTreeBase::_fullkey(ancestor); }
+        { return Base::_fullkey(ancestor); }
 
     /**
      * Finds the sub-node with the specified key.
      * If key.isempty(), returns this node.
      */
     Sub *find(const UniConfKey &key) const
-        { return static_cast<Sub*>(UniHashTreeBase::_find(key)); }
+        { return static_cast<Sub*>(Base::_find(key)); }
     
     /**
      * Finds the direct child node with the specified key.
@@ -69,7 +72,7 @@ public:
      * as find(key), but a little faster.  Otherwise returns NULL.
      */
     Sub *findchild(const UniConfKey &key) const
-        { return static_cast<Sub*>(UniHashTreeBase::_findchild(key)); }
+        { return static_cast<Sub*>(Base::_findchild(key)); }
 
     /**
      * Removes the node for the specified key from the tree
@@ -88,11 +91,11 @@ public:
         // set xchildren to NULL first so that the zap() will happen faster
         // otherwise, each child will attempt to unlink itself uselessly
 
-        typename UniHashTreeBase::Container *oldchildren = this->xchildren;
+        typename Base::Container *oldchildren = this->xchildren;
         this->xchildren = NULL;
 
         // delete all children
-        typename UniHashTreeBase::Container::Iter i(*oldchildren);
+        typename Base::Container::Iter i(*oldchildren);
         for (i.rewind(); i.next();)
             delete static_cast<Sub*>(i.ptr());
 
@@ -108,8 +111,8 @@ public:
     void visit(const Visitor &visitor, void *userdata,
         bool preorder = true, bool postorder = false) const
     {
-        _recursive_unsorted_visit(this, reinterpret_cast<
-            const typename UniHashTreeBase::BaseVisitor&>(visitor), userdata,
+        Base::_recursive_unsorted_visit(this, reinterpret_cast<
+            const typename Base::BaseVisitor&>(visitor), userdata,
             preorder, postorder);
     }
 
@@ -123,21 +126,41 @@ public:
      */
     bool compare(const Sub *other, const Comparator &comparator)
     {
-        return _recursivecompare(this, other, reinterpret_cast<
-            const typename UniHashTreeBase::BaseComparator&>(comparator));
+        return Base::_recursivecompare(this, other, reinterpret_cast<
+            const typename Base::BaseComparator&>(comparator));
     }
 
     /**
      * An iterator that walks over all elements on one level of a
      * UniConfTree.
      */
-    class Iter : public UniHashTreeBase::Iter
+    class Iter : public Base::Iter
     {
     public:
-        typedef typename UniHashTreeBase::Iter MyBase;
+        typedef typename Base::Iter MyBase;
 
         /** Creates an iterator over the specified tree. */
-        Iter(Sub &tree) : UniHashTreeBase::Iter(tree)
+        Iter(Sub &tree) : Base::Iter(tree)
+	    { }
+
+        /** Returns a pointer to the current node. */
+        Sub *ptr() const
+            { return static_cast<Sub*>(MyBase::ptr()); }
+        WvIterStuff(Sub);
+    };
+
+    /**
+     * Like Iter, but returns the children sorted by key.  The order is
+     * kept around until a child is added or removed, so this is about as
+     * cheap as Iter if the node doesn't change much.
+     */
+    class SortedIter : public Base::SortedIter
+    {
+    public:
+        typedef typename Base::SortedIter MyBase;
+
+        /** Creates a sorted iterator over the specified tree. */
+        SortedIter(Sub &tree) : Base::SortedIter(tree)
 	    { }
 
         /** Returns a pointer to the current node. */
@@ -169,4 +192,30 @@ public:
 };
 
 
+/**
+ * A UniConfValueTree that uses much less memory per node, at the cost of
+ * slower insertion into nodes with lots of children.
+ */
+class UniConfCompactValueTree
+    : public UniConfTree<UniConfCompactValueTree, UniCompactTreeBase>
+{
+    WvString xvalue;  /*!< the value of this entry */
+    
+public:
+    UniConfCompactValueTree(UniConfCompactValueTree *parent,
+			    const UniConfKey &key, WvStringParm value)
+	: UniConfTree<UniConfCompactValueTree, UniCompactTreeBase>(parent, key),
+	  xvalue(value)
+	{ }
+    
+    /** Returns the value field. */
+    const WvString &value() const
+        { return xvalue; }
+
+    /** Sets the value field. */
+    void setvalue(WvStringParm value)
+        { xvalue = value; }
+};
+
+
 #endif // __UNICONFTREE_H
@@ -55,6 +55,7 @@ public:
     virtual void flush_buffers() { }
     virtual WvString get(const UniConfKey &key);
     virtual void set(const UniConfKey &key, WvStringParm value);
+    virtual void setv(const UniConfPairList &pairs);
 };
 
 #endif // __UNIDEFGEN_H
@@ -7,8 +7,6 @@
 
 #include "unifiltergen.h"
 
-class UniConfValueTree;
-
 /**
  * A lightwight but slightly dangerous variant of UniCacheGen.
  * 
@@ -26,9 +24,10 @@ class UniConfValueTree;
  * first one, be guaranteed asynchronous.  It caches keys which you've
  * previously done get() on, and accepts notifications for those keys
  * (so the value is always up to date, but you'll never have to wait for it
- * again).  It makes no attempt to optimize any other operations, including
- * set(), refresh/commit, or iterate.  It ignores notifications for any
- * keys you haven't explicitly done get() on in the past.
+ * again).  The answers to exists(), haschildren() and iterator() are
+ * remembered the same way, so iterating over the same subtree again is
+ * free too.  It makes no attempt to optimize set() or refresh/commit.  It
+ * ignores notifications for any keys it hasn't looked at in the past.
  */
 class UniFastRegetGen : public UniFilterGen
 {
@@ -40,10 +39,16 @@ public:
     virtual WvString get(const UniConfKey &key);
     virtual bool exists(const UniConfKey &key);
     virtual bool haschildren(const UniConfKey &key);
+    virtual Iter *iterator(const UniConfKey &key);
 
 private:
+    class CacheTree;
+
     IUniConfGen *inner;
-    UniConfValueTree *tree;
+    CacheTree *tree;
+
+    CacheTree *findnode(const UniConfKey &key);
+    void loadchildren(CacheTree *t, const UniConfKey &key);
     
 protected:
     virtual void gencallback(const UniConfKey &key, WvStringParm value);
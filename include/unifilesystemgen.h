@@ -37,11 +37,16 @@
  * 
  * Files containing embedded NUL characters don't currently work quite right
  * because WvString can't deal with them.  They'll stop at the first NUL.
+ * 
+ * The mirrored directory is kept open, and files are looked up relative
+ * to it.  It's reopened if the directory itself is deleted or replaced
+ * while the generator exists.
  */
 class UniFileSystemGen : public UniConfGen
 {
 public:
     UniFileSystemGen(WvStringParm _dir, mode_t _mode);
+    virtual ~UniFileSystemGen();
     virtual WvString get(const UniConfKey &key);
     virtual void set(const UniConfKey &key, WvStringParm value);
     virtual void setv(const UniConfPairList &pairs);
@@ -50,6 +55,25 @@ public:
 private:
     WvString dir;
     mode_t mode;
+    int dirfd; // the open 'dir', or -1 if we haven't managed to open it
+    dev_t dirdev; // device and inode of dirfd, to notice when 'dir'
+    ino_t dirino; //   stops being the directory we have open
+
+    /**
+     * Opens 'dir' if it isn't already, or if it no longer refers to the
+     * directory we have open.  Creates it if 'create'.
+     */
+    bool open_root(bool create);
+
+    /**
+     * Returns an fd for the directory 'key', creating it (and its
+     * parents) if needed.  Returns -1 on failure.  Unless the result is
+     * dirfd, the caller must close it.
+     */
+    int open_dir(const UniConfKey &key);
+
+    /** Writes 'value' to the file 'name' in the directory 'fd'. */
+    void write_file(int fd, const char *name, WvStringParm value);
 };
 
 #endif
@@ -29,7 +29,7 @@ protected:
             { return &obj->key(); }
     };
 
-    typedef WvScatterHash<UniHashTreeBase, UniConfKey, Accessor> Container;
+    class Container;
     typedef UniHashTreeBaseVisitor BaseVisitor;
     typedef UniHashTreeBaseComparator BaseComparator;
 
@@ -75,12 +75,74 @@ private:
     UniConfKey xkey;   /*!< the name of this entry */
 
 protected:
-    class Iter : public Container::Iter
-    {
-    public:
-        Iter(UniHashTreeBase &b) : Container::Iter(*b.xchildren) { }
-    };
+    class Iter;
     friend class Iter;
+
+    class SortedIter;
+    friend class SortedIter;
+};
+
+
+/**
+ * The children of a UniHashTreeBase node.  The first time someone asks
+ * for them in sorted order, the order is remembered until a child is
+ * added or removed, so walking an unchanging node in order doesn't have
+ * to sort it every time.
+ */
+class UniHashTreeBase::Container
+    : public WvScatterHash<UniHashTreeBase, UniConfKey, Accessor>
+{
+    UniHashTreeBase **xsorted; /*!< NULL-terminated, or NULL if unknown */
+
+public:
+    Container() : xsorted(NULL)
+        { }
+    ~Container()
+        { deletev xsorted; }
+
+    /** Returns the children in sorted order, followed by a NULL. */
+    UniHashTreeBase **sorted();
+
+    /** Forgets the sorted order; call this when adding or removing. */
+    void unsort()
+        { deletev xsorted; xsorted = NULL; }
+};
+
+
+class UniHashTreeBase::Iter : public UniHashTreeBase::Container::Iter
+{
+public:
+    Iter(UniHashTreeBase &b) : Container::Iter(*b.xchildren) { }
+};
+
+
+/**
+ * Like UniHashTreeBase::Iter, but returns the children sorted by key.
+ */
+class UniHashTreeBase::SortedIter
+{
+    UniHashTreeBase **vec;
+    unsigned int i;
+
+public:
+    SortedIter(UniHashTreeBase &b)
+        : vec(b.xchildren ? b.xchildren->sorted() : NULL), i(0)
+        { }
+
+    void rewind()
+        { i = 0; }
+    bool cur() const
+        { return vec && i > 0 && vec[i-1]; }
+    bool next()
+    {
+        if (!vec || (i > 0 && !vec[i-1]))
+            return false;
+        return vec[i++] != NULL;
+    }
+    UniHashTreeBase *ptr() const
+        { return vec[i-1]; }
+
+    WvIterStuff(UniHashTreeBase);
 };
 
 #endif //__UNIHASHTREE_H
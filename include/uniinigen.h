@@ -9,6 +9,7 @@
 
 #include "unitempgen.h"
 #include "wvlog.h"
+#include "wvstringlist.h"
 #include <sys/stat.h>
 
 class WvFile;
@@ -21,6 +22,12 @@ class WvFile;
  * To mount, use the moniker prefix "ini:" followed by the
  * path of the .ini file.
  * 
+ * If journaling is enabled with set_journal(), commit() only appends the
+ * keys that changed to "filename.journal" instead of rewriting the whole
+ * file.  The journal is folded back into the .ini file by compact(),
+ * which runs automatically once the journal grows too big.  refresh()
+ * always replays a journal it finds, so other readers of the same file
+ * see journaled changes whether or not they journal themselves.
  */
 class UniIniGen : public UniTempGen
 {
@@ -33,6 +40,13 @@ private:
     WvLog log;
     struct stat old_st;
     SaveCallback save_cb;
+
+    WvString journalname;
+    size_t journal_max; // 0 means journaling is disabled
+    struct stat old_journal_st;
+    WvStringList journal_pending; // encoded records not yet committed
+    size_t journal_pending_size;
+    bool journal_full; // pending changes can't be journaled; rewrite all
     
 public:
     /**
@@ -50,11 +64,28 @@ public:
     virtual bool refresh();
     virtual void set(const UniConfKey &key, WvStringParm value);
 
+    /**
+     * Enables journaled commits.  The journal is compacted into the .ini
+     * file whenever it grows beyond 'max_size' bytes.  A 'max_size' of 0
+     * disables journaling, which is the default.
+     */
+    void set_journal(size_t max_size);
+
+    /**
+     * Rewrites the .ini file with the current contents and removes the
+     * journal.  Daemons may want to call this when they're idle.
+     */
+    void compact();
+
 private:
-#ifndef _WIN32
     // helper methods for commit
+#ifndef _WIN32
     bool commit_atomic(WvStringParm real_filename);
 #endif
+    void commit_full();
+    bool commit_journal();
+    void commit_failed();
+    void load_journal(UniTempGen &gen);
     
     void save(WvStream &file, UniConfValueTree &parent);
     bool refreshcomparator(const UniConfValueTree *a,
@@ -23,6 +23,8 @@
  * lists by calling add().  If the 'values' list runs out of values before
  * 'keys', the remaining values will be retrieved from the given generator
  * (using get()) instead.
+ *
+ * If the keys happen to be added in sorted order, sorted() says so.
  */
 class UniListIter : public UniConfGen::Iter
 {
@@ -40,6 +42,8 @@ class UniListIter : public UniConfGen::Iter
     
     WvStringCache scache;
     
+    bool issorted; /*!< keys were added in sorted order */
+    
 public:
     UniListIter(IUniConfGen *_gen);
     
@@ -69,6 +73,7 @@ public:
     virtual bool next();
     virtual UniConfKey key() const;
     virtual WvString value() const;
+    virtual bool sorted() const;
 };
 
 #endif // __UNILISTITER_H
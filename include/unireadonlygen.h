@@ -25,6 +25,7 @@ public:
 
     virtual void flush_buffers() { }
     virtual void set(const UniConfKey &key, WvStringParm value) { };
+    virtual void setv(const UniConfPairList &pairs) { };
 };
 
 
@@ -20,6 +20,7 @@
 class UniTempGen : public UniConfGen
 {
     WvStringCache scache;
+    bool sorted; /*!< iterate over children in sorted order */
 
 public:
     UniConfValueTree *root; /*!< the root of the tree */
@@ -28,6 +29,15 @@ public:
     UniTempGen();
     virtual ~UniTempGen();
 
+    /**
+     * If 'sorted' is true, iterators return keys in sorted order, which
+     * saves UniConf::SortedIter from sorting them every time.  Each
+     * node remembers the order until its children change.  The default
+     * is false, which returns them in whatever order is handy.
+     */
+    void set_sorted(bool _sorted)
+        { sorted = _sorted; }
+
     /***** Overridden members *****/
 
     virtual WvString get(const UniConfKey &key);
@@ -25,7 +25,9 @@ class UniConfValueTree;
  * since creation if none) as if they had all been made on the underlying
  * generator at the moment of your call to commit(). However, commit()
  * does this in a way that prevents unnecessary extra callbacks from
- * being issued by the underlying generator.
+ * being issued by the underlying generator.  The changes are all passed
+ * to a single setv() call, so an underlying generator that applies setv()
+ * atomically never shows anyone a half-committed transaction.
  *
  * When you call refresh(), all set() calls since the last commit() or
  * refresh() (or since creation if none) are discarded.
@@ -109,16 +111,19 @@ protected:
     IUniConfGen *base;
 
     /**
-     * A recursive helper function for commit().
+     * A recursive helper function for commit().  Adds the set() calls
+     * needed to apply the changes to 'pairs', in order.
      */
     void apply_changes(UniConfChangeTree *node,
-		       const UniConfKey &section);
+		       const UniConfKey &section,
+		       UniConfPairList &pairs);
 
     /**
      * A recursive helper function for apply_changes().
      */
     void apply_values(UniConfValueTree *newcontents,
-		      const UniConfKey &section);
+		      const UniConfKey &section,
+		      UniConfPairList &pairs);
 
     /**
      * A recursive helper function for refresh().
@@ -91,10 +91,12 @@ public:
      * Returns the number of characters that would have to be read
      * to find the first instance of the character.
      * "ch" is the character
+     * "start" is how many bytes to skip before looking, if you already
+     *         know they don't contain the character
      * Returns: the number of bytes, or zero if the character is not
      *         in the buffer
      */
-    size_t strchr(int ch);
+    size_t strchr(int ch, size_t start = 0);
 
     /**
      * Returns the number of leading buffer elements that match
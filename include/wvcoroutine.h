@@ -0,0 +1,240 @@
+/* -*- Mode: C++ -*-
+ * Worldvisions Weaver Software:
+ *   Copyright (C) 1997-2002 Net Integration Technologies, Inc.
+ *
+ * Stackless coroutines for sequential stream code, as a lighter-weight
+ * alternative to continue_select().  Needs a compiler with C++20
+ * coroutines; otherwise, WVCOROUTINE_AVAILABLE isn't defined and this
+ * file declares nothing.
+ */
+#ifndef __WVCOROUTINE_H
+#define __WVCOROUTINE_H
+
+#include "wvistreamlist.h"
+
+#if defined(__cpp_impl_coroutine) && __cplusplus >= 202002L
+#define WVCOROUTINE_AVAILABLE 1
+
+#include <coroutine>
+#include <exception>
+
+/**
+ * The return type of a coroutine that uses WvCoStream.  Calling the
+ * coroutine runs it right away, up to its first co_await; after that it
+ * gets resumed from the WvIStreamList loop, and its frame frees itself
+ * when it returns.  Nobody waits for the result, so don't throw.
+ *
+ * Example:
+ *     WvCoTask session(WvStream *s)
+ *     {
+ *         {
+ *             WvCoStream co(*s);
+ *             char *line;
+ *             while ((line = co_await co.getline(30000)) != NULL)
+ *                 s->print("You said: %s\n", line);
+ *         }
+ *         // 'co' is gone now, so it won't touch the stream anymore
+ *         WVRELEASE(s);
+ *     }
+ */
+class WvCoTask
+{
+public:
+    struct promise_type
+    {
+	WvCoTask get_return_object()
+	    { return WvCoTask(); }
+	std::suspend_never initial_suspend() noexcept
+	    { return std::suspend_never(); }
+	std::suspend_never final_suspend() noexcept
+	    { return std::suspend_never(); }
+	void return_void()
+	    { }
+	void unhandled_exception()
+	    { std::terminate(); }
+    };
+};
+
+
+/**
+ * Lets a coroutine co_await a stream instead of blocking on it.  The
+ * stream is added to a WvIStreamList (globallist by default) for as long
+ * as the WvCoStream exists, and its callback resumes the coroutine when
+ * whatever it's waiting for has happened, the timeout expires, or the
+ * stream closes.  No stack is needed, so each session only costs its
+ * coroutine frame.
+ *
+ * The WvCoStream takes over the stream's callback, and only one
+ * coroutine at a time may wait on it.  Its destructor puts the stream's
+ * callbacks back, so the stream has to outlive it.  Timeouts are in
+ * milliseconds, and -1 means forever.
+ */
+class WvCoStream
+{
+public:
+    /** The common parts of all the things you can co_await. */
+    class Awaiter
+    {
+	friend class WvCoStream;
+    protected:
+	WvCoStream &co;
+	time_t msec_timeout;
+	bool wants_read;
+
+	Awaiter(WvCoStream &_co, time_t _msec_timeout, bool _wants_read)
+	    : co(_co), msec_timeout(_msec_timeout), wants_read(_wants_read)
+	    { }
+	virtual ~Awaiter()
+	    { }
+
+	/** Tries to finish without waiting; returns true if it did. */
+	virtual bool poll() = 0;
+
+    public:
+	bool await_ready()
+	    { return poll() || !co.s.isok(); }
+	void await_suspend(std::coroutine_handle<> h)
+	    { co.wait(this, h); }
+    };
+
+    class ReadableAwaiter : public Awaiter
+    {
+    public:
+	ReadableAwaiter(WvCoStream &_co, time_t _msec_timeout)
+	    : Awaiter(_co, _msec_timeout, true)
+	    { }
+	virtual bool poll()
+	    { return co.s.select(0, true, false); }
+	bool await_resume()
+	    { return co.s.isok() && poll(); }
+    };
+
+    class GetlineAwaiter : public Awaiter
+    {
+	char separator;
+	char *line;
+    public:
+	GetlineAwaiter(WvCoStream &_co, time_t _msec_timeout, char _separator)
+	    : Awaiter(_co, _msec_timeout, true),
+	      separator(_separator), line(NULL)
+	    { }
+	virtual bool poll()
+	    { return (line = co.s.getline(0, separator)) != NULL; }
+	char *await_resume()
+	    { return line; }
+    };
+
+    class ReadAwaiter : public Awaiter
+    {
+	void *buf;
+	size_t count, got;
+    public:
+	ReadAwaiter(WvCoStream &_co, time_t _msec_timeout,
+		    void *_buf, size_t _count)
+	    : Awaiter(_co, _msec_timeout, true),
+	      buf(_buf), count(_count), got(0)
+	    { }
+	virtual bool poll()
+	    { return (got = co.s.read(buf, count)) > 0; }
+	size_t await_resume()
+	    { return got; }
+    };
+
+    class SleepAwaiter : public Awaiter
+    {
+    public:
+	SleepAwaiter(WvCoStream &_co, time_t _msec_timeout)
+	    : Awaiter(_co, _msec_timeout, false)
+	    { }
+	virtual bool poll()
+	    { return msec_timeout == 0; }
+	void await_resume()
+	    { }
+    };
+
+    WvCoStream(WvStream &_s,
+	       WvIStreamList &_list = WvIStreamList::globallist)
+	: s(_s), list(_list), waiter(NULL), saw_close(false)
+    {
+	s.setcallback(wv::bind(&WvCoStream::wake, this));
+	old_readcb = s.setreadcallback(0);
+	old_closecb = s.setclosecallback(wv::bind(&WvCoStream::closed, this));
+	list.append(&s, false, "WvCoStream");
+    }
+
+    ~WvCoStream()
+    {
+	list.unlink(&s);
+	s.alarm(-1);
+	s.setcallback(0);
+	s.setreadcallback(old_readcb);
+	if (!saw_close)
+	    s.setclosecallback(old_closecb);
+    }
+
+    /** co_await returns true if the stream is readable, false otherwise. */
+    ReadableAwaiter readable(time_t msec_timeout = -1)
+	{ return ReadableAwaiter(*this, msec_timeout); }
+
+    /**
+     * co_await returns the next line, like getline(), or NULL on timeout
+     * or if the stream closed without one.
+     */
+    GetlineAwaiter getline(time_t msec_timeout = -1, char separator = '\n')
+	{ return GetlineAwaiter(*this, msec_timeout, separator); }
+
+    /** co_await returns the number of bytes read, which is 0 on timeout. */
+    ReadAwaiter read(void *buf, size_t count, time_t msec_timeout = -1)
+	{ return ReadAwaiter(*this, msec_timeout, buf, count); }
+
+    /** co_await returns after msec_timeout, or when the stream closes. */
+    SleepAwaiter sleep(time_t msec_timeout)
+	{ return SleepAwaiter(*this, msec_timeout); }
+
+private:
+    WvStream &s;
+    WvIStreamList &list;
+    Awaiter *waiter;
+    std::coroutine_handle<> handle;
+    IWvStreamCallback old_readcb, old_closecb;
+    bool saw_close;
+
+    void wait(Awaiter *a, std::coroutine_handle<> h)
+    {
+	assert(!waiter); // only one coroutine can wait on a stream
+	waiter = a;
+	handle = h;
+	if (a->wants_read)
+	    s.setreadcallback(wv::bind(&WvCoStream::wake, this));
+	s.alarm(a->msec_timeout);
+    }
+
+    void wake()
+    {
+	if (!waiter)
+	    return;
+
+	// keep waiting if nothing interesting happened
+	if (s.isok() && !s.alarm_was_ticking && !waiter->poll())
+	    return;
+
+	s.alarm(-1);
+	s.setreadcallback(0);
+	waiter = NULL;
+	std::coroutine_handle<> h = handle;
+	handle = nullptr;
+	h.resume(); // might delete us!
+    }
+
+    void closed()
+    {
+	saw_close = true;
+	if (old_closecb)
+	    old_closecb();
+	wake();
+    }
+};
+
+#endif // __cpp_impl_coroutine
+
+#endif // __WVCOROUTINE_H
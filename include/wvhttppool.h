@@ -24,6 +24,7 @@
 class WvBufUrlStream;
 class WvUrlStream;
 class WvHttpStream;
+class WvHttpPool;
 
 static const WvString DEFAULT_ANON_PW("weasels@");
 
@@ -47,6 +48,7 @@ public:
     WvString headers;
     WvUrlStream *instream;
     WvBufUrlStream *outstream;
+    WvHttpPool *pool; // gets told when we're done()
     WvStream *putstream;
     WvDynBuf putstream_data;
 
@@ -165,6 +167,10 @@ public:
     // only implemented in WvHttpStream
     virtual size_t remaining()
         { return 0; }
+
+    /** The number of requests sent on, or waiting for, this connection. */
+    size_t queued() const
+        { return urls.count() + waiting_urls.count(); }
     
     virtual void execute() = 0;
     
@@ -175,6 +181,35 @@ public:
 unsigned WvHash(const WvUrlStream::Target &n);
 
 DeclareWvDict(WvUrlStream, WvUrlStream::Target, target);
+DeclareWvList(WvUrlStream);
+
+
+/** All the connections a WvHttpPool has open to one WvUrlStream::Target. */
+struct WvUrlTargetConns
+{
+    WvUrlStream::Target target;
+    WvUrlStreamList conns;
+
+    WvUrlTargetConns(const WvUrlStream::Target &_target)
+	: target(_target)
+        {}
+};
+
+DeclareWvDict(WvUrlTargetConns, WvUrlStream::Target, target);
+
+
+/** The requests in a WvHttpPool that are waiting for one hostname to resolve. */
+struct WvUrlHostWait
+{
+    WvString hostname;
+    WvUrlRequestList urls;
+
+    WvUrlHostWait(WvStringParm _hostname)
+	: hostname(_hostname)
+        {}
+};
+
+DeclareWvDict(WvUrlHostWait, WvString, hostname);
 
 
 class WvHttpStream : public WvUrlStream
@@ -183,6 +218,7 @@ public:
     static bool global_enable_pipelining;
     static WvString pipeline_check_filename;
     bool enable_pipelining, expect_keep_alive;
+    time_t idle_timeout; // msec to keep the connection open with no requests
     
 private:
     int pipeline_test_count;
@@ -265,9 +301,15 @@ class WvHttpPool : public WvIStreamList
 {
     WvLog log;
     WvResolver dns;
-    WvUrlStreamDict conns;
-    WvUrlRequestList urls;
-    int num_streams_created;
+    WvUrlTargetConnsDict targets;
+    WvUrlRequestList urls;      // all our requests; the others just point here
+    WvUrlHostWaitDict resolving;  // waiting for DNS, by hostname
+    WvUrlRequestList ready;     // resolved, but not given to a stream yet
+    WvUrlRequestList finished;  // done(), but not cleaned up yet
+    bool dispatch_needed;       // something changed that might help 'ready'
+    int num_streams_created, num_conns;
+    int max_conns_per_target, max_conns;
+    time_t idle_timeout;
     bool sure;
     
     WvIPPortAddrTable pipeline_incompatible;
@@ -289,12 +331,48 @@ public:
     // non-existent directories in _url to be created.
 //    WvBufUrlStream *addputurl(WvStringParm _url, WvStringParm _headers,
 //			      WvStream *s, bool create_dirs = false);
+
+    /**
+     * Open up to 'n' connections at once to each server (default 1).
+     * New requests go to whichever connection has the fewest requests
+     * queued on it, and a new connection is only opened if all the
+     * existing ones are busy.
+     */
+    void set_max_conns_per_target(int n)
+        { max_conns_per_target = n > 0 ? n : 1; }
+
+    /**
+     * Never have more than 'n' connections open in total, or 0 (the
+     * default) for no limit.  Idle connections are closed early to make
+     * room for servers that don't have a connection yet.
+     */
+    void set_max_conns(int n)
+        { max_conns = n > 0 ? n : 0; }
+
+    /**
+     * How long, in milliseconds, an idle HTTP connection is kept open in
+     * case more requests for the same server come along (default 5000).
+     * This only affects connections opened after it's called.
+     */
+    void set_idle_timeout(time_t msec)
+        { idle_timeout = msec; }
+
+    /** The number of connections currently open. */
+    int conn_count() const
+        { return num_conns; }
+
 private:
+    WvUrlStream *find_conn(WvUrlRequest *url);
+    WvUrlStream *new_conn(WvUrlRequest *url);
+    bool close_idle_conn();
     void unconnect(WvUrlStream *s);
+    void url_resolving(WvUrlRequest *url);
+    void url_done(WvUrlRequest *url);
+    friend class WvUrlRequest;
     
 public:
     bool idle() const 
-        { return !urls.count(); }
+        { return urls.isempty(); }
     
 public:
     const char *wstype() const { return "WvHttpPool"; }
@@ -0,0 +1,151 @@
+/* -*- Mode: C++ -*-
+ * Worldvisions Weaver Software:
+ *   Copyright (C) 1997-2002 Net Integration Technologies, Inc.
+ *
+ * A "Log Receiver" that saves log messages unformatted, in a compact binary
+ * file, and a reader to get them back out again.
+ */
+#ifndef __WVLOGBINARY_H
+#define __WVLOGBINARY_H
+
+#include "wvlog.h"
+#include "wvscatterhash.h"
+#include <stdint.h>
+
+/**
+ * The layout of a WvLogBinary file: a WvLogBinaryHeader, followed by
+ * records, each of which is a WvLogBinaryRecord followed by 'len' bytes of
+ * data and padded to a multiple of 8 bytes.
+ */
+struct WvLogBinaryHeader
+{
+    char magic[8];   /*!< WVLOGBINARY_MAGIC */
+    uint32_t version;
+    uint32_t hdrsize;  /*!< where the first record starts */
+    uint64_t size;   /*!< how big the file is allowed to get */
+    uint64_t used;   /*!< where the last record ends */
+};
+
+#define WVLOGBINARY_MAGIC "WvLogBin"
+#define WVLOGBINARY_VERSION 1
+
+struct WvLogBinaryRecord
+{
+    enum { Message = 1, Source = 2 };
+
+    uint64_t usec;   /*!< when it was logged, in microseconds since 1970 */
+    uint32_t len;    /*!< the number of data bytes that follow */
+    uint16_t source; /*!< the source id */
+    uint8_t level;
+    uint8_t type;    /*!< Message, or Source to give a source id a name */
+};
+
+
+/**
+ * WvLogBinary is a WvLogRcvBase that saves log messages exactly as they
+ * were written, along with the time, source and level, without any
+ * formatting or escaping.  Source names are stored only once per file.
+ * This is cheap enough to leave Debug logging turned on; use wvlogdecode
+ * (or WvLogBinaryReader) to turn the file back into text later.
+ *
+ * The file is mmap()ed and never grows beyond 'max_size'.  When it fills
+ * up, it's renamed to "filename.1" (with older files moving up to
+ * "filename.<keep>", and the oldest one being deleted), and a new one is
+ * started.
+ */
+class WvLogBinary : public WvLogRcvBase
+{
+public:
+    WvLogBinary(WvStringParm _filename, size_t _max_size = 16*1024*1024,
+		int _keep = 3,
+		WvLog::LogLevel _max_level = WvLog::NUM_LOGLEVELS);
+    virtual ~WvLogBinary();
+
+    /** Returns true if the file is open and we're logging to it. */
+    bool isok() const
+        { return hdr != NULL; }
+
+    WvLog::LogLevel level() const
+        { return max_level; }
+    void level(WvLog::LogLevel lvl)
+        { max_level = lvl; }
+
+    /** Starts a new file right away, even if the old one isn't full. */
+    void rotate();
+
+protected:
+    virtual void log(WvStringParm source, int loglevel,
+		     const char *_buf, size_t len);
+
+private:
+    WvString filename;
+    size_t max_size;
+    int keep;
+    WvLog::LogLevel max_level;
+
+    int fd;
+    WvLogBinaryHeader *hdr; /*!< the start of the mapped file */
+
+    struct SourceId
+    {
+	WvString name;
+	unsigned id;
+	SourceId(WvStringParm _name, unsigned _id) : name(_name), id(_id)
+	    { }
+    };
+    DeclareWvScatterDict(SourceId, WvString, name);
+    SourceIdDict sources; /*!< the ids of sources named in this file */
+
+    bool open_file();
+    void close_file();
+    bool append(uint64_t usec, unsigned source, int level, int type,
+		const void *data, size_t len);
+};
+
+
+/**
+ * Reads back the messages in a file written by WvLogBinary.
+ *
+ * Example:
+ *     WvLogBinaryReader r("debug.wvlog");
+ *     while (r.next())
+ *         printf("%s: %.*s", r.source.cstr(), (int)r.len, r.text);
+ */
+class WvLogBinaryReader
+{
+public:
+    WvLogBinaryReader(WvStringParm filename);
+    ~WvLogBinaryReader();
+
+    /** Returns true if the file could be opened and looks right. */
+    bool isok() const
+        { return hdr != NULL; }
+
+    /**
+     * Moves to the next message, and returns false if there are no more.
+     * The text only stays valid until the next call to next().
+     */
+    bool next();
+
+    struct timeval when;
+    WvString source;
+    WvLog::LogLevel level;
+    const char *text;
+    size_t len;
+
+private:
+    const WvLogBinaryHeader *hdr;
+    size_t mapsize, pos;
+
+    struct SourceName
+    {
+	int id;
+	WvString name;
+	SourceName(int _id, WvStringParm _name) : id(_id), name(_name)
+	    { }
+    };
+    DeclareWvScatterDict(SourceName, int, id);
+    SourceNameDict names;
+};
+
+#endif // __WVLOGBINARY_H
@@ -13,22 +13,58 @@
 
 /// Basic WvLogRcv that logs to a file. Always logs to the same file.
 /// No auto-rotation of log files.
+///
+/// After set_async(), finished log lines go into a fixed-size ring instead
+/// of being written right away, and a background thread formats them and
+/// writes them out in batches.  That way a slow disk never holds up the
+/// code doing the logging; if the ring fills up, lines are either dropped
+/// (and counted) or the logger waits, depending on the overflow policy.
 class WvLogFileBase : public WvLogRcv, public WvFile
 {
 public:
     WvLogFileBase(WvStringParm _filename,
 		  WvLog::LogLevel _max_level = WvLog::NUM_LOGLEVELS);
+    virtual ~WvLogFileBase();
     
     // run fsync() every so many log messages.  0 never fsyncs.
     int fsync_every;
 
+    /// What to do with a log line when the ring is full.
+    enum AsyncOverflow {
+	AsyncDrop,  ///< throw it away, and count it in async_dropped()
+	AsyncBlock  ///< wait for the writer thread to make room
+    };
+
+    /// Starts writing from a background thread, with room for
+    /// 'ring_size' (rounded up to a power of two) lines that haven't been
+    /// written yet.  Returns false if the thread couldn't be started, in
+    /// which case lines are still written synchronously.
+    bool set_async(size_t ring_size = 4096,
+		   AsyncOverflow overflow = AsyncDrop);
+
+    /// Waits until every queued line has been written.
+    void drain();
+
+    /// The number of lines dropped because the ring was full.
+    size_t async_dropped() const;
+
 protected:
     WvLogFileBase(WvLog::LogLevel _max_level);
     virtual void _make_prefix(time_t now_sec); 
+    virtual void _begin_line();
     virtual void _mid_line(const char *str, size_t len);
     virtual void _end_line();
 
     int fsync_count;
+
+private:
+    time_t timestr_time; // when timestr was formatted
+    char timestr[30];
+
+    class AsyncWriter;
+    AsyncWriter *async;
+    WvDynBuf async_line; // the line we're building up for the ring
+    time_t async_time;
 };
 
 
@@ -47,6 +83,7 @@ public:
 private:
     virtual void _make_prefix(time_t now_sec); 
     int keep_for, last_day;
+    time_t tzoffset, tzoffset_time; // gmtoffset(), and when we checked
     WvString filename;
     bool allow_append;
 
@@ -35,6 +35,12 @@ protected:
     WvString prefix;
     size_t prelen;
     
+private:
+    const char *prefix_buf; // the buffer set_prefix() made for prefix
+    size_t prefix_size;
+    
+protected:
+    
     class Src_Lvl
     {
     public:
@@ -48,9 +54,34 @@ protected:
     
     Src_LvlDict custom_levels;
     
+    /** Which custom level (if any) applies to a given source. */
+    class Src_Match
+    {
+    public:
+	WvString src;
+	Src_Lvl *match;
+	Src_Match(WvStringParm _src, Src_Lvl *_match)
+	    : src(_src), match(_match) {};
+    };
+    
+    DeclareWvScatterDict(Src_Match, WvString, src);
+    
+    /** Sources we've already looked up in custom_levels. */
+    Src_MatchDict custom_matches;
+    
+    /** Returns the custom level for 'source', or NULL if none applies. */
+    Src_Lvl *find_custom_level(WvStringParm source);
+    
     /** Set the Prefix and Prefix Length (size_t prelen) */
     virtual void _make_prefix(time_t now);
     
+    /**
+     * Sets prefix and prelen to "timestr: source<level>: ", or just
+     * "source<level>: " if timestr is NULL, reusing the old prefix's
+     * buffer if there's room.
+     */
+    void set_prefix(const char *timestr);
+    
     /** Start a new log line (print prefix) */
     virtual void _begin_line();
     
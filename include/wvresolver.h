@@ -20,7 +20,16 @@ DeclareWvDict(WvResolverAddr, WvIPAddr, addr[0]);
 
 DeclareWvList(WvIPAddr);
 
-/** ASynchronous DNS resolver functions, so that we can do non-blocking lookups */
+/**
+ * ASynchronous DNS resolver functions, so that we can do non-blocking lookups.
+ *
+ * Names are looked up in /etc/hosts, then by sending queries straight to
+ * the nameservers in /etc/resolv.conf over UDP, all without blocking or
+ * forking.  Anything we can't handle that way ourselves (eg. short names
+ * that need the search list, or truncated replies) is passed to
+ * getaddrinfo() in a background thread.  Answers are cached for as long
+ * as their DNS TTL says.
+ */
 class WvResolver
 {
     static int numresolvers;
@@ -47,6 +56,16 @@ public:
 
     /** determines whether the resolving process is complete. */
     bool post_select(WvStringParm hostname, WvStream::SelectInfo &si);
+
+    /**
+     * Read the nameservers and options from 'filename' instead of
+     * /etc/resolv.conf.  As an extension, a nameserver can be given as
+     * ip:port, which is mostly useful for testing.
+     */
+    static void set_resolv_conf(WvStringParm filename);
+
+    /** Read static host entries from 'filename' instead of /etc/hosts. */
+    static void set_hosts_file(WvStringParm filename);
 };
 
 #endif // __WVRESOLVER_H
@@ -0,0 +1,35 @@
+/* -*- Mode: C++ -*-
+ * Worldvisions Weaver Software:
+ *   Copyright (C) 1997-2002 Net Integration Technologies, Inc.
+ *
+ * Run-time selection between the plain and SIMD versions of inner loops.
+ */
+#ifndef __WVSIMD_H
+#define __WVSIMD_H
+
+// x86 SIMD versions are compiled in (with __attribute__((target))) whenever
+// the compiler can generate them, and only used if the CPU we're running on
+// turns out to support them.
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) \
+    && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# define WVSIMD_X86 1
+#endif
+
+/** Instruction set extensions, from worst to best */
+enum WvSimdLevel
+{
+    WVSIMD_NONE = 0,
+    WVSIMD_SSSE3,
+    WVSIMD_AVX2
+};
+
+/** Returns the best extension this CPU supports (and we're allowed to use) */
+WvSimdLevel wvsimd_level();
+
+/**
+ * Never use anything better than 'max', even if the CPU has it.  This is
+ * mostly so that the tests can try every version on one machine.
+ */
+void wvsimd_limit(WvSimdLevel max);
+
+#endif // __WVSIMD_H
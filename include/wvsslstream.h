@@ -15,14 +15,18 @@
 struct ssl_st;
 struct ssl_ctx_st;
 struct ssl_method_st;
+struct ssl_session_st;
 
 typedef struct ssl_ctx_st SSL_CTX;
 typedef struct ssl_st SSL;
 typedef struct ssl_method_st SSL_METHOD;
+typedef struct ssl_session_st SSL_SESSION;
 
 class WvX509;
 class WvX509Mgr;
 class WvSSLStream;
+class WvSSLContext;
+class WvSSLHandshake;
 
 typedef wv::function<bool(WvX509*)> WvSSLValidateCallback;
 typedef wv::function<bool(WvX509*, WvSSLStream *)> WvSSLGlobalValidateCallback;
@@ -31,6 +35,13 @@ typedef wv::function<bool(WvX509*, WvSSLStream *)> WvSSLGlobalValidateCallback;
  * SSL Stream, handles SSLv2, SSLv3, and TLS
  * Methods - If you want it to be a server, then you must feed the constructor
  * a WvX509Mgr object
+ *
+ * All the streams using the same certificate in the same mode share one
+ * SSL context, so the certificate and key are only loaded once.  The
+ * shared context also caches TLS sessions: a server remembers the
+ * sessions it has handed out (and issues session tickets), and a client
+ * remembers the last session for each server address it talked to, so
+ * reconnecting doesn't need a full handshake.
  */
 class WvSSLStream : public WvStreamClone
 {
@@ -64,12 +75,41 @@ public:
     virtual bool isok() const;
     virtual void noread();
     virtual void nowrite();
+
+    /**
+     * Returns true if the handshake resumed an earlier session instead of
+     * doing a full key exchange.
+     */
+    bool session_reused() const;
+
+    /**
+     * Throws away the shared SSL contexts that no stream is using right
+     * now, along with their cached sessions.  Unused contexts are normally
+     * kept for a while so that their sessions can be resumed.
+     */
+    static void flush_contexts();
+
+    /**
+     * Lets up to 'n' worker threads do the key exchange for new
+     * connections, so that a burst of handshakes doesn't hold up the
+     * streams that are already connected.  0, the default, does them
+     * right in post_select().  Only streams created afterwards use the
+     * threads.
+     */
+    static void set_handshake_threads(int n);
+
+    /** The number of handshake steps the worker threads have done */
+    static unsigned long threaded_handshakes();
     
 protected:
     WvX509Mgr *x509;
     
-    /** SSL Context - used to create SSL Object */
+    /**
+     * SSL Context - used to create SSL Object.  It belongs to 'shared',
+     * so don't free it yourself.
+     */
     SSL_CTX *ctx;
+    WvSSLContext *shared;
     
     /**
      * Main SSL Object - after SSL_set_fd() we make all calls through the
@@ -79,6 +119,7 @@ protected:
     
     virtual size_t uwrite(const void *buf, size_t len);
     virtual size_t uread(void *buf, size_t len);
+    virtual bool flush_internal(time_t msec_timeout);
     
 private:
     /**
@@ -99,30 +140,69 @@ private:
     
     /** Keep track of whether we want to check the peer who connects to us */
     WvSSLValidateCallback vcb;
+
+    /** Where a client caches its session: the address of the server */
+    WvString session_key;
+
+    /** Called by openssl when a client gets a session it could resume */
+    static int new_session_cb(SSL *ssl, SSL_SESSION *sess);
+    friend class WvSSLContext;
+
+    /** True if our handshakes go to the worker threads */
+    bool threaded;
+
+    /**
+     * The handshake step a worker thread is doing right now, if any.
+     * Until it's done, the worker owns 'ssl' and the socket.
+     */
+    WvSSLHandshake *handshake;
+
+    /** A session openssl gave us in a worker thread, to be saved later */
+    SSL_SESSION *new_session;
+
+    /** Deals with what SSL_accept() or SSL_connect() returned */
+    void handshake_done(int err, int saved_errno,
+			const unsigned long *errors = NULL);
     
     /** Internal Log Object */
     WvLog debug;
 
     /**
-     * SSL_write() may return an SSL_ERROR_WANT_WRITE code which
+     * Small writes are collected here and sent as one record, either when
+     * it fills up or before we wait in select().  Big writes go straight
+     * from the caller's buffer to SSL_write().
+     *
+     * SSL_write() may also return an SSL_ERROR_WANT_WRITE code which
      * indicates that the function should be called again with
-     * precisely the same arguments as the last time.  To ensure that
-     * this can happen, we must unfortunately copy data into a bounce
-     * buffer and remeber the fact.  We use a WvBuf here to allow
-     * an arbitrary amount of data to be set aside.
+     * precisely the same arguments as the last time.  When that happens
+     * to the caller's buffer, we copy the data in here, claim it was
+     * written, and set write_started so that nothing gets added to it
+     * until it's gone.
      */
     WvInPlaceBuf write_bouncebuf;
-    size_t write_eat;
+    bool write_started;
 
-    /** Similar nastiness happens with SSL_read() */
-    WvInPlaceBuf read_bouncebuf;
+    /** True if openssl might have data for us without select() knowing */
     bool read_pending;
 
     /** Need to buffer writes until sslconnected */
     WvDynBuf unconnected_buf;
 
-    /** Prints out the entire SSL error queue */
-    void printerr(WvStringParm func);
+    /**
+     * Prints out the entire SSL error queue, or the list of errors a worker
+     * thread saved from its own queue
+     */
+    void printerr(WvStringParm func, const unsigned long *errors = NULL);
+
+    /**
+     * Calls SSL_write() and deals with any errors.  Returns the number of
+     * bytes written, 0 if it has to be tried again later with the same
+     * data, or -1 if the stream is dead.
+     */
+    int ssl_write(const void *buf, size_t len);
+
+    /** Tries to send write_bouncebuf; returns true if it's empty now */
+    bool flush_bouncebuf();
 
 public:
     const char *wstype() const { return "WvSSLStream"; }
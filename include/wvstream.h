@@ -635,6 +635,8 @@ protected:
     bool is_flushing;
 
     size_t queue_min;		// minimum bytes to read()
+    size_t getline_scanned;	// bytes of inbuf known not to hold getline_sep
+    int getline_sep;
     time_t autoclose_time;	// close eventually, even if output is queued
     WvTime alarm_time;          // select() returns true at this time
     WvTime last_alarm_check;    // last time we checked the alarm_remaining
@@ -56,6 +56,7 @@ class WvTask
     WvTaskMan &man;
     ucontext_t mystate;	// used for resuming the task
     ucontext_t func_call, func_return;
+    void *fast_sp;	// used instead of mystate with fast switching
     
     TaskFunc *func;
     void *userdata;
@@ -85,7 +86,14 @@ class WvTaskMan
     static int links;
     
     static int magic_number;
-    static WvTaskList all_tasks, free_tasks;
+    
+    // recycled tasks, by stack size class (see stack_class())
+    enum { NUM_STACK_CLASSES = 32 };
+    static WvTaskList all_tasks, free_tasks[NUM_STACK_CLASSES];
+    static int stack_class(size_t size);
+    
+    static bool release_stacks;
+    static size_t stack_bytes, stacks_reused, stacks_released;
     
     static void get_stack(WvTask &task, size_t size);
     static void stackmaster();
@@ -101,6 +109,9 @@ class WvTaskMan
     
     static WvTask *current_task;
     static ucontext_t toplevel;
+    static void *toplevel_sp;
+    
+    static void fast_task_main(WvTask *task);
     
     WvTaskMan();
     virtual ~WvTaskMan();
@@ -125,6 +136,15 @@ public:
     
     static WvTask *whoami()
         { return current_task; }
+    
+    /**
+     * If 'release' is true, the stacks of recycled tasks are handed back
+     * to the kernel (with MADV_DONTNEED) until they're reused.  That
+     * saves memory when lots of tasks finish at once, at the cost of
+     * page faults when they start again.  Off by default.
+     */
+    static void set_release_stacks(bool release)
+        { release_stacks = release; }
 
     static const void *current_top_of_stack();
     static size_t current_stacksize_limit();
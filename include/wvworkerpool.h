@@ -0,0 +1,117 @@
+/* -*- Mode: C++ -*-
+ * Worldvisions Weaver Software:
+ *   Copyright (C) 1997-2002 Net Integration Technologies, Inc.
+ *
+ * A few background threads for jobs that can only be done by blocking.
+ */
+#ifndef __WVWORKERPOOL_H
+#define __WVWORKERPOOL_H
+
+#ifdef _WIN32
+#define WVWORKERPOOL_NO_THREADS
+#else
+#include <pthread.h>
+#include <sys/types.h>
+#endif
+
+class WvWorkerPool;
+
+/**
+ * One job for a WvWorkerPool.  Derive from this and fill in run().
+ */
+class WvWorkerJob
+{
+public:
+    WvWorkerJob() : done(false), orphaned(false), next(NULL) { }
+    virtual ~WvWorkerJob() { }
+
+    /**
+     * Does the work.  This is called in a worker thread, so it had better
+     * not touch anything that isn't thread safe, which includes WvStrings.
+     */
+    virtual void run() = 0;
+
+private:
+    friend class WvWorkerPool;
+    bool done, orphaned;
+    WvWorkerJob *next;
+};
+
+
+/**
+ * Runs WvWorkerJobs in up to 'max_threads' background threads, which are
+ * started as they're needed.  Finished jobs are announced through a pipe
+ * (see getfd()), so the main thread can select() on it.
+ *
+ * Each user calls open() before submitting anything and close() when it's
+ * done; when the last one closes, so do the threads.  The threads don't
+ * survive a fork(), so in the child, any jobs that were in progress count
+ * as finished, and nothing new gets submitted until the next open().
+ *
+ * Meant to be a static object: the constructor does nothing that depends
+ * on other static objects, and the destructor doesn't wait for anything.
+ */
+class WvWorkerPool
+{
+public:
+    WvWorkerPool(int _max_threads);
+
+    void set_max_threads(int n)
+        { max_threads = n; }
+
+    /** Starts using the pool.  Returns false if threads aren't available. */
+    bool open();
+
+    /** The opposite of open(); the last one stops the threads. */
+    void close();
+
+    /**
+     * Queues 'job' to run in a thread.  Returns false (and doesn't queue
+     * it) if there aren't any threads to run it.
+     */
+    bool submit(WvWorkerJob *job);
+
+    /** Returns true if 'job' has finished, and empties the pipe. */
+    bool finished(WvWorkerJob *job);
+
+    /**
+     * Returns true if 'job' has finished, but leaves the pipe alone, since
+     * its other users might still be counting on it to wake them up.  Use
+     * this in pre_select() and finished() in post_select().
+     */
+    bool isdone(WvWorkerJob *job);
+
+    /** Blocks until 'job' has finished. */
+    void wait(WvWorkerJob *job);
+
+    /**
+     * We don't care about 'job' anymore: it gets deleted now if it's
+     * done or hasn't started, or else by the thread once it's finished.
+     */
+    void abandon(WvWorkerJob *job);
+
+    /** The fd to select() on for finished jobs, or -1 if there isn't one */
+    int getfd() const;
+
+    /** The number of jobs run by threads so far (for testing) */
+    unsigned long jobs_run() const
+        { return nrun; }
+
+private:
+    int max_threads;
+    unsigned long nrun;
+#ifndef WVWORKERPOOL_NO_THREADS
+    pid_t pid; // the process that started the threads
+    pthread_mutex_t lock;
+    pthread_cond_t cond, done_cond;
+    WvWorkerJob *todo, *todo_tail;
+    int threads, idle, queued, users;
+    bool isopen, quit;
+    int pipefd[2];
+
+    void close_pipe();
+    static void *thread_main(void *userdata);
+#endif
+};
+
+#endif // __WVWORKERPOOL_H
@@ -0,0 +1,256 @@
+#include "wvtest.h"
+#include "wvresolver.h"
+#include "wvfileutils.h"
+#include "wvistreamlist.h"
+#include "wvudp.h"
+#include <stdio.h>
+
+static int queries;
+static WvString last_src;
+static unsigned char last_query[512];
+static size_t last_len;
+
+// A tiny nameserver that knows about a few names under "example.test".
+static void stub_callback(WvUDPStream &s)
+{
+    unsigned char pkt[512];
+    size_t len;
+    while ((len = s.read(pkt, sizeof(pkt))) > 12)
+    {
+	queries++;
+	last_src = *s.src();
+	memcpy(last_query, pkt, len);
+	last_len = len;
+
+	// the question is one name in uncompressed labels
+	char name[256];
+	size_t pos = 12, n = 0;
+	while (pos < len && pkt[pos] && n + pkt[pos] + 2 < sizeof(name))
+	{
+	    if (n)
+		name[n++] = '.';
+	    memcpy(name + n, pkt + pos + 1, pkt[pos]);
+	    n += pkt[pos];
+	    pos += pkt[pos] + 1;
+	}
+	name[n] = 0;
+	WvString qname(name);
+	pos += 5;
+	if (pos > len)
+	    continue;
+
+	unsigned char reply[512];
+	memcpy(reply, pkt, pos);
+	reply[2] = 0x81; // reply, recursion desired
+	reply[3] = 0x80; // recursion available
+	size_t out = pos;
+	int answers = 0;
+
+	const unsigned char a1[] = { 10, 1, 2, 3 }, a2[] = { 10, 1, 2, 4 };
+	if (qname == "www.example.test" || qname == "multi.example.test")
+	{
+	    for (int i = 0; i < (qname == "www.example.test" ? 1 : 2); i++)
+	    {
+		const unsigned char rr[] = {
+		    0xc0, 12, 0, 1, 0, 1, 0, 0, 0, 1, 0, 4 }; // ttl 1
+		memcpy(reply + out, rr, sizeof(rr));
+		memcpy(reply + out + sizeof(rr), i ? a2 : a1, 4);
+		out += sizeof(rr) + 4;
+		answers++;
+	    }
+	}
+	else if (qname == "alias.example.test")
+	{
+	    // CNAME to www.example.test, then its address
+	    const unsigned char cname[] = {
+		0xc0, 12, 0, 5, 0, 1, 0, 0, 0, 60, 0, 6,
+		3, 'w', 'w', 'w', 0xc0, 18 };
+	    memcpy(reply + out, cname, sizeof(cname));
+	    size_t target = out + 12;
+	    out += sizeof(cname);
+	    const unsigned char rr[] = {
+		0xc0, (unsigned char)target, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4 };
+	    memcpy(reply + out, rr, sizeof(rr));
+	    memcpy(reply + out + sizeof(rr), a2, 4);
+	    out += sizeof(rr) + 4;
+	    answers = 2;
+	}
+	else if (qname == "slow.example.test")
+	    continue; // the test answers this one itself
+	else
+	    reply[3] |= 3; // no such name
+
+	reply[7] = answers;
+	s.write(reply, out);
+    }
+}
+
+
+static int lookup(WvIStreamList &l, WvResolver &dns, WvStringParm name,
+		  WvIPAddrList *addrs = NULL)
+{
+    int res;
+    for (int i = 0; (res = dns.findaddr(0, name, NULL, addrs)) < 0
+	     && i < 500; i++)
+	l.runonce(10);
+    return res;
+}
+
+
+WVTEST_MAIN("resolver without forking")
+{
+    WvUDPStream stub(WvIPPortAddr("127.0.0.1", 0), WvIPPortAddr());
+    WVPASS(stub.isok());
+    stub.setcallback(wv::bind(stub_callback, wv::ref(stub)));
+    WvIStreamList l;
+    l.append(&stub, false, "stub dns");
+
+    WvString conf(wvtmpfilename("wvtest-resolv")),
+	hosts(wvtmpfilename("wvtest-hosts"));
+    {
+	FILE *f = fopen(conf, "w");
+	fprintf(f, "# testing\nnameserver %s\noptions timeout:1 attempts:1\n",
+		WvString(*stub.local()).cstr());
+	fclose(f);
+	f = fopen(hosts, "w");
+	fprintf(f, "10.9.8.7  MyHost.test myalias # comment\n"
+		"::1 ip6-localhost\n");
+	fclose(f);
+    }
+    WvResolver::set_resolv_conf(conf);
+    WvResolver::set_hosts_file(hosts);
+
+    {
+	WvResolver dns;
+	const WvIPAddr *addr;
+
+	// these never need to ask anyone
+	WVPASSEQ(dns.findaddr(0, "myhost.TEST", &addr), 1);
+	WVPASSEQ(WvString(*addr), "10.9.8.7");
+	WVPASSEQ(dns.findaddr(0, "1.2.3.4", &addr), 1);
+	WVPASSEQ(WvString(*addr), "1.2.3.4");
+	WVPASSEQ(queries, 0);
+
+	// a real DNS lookup happens in the background
+	WVPASSEQ(dns.findaddr(0, "www.example.test", &addr), -1);
+	WVPASSEQ(lookup(l, dns, "www.example.test"), 1);
+	WVPASSEQ(dns.findaddr(0, "www.example.test", &addr), 1);
+	WVPASSEQ(WvString(*addr), "10.1.2.3");
+	WVPASSEQ(queries, 1);
+
+	WvIPAddrList addrs;
+	WVPASSEQ(lookup(l, dns, "multi.example.test", &addrs), 2);
+	WVPASSEQ(addrs.count(), 2);
+	WVPASSEQ(lookup(l, dns, "alias.example.test", NULL), 1);
+	WVPASSEQ(dns.findaddr(0, "alias.example.test", &addr), 1);
+	WVPASSEQ(WvString(*addr), "10.1.2.4");
+	WVPASSEQ(queries, 3);
+
+	// negative answers are cached too
+	WVPASSEQ(lookup(l, dns, "nothere.example.test"), 0);
+	WVPASSEQ(dns.findaddr(0, "nothere.example.test", &addr), 0);
+	WVPASSEQ(queries, 4);
+
+	// the select loop notices when the answer arrives
+	WvStream::SelectInfo si;
+	FD_ZERO(&si.read);
+	FD_ZERO(&si.write);
+	FD_ZERO(&si.except);
+	si.max_fd = -1;
+	si.msec_timeout = -1;
+	dns.clearhost("www.example.test");
+	WVPASSEQ(dns.findaddr(0, "www.example.test", &addr), -1);
+	dns.pre_select("www.example.test", si);
+	WVPASS(si.max_fd >= 0);
+	WVPASS(si.msec_timeout > 0);
+	WVPASSEQ(lookup(l, dns, "www.example.test"), 1);
+
+	// a ttl of one second means asking again later
+	WVPASSEQ(queries, 5);
+	sleep(2);
+	WVPASSEQ(lookup(l, dns, "www.example.test"), 1);
+	WVPASSEQ(queries, 6);
+
+	// every query comes from a different port, with a different ID
+	WvString src1(last_src);
+	unsigned char id1[2];
+	memcpy(id1, last_query, 2);
+	WVPASSEQ(lookup(l, dns, "nothere2.example.test"), 0);
+	WVPASS(last_src != src1);
+	WVPASS(memcmp(id1, last_query, 2));
+
+	// an answer with the right ID and port, but from the wrong place,
+	// doesn't count
+	WVPASSEQ(dns.findaddr(0, "slow.example.test", &addr), -1);
+	for (int i = 0; i < 100 && queries < 8; i++)
+	    l.runonce(10);
+	WVPASSEQ(queries, 8);
+	unsigned char reply[512];
+	const unsigned char rr[] = {
+	    0xc0, 12, 0, 1, 0, 1, 0, 0, 0, 60, 0, 4, 10, 6, 6, 6 };
+	memcpy(reply, last_query, last_len);
+	memcpy(reply + last_len, rr, sizeof(rr));
+	reply[2] = 0x81;
+	reply[3] = 0x80;
+	reply[7] = 1;
+	WvIPPortAddr resolver(last_src);
+	WvUDPStream spoof(WvIPPortAddr("127.0.0.1", 0), resolver);
+	spoof.write(reply, last_len + sizeof(rr));
+	for (int i = 0; i < 10; i++)
+	    l.runonce(10);
+	WVPASSEQ(dns.findaddr(0, "slow.example.test", &addr), -1);
+
+	// the same thing from the nameserver is fine
+	reply[15 + last_len] = 7;
+	stub.setdest(resolver);
+	stub.write(reply, last_len + sizeof(rr));
+	WVPASSEQ(lookup(l, dns, "slow.example.test"), 1);
+	WVPASSEQ(dns.findaddr(0, "slow.example.test", &addr), 1);
+	WVPASSEQ(WvString(*addr), "10.6.6.7");
+    }
+
+    unlink(conf);
+    unlink(hosts);
+    WvResolver::set_resolv_conf("/etc/resolv.conf");
+    WvResolver::set_hosts_file("/etc/hosts");
+}
+
+
+WVTEST_MAIN("resolver getaddrinfo fallback")
+{
+    WvUDPStream stub(WvIPPortAddr("127.0.0.1", 0), WvIPPortAddr());
+    WVPASS(stub.isok());
+    stub.setcallback(wv::bind(stub_callback, wv::ref(stub)));
+    WvIStreamList l;
+    l.append(&stub, false, "stub dns");
+
+    WvString conf(wvtmpfilename("wvtest-resolv")),
+	hosts(wvtmpfilename("wvtest-hosts"));
+    {
+	FILE *f = fopen(conf, "w");
+	fprintf(f, "nameserver %s\noptions timeout:1 attempts:1\n",
+		WvString(*stub.local()).cstr());
+	fclose(f);
+	f = fopen(hosts, "w");
+	fclose(f);
+    }
+    WvResolver::set_resolv_conf(conf);
+    WvResolver::set_hosts_file(hosts);
+
+    {
+	WvResolver dns;
+	const WvIPAddr *addr;
+
+	// short names go to the C library, which finds this in /etc/hosts
+	queries = 0;
+	WVPASSEQ(lookup(l, dns, "localhost"), 1);
+	WVPASSEQ(dns.findaddr(0, "localhost", &addr), 1);
+	WVPASSEQ(WvString(*addr), "127.0.0.1");
+	WVPASSEQ(queries, 0);
+    }
+
+    unlink(conf);
+    unlink(hosts);
+    WvResolver::set_resolv_conf("/etc/resolv.conf");
+    WvResolver::set_hosts_file("/etc/hosts");
+}
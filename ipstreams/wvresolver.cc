@@ -1,31 +1,42 @@
 /*
  * Worldvisions Weaver Software:
  *   Copyright (C) 1997-2002 Net Integration Technologies, Inc.
- * 
+ *
  * DNS name resolver with support for background lookups.
  */
 #include "wvresolver.h"
-#include "wvloopback.h"
 #include "wvaddr.h"
-#include "wvtcp.h"
+#include "wvfile.h"
+#include "wvstrutils.h"
+#include "wvtimeutils.h"
+#include "wvudp.h"
+#include "wvworkerpool.h"
 #include <sys/types.h>
-#include <signal.h>
+#include <sys/stat.h>
 #include <time.h>
 
 #ifdef _WIN32
-#define WVRESOLVER_SKIP_FORK
-typedef int pid_t;
-#define kill(a,b)
-#define waitpid(a,b,c) (0)
-#define alarm(a)
 #include "streams.h"
 #else
-#include "wvautoconf.h"
-#include "wvfork.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
 #include <netdb.h>
-#include <sys/wait.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 #endif
 
+#define DNS_PORT 53
+#define DNS_MAXPACKET 512
+#define NEGATIVE_TTL 60      // retry failed lookups after this many seconds
+#define DEFAULT_TTL (60*5)   // for answers that didn't come with a TTL
+#define MAX_TTL (60*60*24)
+#define MAX_ADDRS 32         // per hostname
+#define MAX_THREADS 4        // getaddrinfo() lookups at once
+
+static WvString resolv_conf_file("/etc/resolv.conf");
+static WvString hosts_file("/etc/hosts");
+
+
 class WvResolverHost
 {
 public:
@@ -33,33 +44,41 @@ public:
     WvIPAddr *addr;
     WvIPAddrList addrlist;
     bool done, negative;
-    pid_t pid;
-    WvLoopback *loop;
-    time_t last_tried;
+    time_t expires;
+
+    // while a lookup is in progress
+    enum { Idle, Dns, Gai } state;
+    unsigned short qid;
+    int tries;
+    WvTime next_try;
+    WvUDPStream *sock; // the current DNS query's socket, if any
+    int server;        //   and which nameserver it's connected to
 
     WvResolverHost(WvStringParm _name) : name(_name)
         { init(); addr = NULL; }
-    ~WvResolverHost()
+    bool pending() const
+        { return state != Idle; }
+
+    void add(const unsigned char ip[4])
         {
-	    WVRELEASE(loop);
-#ifndef WVRESOLVER_SKIP_FORK
-            if (pid && pid != -1)
-            {
-                kill(pid, SIGKILL);
-                pid_t rv;
-                // In case a signal is in the process of being delivered...
-                while ((rv = waitpid(pid, NULL, 0)) != pid)
-                    if (rv == -1 && errno != EINTR)
-                        break;
-            }
-#endif
-        }
+	    WvIPAddr *a = new WvIPAddr(ip);
+	    if (!addr)
+		addr = a;
+	    addrlist.append(a, true);
+	}
+    void finish(bool found, time_t ttl)
+        {
+	    state = Idle;
+	    done = found;
+	    negative = !found;
+	    expires = time(NULL) + (found ? ttl : NEGATIVE_TTL);
+	}
 protected:
     WvResolverHost()
         { init(); }
     void init()
-        { done = negative = false;
-          pid = 0; loop = NULL; last_tried = time(NULL); }
+        { done = negative = false; expires = 0;
+          state = Idle; qid = 0; tries = 0; sock = NULL; server = -1; }
 };
 
 class WvResolverAddr : public WvResolverHost
@@ -69,58 +88,762 @@ public:
         { addr = _addr; }
 };
 
+DeclareWvList(WvResolverHost);
+
 // static members of WvResolver
 int WvResolver::numresolvers = 0;
 WvResolverHostDict *WvResolver::hostmap = NULL;
 WvResolverAddrDict *WvResolver::addrmap = NULL;
 
 
-// function that runs in a child task
+//------------------------------ getaddrinfo() threads -----------------
 
-static void namelookup(const char *name, WvLoopback *loop)
+// Some lookups need the whole of the C library's resolver (search lists,
+// nsswitch.conf, and so on), which can only be done by blocking.  Those go
+// to a few background threads.  The threads only ever touch plain C data,
+// since WvStrings aren't thread safe.
+
+class WvResolverJob : public WvWorkerJob
 {
-    struct hostent *he;
-    
-    // wait up to one minute...
-    alarm(60);
-    
-    for (int count = 0; count < 10; count++)
+public:
+    char *name;
+    int naddrs;
+    unsigned char addrs[MAX_ADDRS][4];
+    WvResolverJob *nextjob; // the main thread's list of jobs
+
+    WvResolverJob(const char *_name)
+        : name(strdup(_name)), naddrs(0), nextjob(NULL) { }
+    virtual ~WvResolverJob()
+        { free(name); }
+    virtual void run();
+};
+
+
+void WvResolverJob::run()
+{
+    struct addrinfo hints, *ai = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    naddrs = 0;
+    if (getaddrinfo(name, NULL, &hints, &ai) != 0)
+	return;
+
+    for (struct addrinfo *i = ai; i && naddrs < MAX_ADDRS; i = i->ai_next)
     {
-	he = gethostbyname(name);
-	if (he)
-	{
-            char **addr = he->h_addr_list;
-            while (*addr != NULL)
-            {
-  	        loop->print("%s ", WvIPAddr((unsigned char *)(*addr)));
-                addr++;
-            }
-            loop->print("\n");
-	    alarm(0);
+	if (i->ai_family != AF_INET)
+	    continue;
+	const unsigned char *ip = (const unsigned char *)
+	    &((struct sockaddr_in *)i->ai_addr)->sin_addr;
+
+	bool dup = false;
+	for (int j = 0; j < naddrs && !dup; j++)
+	    dup = !memcmp(addrs[j], ip, 4);
+	if (!dup)
+	    memcpy(addrs[naddrs++], ip, 4);
+    }
+    freeaddrinfo(ai);
+}
+
+
+static WvWorkerPool gai_pool(MAX_THREADS);
+
+
+//------------------------------ DNS packets ----------------------------
+
+// Query IDs and source ports are all that keep someone off the path from
+// answering for the nameserver, so they have to be unpredictable.
+static void dns_random(void *buf, size_t len)
+{
+#ifndef _WIN32
+    int fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0)
+    {
+	ssize_t got = read(fd, buf, len);
+	::close(fd);
+	if (got == (ssize_t)len)
 	    return;
+    }
+#endif
+
+    // no /dev/urandom (in a chroot, maybe): better than nothing
+    static unsigned long seed = 0;
+    if (!seed)
+	seed = time(NULL) ^ (getpid() << 16) ^ (unsigned long)&buf;
+    unsigned char *p = (unsigned char *)buf;
+    for (size_t i = 0; i < len; i++)
+    {
+	seed = seed * 1103515245 + 12345;
+	p[i] = seed >> 16;
+    }
+}
+
+
+// A new socket for each query, from a random port, connected to 'server'
+// so that we find out right away if nobody's listening.
+static WvUDPStream *dns_socket(const WvIPPortAddr &server)
+{
+    unsigned short ports[4];
+    dns_random(ports, sizeof(ports));
+    for (unsigned i = 0; i < sizeof(ports)/sizeof(ports[0]); i++)
+    {
+	if (ports[i] < 1024)
+	    continue;
+	WvUDPStream *s = new WvUDPStream(WvIPPortAddr(ports[i]), server);
+	if (s->isok())
+	    return s;
+	WVRELEASE(s); // that one's taken
+    }
+
+    // let the kernel pick one
+    WvUDPStream *s = new WvUDPStream(WvIPPortAddr(), server);
+    if (!s->isok())
+	WVRELEASE(s);
+    return s;
+}
+
+
+static size_t dns_query(unsigned char *buf, unsigned short id,
+			const char *name)
+{
+    unsigned char *p = buf;
+    *p++ = id >> 8;
+    *p++ = id & 0xff;
+    *p++ = 0x01; // recursion desired
+    *p++ = 0;
+    *p++ = 0; *p++ = 1; // one question
+    memset(p, 0, 6);
+    p += 6;
+
+    const char *label = name;
+    while (*label)
+    {
+	const char *dot = strchr(label, '.');
+	size_t len = dot ? dot - label : strlen(label);
+	if (!len || len > 63 || p + len + 1 + 5 > buf + 255 + 12)
+	    return 0; // not a valid DNS name
+	*p++ = len;
+	memcpy(p, label, len);
+	p += len;
+	label += len;
+	if (*label)
+	    label++;
+    }
+    *p++ = 0;
+    *p++ = 0; *p++ = 1; // type A
+    *p++ = 0; *p++ = 1; // class IN
+    return p - buf;
+}
+
+
+// Reads a (possibly compressed) name at 'pos', and moves 'pos' past it.
+static bool dns_getname(const unsigned char *pkt, size_t len, size_t &pos,
+			char *name, size_t namelen)
+{
+    size_t at = pos, out = 0;
+    bool jumped = false;
+    for (int hops = 0; hops < 64; hops++)
+    {
+	if (at >= len)
+	    return false;
+	unsigned char c = pkt[at];
+	if ((c & 0xc0) == 0xc0)
+	{
+	    if (at + 1 >= len)
+		return false;
+	    if (!jumped)
+		pos = at + 2;
+	    jumped = true;
+	    at = ((c & 0x3f) << 8) | pkt[at + 1];
+	    continue;
 	}
-	
-	// not found (yet?)
-	
-	if (h_errno != TRY_AGAIN)
+	if (!c)
 	{
-	    alarm(0);
-	    return; // not found; blank output
+	    if (!jumped)
+		pos = at + 1;
+	    name[out ? out - 1 : 0] = 0;
+	    return true;
 	}
-	
-	// avoid spinning in a tight loop.
-	//
-	// sleep() is documented to possibly mess with the alarm(), so we
-	// have to make sure to reset the alarm here.  That's a shame,
-	// because otherwise it would timeout nicely after 60 seconds
-	// overall, not 60 seconds per request.
-	sleep(1);
+	if (at + 1 + c > len || out + c + 1 >= namelen)
+	    return false;
+	memcpy(name + out, pkt + at + 1, c);
+	out += c;
+	name[out++] = '.';
+	at += 1 + c;
+    }
+    return false; // a compression loop
+}
+
+
+static inline unsigned get16(const unsigned char *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+
+static inline unsigned long get32(const unsigned char *p)
+{
+    return ((unsigned long)get16(p) << 16) | get16(p + 2);
+}
+
+
+//------------------------------ WvResolverEngine -----------------------
+
+// Everything the WvResolver objects share: the configuration and the
+// hosts we're waiting for.
+class WvResolverEngine
+{
+public:
+    WvResolverEngine(WvResolverHostDict &_hostmap);
+    ~WvResolverEngine();
+
+    void start(WvResolverHost *host);
+    void forget(WvResolverHost *host)
+        { drop_query(host); pending.unlink(host); }
+
+    void pre_select(WvStream::SelectInfo &si);
+    void service();
+    void wait(WvResolverHost *host, int msec_timeout);
+
+private:
+    WvResolverHostDict &hostmap;
+    WvResolverHostList pending;
+
+    // from resolv.conf
+    struct stat resolv_st;
+    WvIPPortAddr servers[8];
+    int nservers, timeout, attempts, ndots;
 
-	alarm(60);
+    // from /etc/hosts
+    struct stat hosts_st;
+    WvResolverHostDict hosts;
+
+    // getaddrinfo() lookups we've handed to gai_pool
+    bool gai_open;
+    WvResolverJob *gai_jobs;
+
+    void check_config();
+    void read_resolv_conf();
+    void read_hosts();
+    bool from_hosts(WvResolverHost *host);
+    void send_query(WvResolverHost *host);
+    void drop_query(WvResolverHost *host);
+    void use_gai(WvResolverHost *host);
+    void gai_result(WvResolverHost *host, WvResolverJob *job);
+    void got_reply(WvResolverHost *host, const unsigned char *pkt,
+		   size_t len);
+    void done(WvResolverHost *host, bool found, time_t ttl);
+};
+
+static WvResolverEngine *engine = NULL;
+
+
+static bool changed(WvStringParm filename, struct stat &old)
+{
+    struct stat st;
+    if (stat(filename, &st) < 0)
+	memset(&st, 0, sizeof(st));
+    if (st.st_mtime == old.st_mtime && st.st_size == old.st_size
+	&& st.st_ino == old.st_ino)
+	return false;
+    old = st;
+    return true;
+}
+
+
+WvResolverEngine::WvResolverEngine(WvResolverHostDict &_hostmap)
+    : hostmap(_hostmap), hosts(10)
+{
+    memset(&resolv_st, 0, sizeof(resolv_st));
+    memset(&hosts_st, 0, sizeof(hosts_st));
+    resolv_st.st_mtime = hosts_st.st_mtime = -1;
+    nservers = 0;
+    gai_open = false;
+    gai_jobs = NULL;
+}
+
+
+WvResolverEngine::~WvResolverEngine()
+{
+    WvResolverHostList::Iter i(pending);
+    for (i.rewind(); i.next(); )
+	drop_query(i.ptr());
+
+    while (gai_jobs)
+    {
+	WvResolverJob *next = gai_jobs->nextjob;
+	gai_pool.abandon(gai_jobs);
+	gai_jobs = next;
     }
+    if (gai_open)
+	gai_pool.close();
 }
 
 
+void WvResolverEngine::check_config()
+{
+    if (changed(resolv_conf_file, resolv_st))
+	read_resolv_conf();
+    if (changed(hosts_file, hosts_st))
+	read_hosts();
+}
+
+
+void WvResolverEngine::read_resolv_conf()
+{
+    nservers = 0;
+    timeout = 5;
+    attempts = 2;
+    ndots = 1;
+
+    WvFile f(resolv_conf_file, O_RDONLY);
+    char *line;
+    while (f.isok() && (line = f.blocking_getline(-1)) != NULL)
+    {
+	char *word = strtok(line, " \t\r");
+	if (!word || word[0] == '#' || word[0] == ';')
+	    continue;
+	if (!strcmp(word, "nameserver"))
+	{
+	    char *arg = strtok(NULL, " \t\r");
+	    if (!arg || nservers >= (int)(sizeof(servers)/sizeof(servers[0])))
+		continue;
+
+	    // an IPv6 server has more than one colon, and we can't use it
+	    char *colon = strchr(arg, ':');
+	    if (colon && strchr(colon + 1, ':'))
+		continue;
+	    if (colon)
+		*colon = 0;
+	    struct in_addr in;
+	    if (!inet_aton(arg, &in))
+		continue;
+	    servers[nservers++] = WvIPPortAddr(arg,
+				       colon ? atoi(colon + 1) : DNS_PORT);
+	}
+	else if (!strcmp(word, "options"))
+	{
+	    while ((word = strtok(NULL, " \t\r")) != NULL)
+	    {
+		if (!strncmp(word, "timeout:", 8))
+		    timeout = atoi(word + 8);
+		else if (!strncmp(word, "attempts:", 9))
+		    attempts = atoi(word + 9);
+		else if (!strncmp(word, "ndots:", 6))
+		    ndots = atoi(word + 6);
+	    }
+	}
+    }
+    if (timeout < 1)
+	timeout = 1;
+    if (attempts < 1)
+	attempts = 1;
+}
+
+
+void WvResolverEngine::read_hosts()
+{
+    hosts.zap();
+
+    WvFile f(hosts_file, O_RDONLY);
+    char *line;
+    while (f.isok() && (line = f.blocking_getline(-1)) != NULL)
+    {
+	char *hash = strchr(line, '#');
+	if (hash)
+	    *hash = 0;
+	char *ip = strtok(line, " \t\r");
+	struct in_addr in;
+	if (!ip || !inet_aton(ip, &in))
+	    continue; // including IPv6 addresses, which we can't use
+
+	char *name;
+	while ((name = strtok(NULL, " \t\r")) != NULL)
+	{
+	    strlwr(name);
+	    WvResolverHost *h = hosts[name];
+	    if (!h)
+	    {
+		h = new WvResolverHost(name);
+		hosts.add(h, true);
+	    }
+	    h->add((const unsigned char *)&in);
+	}
+    }
+}
+
+
+bool WvResolverEngine::from_hosts(WvResolverHost *host)
+{
+    WvString name(host->name);
+    strlwr(name.edit());
+    if (!!name && name.cstr()[name.len() - 1] == '.')
+	name.edit()[name.len() - 1] = 0;
+
+    WvResolverHost *h = hosts[name];
+    if (!h)
+	return false;
+
+    WvIPAddrList::Iter i(h->addrlist);
+    for (i.rewind(); i.next(); )
+	host->add(i->binaddr);
+    // check again soon, in case someone edits the file
+    host->finish(true, NEGATIVE_TTL);
+    return true;
+}
+
+
+void WvResolverEngine::start(WvResolverHost *host)
+{
+    check_config();
+
+    // an IP address doesn't need looking up at all
+    struct in_addr in;
+    if (inet_aton(host->name, &in) && strspn(host->name, "0123456789.")
+	== host->name.len())
+    {
+	host->add((const unsigned char *)&in);
+	host->finish(true, MAX_TTL);
+	return;
+    }
+
+    if (from_hosts(host))
+	return;
+
+    // names with just a few dots might need the search list, which we
+    // leave to the C library.
+    const char *name = host->name;
+    int dots = 0;
+    for (const char *cptr = name; *cptr; cptr++)
+	if (*cptr == '.')
+	    dots++;
+    bool absolute = !!host->name && name[host->name.len() - 1] == '.';
+
+    if (!nservers || (!absolute && dots < ndots))
+	use_gai(host);
+    else
+    {
+	host->tries = 0;
+	host->state = WvResolverHost::Dns;
+	pending.append(host, false);
+	send_query(host);
+    }
+}
+
+
+void WvResolverEngine::send_query(WvResolverHost *host)
+{
+    WvString name(host->name);
+    if (!!name && name.cstr()[name.len() - 1] == '.')
+	name.edit()[name.len() - 1] = 0;
+
+    // a new ID and port every time, so a slow server gives an attacker
+    // no more chances to guess
+    dns_random(&host->qid, sizeof(host->qid));
+    unsigned char pkt[DNS_MAXPACKET];
+    size_t len = dns_query(pkt, host->qid, name);
+    if (!len)
+    {
+	done(host, false, 0);
+	return;
+    }
+
+    // try each server in turn, with a longer timeout each time around
+    int round = host->tries / nservers;
+    drop_query(host);
+    host->server = host->tries % nservers;
+    host->sock = dns_socket(servers[host->server]);
+    if (!host->sock
+	|| ::send(host->sock->getfd(), (const char *)pkt, len, 0) < 0)
+    {
+	// try the next one right away
+	host->next_try = wvtime();
+    }
+    else
+	host->next_try = msecadd(wvtime(), (timeout * 1000) << round);
+}
+
+
+void WvResolverEngine::drop_query(WvResolverHost *host)
+{
+    WVRELEASE(host->sock);
+    host->server = -1;
+}
+
+
+void WvResolverEngine::use_gai(WvResolverHost *host)
+{
+    drop_query(host);
+    if (host->state == WvResolverHost::Idle)
+	pending.append(host, false);
+    host->state = WvResolverHost::Gai;
+
+    WvResolverJob *job = new WvResolverJob(host->name);
+    if (!gai_open)
+	gai_open = gai_pool.open();
+    if (gai_open && gai_pool.submit(job))
+    {
+	job->nextjob = gai_jobs;
+	gai_jobs = job;
+    }
+    else
+    {
+	// no threads, so we'll just have to wait for it
+	job->run();
+	gai_result(host, job);
+	delete job;
+    }
+}
+
+
+void WvResolverEngine::gai_result(WvResolverHost *host, WvResolverJob *job)
+{
+    for (int i = 0; i < job->naddrs; i++)
+	host->add(job->addrs[i]);
+    done(host, job->naddrs > 0, DEFAULT_TTL);
+}
+
+
+void WvResolverEngine::done(WvResolverHost *host, bool found, time_t ttl)
+{
+    drop_query(host);
+    pending.unlink(host);
+    host->finish(found, ttl);
+}
+
+
+void WvResolverEngine::got_reply(WvResolverHost *host,
+				 const unsigned char *pkt, size_t len)
+{
+    if (len < 12 || !(pkt[2] & 0x80) || get16(pkt + 4) != 1
+	|| get16(pkt) != host->qid)
+	return; // not a reply, or not to the question we asked
+
+    char qname[256];
+    size_t pos = 12;
+    if (!dns_getname(pkt, len, pos, qname, sizeof(qname)))
+	return;
+    pos += 4; // type and class
+
+    WvString name(host->name);
+    if (name.cstr()[name.len() - 1] == '.')
+	name.edit()[name.len() - 1] = 0;
+    if (strcasecmp(name, qname))
+	return;
+
+    int rcode = pkt[3] & 0x0f;
+    if (pkt[2] & 0x02)
+    {
+	// truncated; the C library knows how to use TCP
+	use_gai(host);
+	return;
+    }
+    if (rcode == 3) // no such name
+    {
+	done(host, false, 0);
+	return;
+    }
+    if (rcode != 0)
+    {
+	// that server's having trouble; ask the next one now
+	host->next_try = wvtime();
+	return;
+    }
+
+    // follow the CNAMEs from the name we asked about
+    char want[256], owner[256], target[256];
+    strcpy(want, qname);
+    unsigned long ttl = MAX_TTL;
+    int found = 0;
+    for (unsigned n = get16(pkt + 6); n > 0; n--)
+    {
+	if (!dns_getname(pkt, len, pos, owner, sizeof(owner))
+	    || pos + 10 > len)
+	    break;
+	unsigned type = get16(pkt + pos), cls = get16(pkt + pos + 2);
+	unsigned long rttl = get32(pkt + pos + 4);
+	size_t rdlen = get16(pkt + pos + 8);
+	pos += 10;
+	if (pos + rdlen > len)
+	    break;
+
+	if (cls == 1 && !strcasecmp(owner, want))
+	{
+	    if (type == 5) // CNAME
+	    {
+		size_t tpos = pos;
+		if (!dns_getname(pkt, len, tpos, target, sizeof(target)))
+		    break;
+		strcpy(want, target);
+		if (rttl < ttl)
+		    ttl = rttl;
+	    }
+	    else if (type == 1 && rdlen == 4 && found < MAX_ADDRS)
+	    {
+		host->add(pkt + pos);
+		found++;
+		if (rttl < ttl)
+		    ttl = rttl;
+	    }
+	}
+	pos += rdlen;
+    }
+
+    done(host, found > 0, ttl ? ttl : 1);
+}
+
+
+void WvResolverEngine::service()
+{
+    unsigned char pkt[DNS_MAXPACKET];
+    WvResolverHostList::Iter i(pending);
+    for (i.rewind(); i.next(); )
+    {
+	WvResolverHost *host = i.ptr();
+	while (host->sock)
+	{
+	    struct sockaddr_in from;
+	    socklen_t fromlen = sizeof(from);
+	    int len = ::recvfrom(host->sock->getfd(), (char *)pkt, sizeof(pkt),
+				 0, (struct sockaddr *)&from, &fromlen);
+	    if (len < 0)
+	    {
+		// nobody's there, so don't wait for an answer from it
+		if (errno == ECONNREFUSED)
+		    host->next_try = wvtime();
+		break;
+	    }
+
+	    // the socket is connected, so this should never happen, but
+	    // it's cheap to be sure
+	    if (fromlen < sizeof(from) || from.sin_family != AF_INET
+		|| WvIPPortAddr(&from) != servers[host->server])
+		continue;
+
+	    got_reply(host, pkt, len);
+	}
+
+	// done() takes it out of the list we're iterating over
+	if (!host->pending())
+	    i.rewind();
+    }
+
+    WvResolverJob **prev = &gai_jobs;
+    while (*prev)
+    {
+	WvResolverJob *job = *prev;
+	if (!gai_pool.finished(job))
+	{
+	    prev = &job->nextjob;
+	    continue;
+	}
+	*prev = job->nextjob;
+	WvResolverHost *host = hostmap[job->name];
+	if (host && host->state == WvResolverHost::Gai)
+	    gai_result(host, job);
+	delete job;
+    }
+
+    // resend anything that's taking too long
+    WvTime now = wvtime();
+    for (i.rewind(); i.next(); )
+    {
+	WvResolverHost *host = i.ptr();
+	if (host->state != WvResolverHost::Dns || msecdiff(host->next_try, now) > 0)
+	    continue;
+	if (++host->tries >= attempts * nservers)
+	{
+	    // the nameservers aren't answering; maybe the C library knows
+	    // something we don't.
+	    use_gai(host);
+	}
+	else
+	    send_query(host);
+
+	if (!host->pending())
+	    i.rewind();
+    }
+}
+
+
+void WvResolverEngine::pre_select(WvStream::SelectInfo &si)
+{
+    bool dns = false;
+    time_t wait = -1;
+    int fd = gai_pool.getfd();
+    WvTime now = wvtime();
+    WvResolverHostList::Iter i(pending);
+    for (i.rewind(); i.next(); )
+    {
+	if (i->state != WvResolverHost::Dns)
+	{
+	    if (fd < 0)
+		wait = 0; // nothing to wait for; it's done already
+	    continue;
+	}
+	dns = true;
+	time_t left = msecdiff(i->next_try, now);
+	if (left < 0)
+	    left = 0;
+	if (wait < 0 || left < wait)
+	    wait = left;
+    }
+
+    if (dns)
+	for (i.rewind(); i.next(); )
+	    if (i->sock)
+		i->sock->xpre_select(si,
+				   WvStream::SelectRequest(true, false, false));
+    if (fd >= 0)
+    {
+	FD_SET(fd, &si.read);
+	if (fd > si.max_fd)
+	    si.max_fd = fd;
+    }
+    if (wait >= 0 && (si.msec_timeout < 0 || wait < si.msec_timeout))
+	si.msec_timeout = wait;
+}
+
+
+void WvResolverEngine::wait(WvResolverHost *host, int msec_timeout)
+{
+    WvTime deadline = msecadd(wvtime(), msec_timeout);
+    service();
+    while (host->pending())
+    {
+	WvStream::SelectInfo si;
+	FD_ZERO(&si.read);
+	FD_ZERO(&si.write);
+	FD_ZERO(&si.except);
+	si.wants = WvStream::SelectRequest(true, false, false);
+	si.max_fd = -1;
+	si.msec_timeout = -1;
+	si.inherit_request = false;
+	si.global_sure = false;
+	pre_select(si);
+
+	if (msec_timeout >= 0)
+	{
+	    time_t left = msecdiff(deadline, wvtime());
+	    if (left <= 0)
+		return;
+	    if (si.msec_timeout < 0 || left < si.msec_timeout)
+		si.msec_timeout = left;
+	}
+
+	struct timeval tv;
+	tv.tv_sec = si.msec_timeout / 1000;
+	tv.tv_usec = (si.msec_timeout % 1000) * 1000;
+	::select(si.max_fd + 1, &si.read, NULL, NULL,
+		 si.msec_timeout < 0 ? NULL : &tv);
+	service();
+    }
+}
+
+
+//------------------------------ WvResolver -----------------------------
+
 WvResolver::WvResolver()
 {
     numresolvers++;
@@ -128,6 +851,8 @@ WvResolver::WvResolver()
 	hostmap = new WvResolverHostDict(10);
     if (!addrmap)
 	addrmap = new WvResolverAddrDict(10);
+    if (!engine)
+	engine = new WvResolverEngine(*hostmap);
 }
 
 
@@ -136,8 +861,10 @@ WvResolver::~WvResolver()
     numresolvers--;
     if (numresolvers <= 0 && hostmap && addrmap)
     {
+	delete engine;
 	delete hostmap;
 	delete addrmap;
+	engine = NULL;
 	hostmap = NULL;
 	addrmap = NULL;
     }
@@ -153,47 +880,14 @@ int WvResolver::findaddr(int msec_timeout, WvStringParm name,
     WvResolverHost *host;
     time_t now = time(NULL);
     int res = 0;
-    
+
     host = (*hostmap)[name];
 
-    if (host)
+    // expired from the cache?  Force a repeat lookup below...
+    if (host && !host->pending() && host->expires <= now)
     {
-	// refresh successes after 5 minutes, retry failures every 1 minute
-	if ((host->done && host->last_tried + 60*5 < now)
-	    || (!host->done && host->last_tried + 60 < now))
-	{
-	    // expired from the cache.  Force a repeat lookup below...
-	    hostmap->remove(host);
-	    host = NULL;
-	}
-	else if (host->done)
-	{
-	    // entry exists, is marked done, and hasn't expired yet.  Return
-	    // the cached value.
-	    if (addr)
-		*addr = host->addr;
-            if (addrlist)
-            {
-                WvIPAddrList::Iter i(host->addrlist);
-                for (i.rewind(); i.next(); )
-                {
-                    addrlist->append(i.ptr(), false);
-                    res++;
-                }
-            }
-            else
-                res = 1;
-	    return res;
-	}
-	else if (host->negative)
-	{
-	    // the entry is in the cache, but the response was negative:
-	    // the name doesn't exist.
-	    return 0;
-	}
-	
-	// if we get here, 'host' either exists (still in progress)
-	// or is NULL (need to start again).
+	hostmap->remove(host);
+	host = NULL;
     }
 
     if (!host)
@@ -202,126 +896,58 @@ int WvResolver::findaddr(int msec_timeout, WvStringParm name,
 	// and start a new lookup.
 	host = new WvResolverHost(name);
 	hostmap->add(host, true);
-	
-	host->loop = new WvLoopback();
-	
-#ifdef WVRESOLVER_SKIP_FORK
-        // background name resolution doesn't work when debugging with gdb!
-	namelookup(name, host->loop);
-#else
-        // fork a subprocess so we don't block while doing the DNS lookup.
+	engine->start(host);
+    }
 
-	// close everything but host->loop in the subprocess.
-	host->pid = wvfork(host->loop->getrfd(), host->loop->getwfd());
-	
-	if (!host->pid)
-	{
-	    // child process
-	    host->loop->noread();
-	    namelookup(name, host->loop);
-	    _exit(1);
-	}
-#endif
-	
-	// parent process
-	host->loop->nowrite();
-    }
-
-#ifndef WVRESOLVER_SKIP_FORK
-    
-    // if we get here, we are the parent task waiting for the child.
-    
-    do
-    {
-	if (waitpid(host->pid, NULL, WNOHANG) == host->pid)
-	    host->pid = 0;
-	
-	if (!host->loop->select(msec_timeout < 0 ? 100 : msec_timeout,
-				true, false))
+    if (host->pending())
+    {
+	engine->wait(host, msec_timeout);
+	if (host->pending())
+	    return -1; // timeout, but still trying
+    }
+
+    if (host->negative)
+    {
+	// the name doesn't exist.
+	return 0;
+    }
+
+    if (addr)
+	*addr = host->addr;
+    if (addrlist)
+    {
+	WvIPAddrList::Iter i(host->addrlist);
+	for (i.rewind(); i.next(); )
 	{
-	    if (host->pid)
-	    {
-		if (msec_timeout >= 0)
-		    return -1; // timeout, but still trying
-	    }
-	    else
-	    {
-		// the child is dead.  Clean up our stream, too.
-		WVRELEASE(host->loop);
-		host->loop = NULL;
-		host->negative = true;
-		return 0; // exited while doing search
-	    }
+	    addrlist->append(i.ptr(), false);
+	    res++;
 	}
-	else
-	    break;
-    } while (host->pid && msec_timeout < 0); // repeat if unlimited timeout!
-#endif
-
-    // data coming in!
-    char *line;
-    
-    do
-    {
-	line = host->loop->blocking_getline(-1);
-    } while (!line && host->loop->isok());
-    
-    if (line && line[0] != 0)
-    {
-        res = 1;
-        WvIPAddr *resolvedaddr;
-        char *p;
-        p = strtok(line, " \n");
-	resolvedaddr = new WvIPAddr(p);
-	host->addr = resolvedaddr;
-        host->addrlist.append(resolvedaddr, true);
-        if (addr)
-            *addr = host->addr;
-        if (addrlist)
-            addrlist->append(host->addr, false);
-        do
-        {
-            p = strtok(NULL, " \n");
-            if (p)
-            {
-                res++;
-                resolvedaddr = new WvIPAddr(p);
-                host->addrlist.append(resolvedaddr, true);
-                if (addrlist)
-                    addrlist->append(resolvedaddr, false);
-            }
-        } while (p);
-	host->done = true;
     }
     else
-	host->negative = true;
-
-    if (host->pid && waitpid(host->pid, NULL, 0) == host->pid)
-	host->pid = 0;
-    WVRELEASE(host->loop);
-    host->loop = NULL;
-    
-    // Return as many addresses as we find.
-    return host->negative ? 0 : res;
+	res = 1;
+    return res;
 }
 
+
 void WvResolver::clearhost(WvStringParm hostname)
 {
     WvResolverHost *host = (*hostmap)[hostname];
     if (host)
+    {
+	engine->forget(host);
         hostmap->remove(host);
+    }
 }
 
 
 void WvResolver::pre_select(WvStringParm hostname, WvStream::SelectInfo &si)
 {
     WvResolverHost *host = (*hostmap)[hostname];
-    
+
     if (host)
     {
-	if (host->loop)
-	    host->loop->xpre_select(si,
-			    WvStream::SelectRequest(true, false, false));
+	if (host->pending())
+	    engine->pre_select(si);
 	else
 	    si.msec_timeout = 0; // already ready
     }
@@ -331,14 +957,24 @@ void WvResolver::pre_select(WvStringParm hostname, WvStream::SelectInfo &si)
 bool WvResolver::post_select(WvStringParm hostname, WvStream::SelectInfo &si)
 {
     WvResolverHost *host = (*hostmap)[hostname];
-    
+
     if (host)
     {
-	if (host->loop)
-	    return host->loop->xpost_select(si,
-                    WvStream::SelectRequest(true, false, false));
-	else
-	    return true; // already ready
+	if (host->pending())
+	    engine->service();
+	return !host->pending();
     }
     return false;
 }
+
+
+void WvResolver::set_resolv_conf(WvStringParm filename)
+{
+    resolv_conf_file = filename;
+}
+
+
+void WvResolver::set_hosts_file(WvStringParm filename)
+{
+    hosts_file = filename;
+}
@@ -0,0 +1,96 @@
+#include "wvtest.h"
+#include "wvcoroutine.h"
+#include "wvloopback.h"
+#include "wvstringlist.h"
+
+// Makefile.in builds this into its own test program with -std=gnu++20
+#ifndef WVCOROUTINE_AVAILABLE
+#error "wvcoroutine.t.cc needs a compiler with C++20 coroutines"
+#endif
+
+static WvCoTask echo_session(WvStream *s, WvStringList *got, bool *done)
+{
+    WvCoStream co(*s);
+    char *line;
+    while ((line = co_await co.getline(1000)) != NULL)
+    {
+	got->append(line);
+	if (!strcmp(line, "quit"))
+	    break;
+    }
+    *done = true;
+}
+
+
+static void run_until(bool &done, int max = 100)
+{
+    for (int i = 0; !done && i < max; i++)
+	WvIStreamList::globallist.runonce(10);
+}
+
+
+WVTEST_MAIN("coroutine getline")
+{
+    WvLoopback a, b;
+    WvStringList gota, gotb;
+    bool donea = false, doneb = false;
+
+    echo_session(&a, &gota, &donea);
+    echo_session(&b, &gotb, &doneb);
+    WVFAIL(donea);
+    WVFAIL(doneb);
+
+    // lines can arrive in pieces, and interleaved between sessions
+    a.print("hel");
+    b.print("one\ntwo\n");
+    WvIStreamList::globallist.runonce(10);
+    WvIStreamList::globallist.runonce(10);
+    a.print("lo\nquit\n");
+    run_until(donea);
+    WVPASS(donea);
+    WVPASSEQ(gota.join(","), "hello,quit");
+
+    WVFAIL(doneb);
+    b.print("quit\n");
+    run_until(doneb);
+    WVPASS(doneb);
+    WVPASSEQ(gotb.join(","), "one,two,quit");
+}
+
+
+static WvCoTask timeout_session(WvStream *s, int *state)
+{
+    WvCoStream co(*s);
+    *state = 1;
+    co_await co.sleep(50);
+    *state = 2;
+    bool readable = co_await co.readable(50);
+    *state = readable ? 3 : 4;
+    char buf[10];
+    size_t len = co_await co.read(buf, sizeof(buf), 1000);
+    *state = (len == 3) ? 5 : 6;
+}
+
+
+WVTEST_MAIN("coroutine timeouts")
+{
+    WvLoopback s;
+    int state = 0;
+
+    timeout_session(&s, &state);
+    WVPASSEQ(state, 1);
+
+    // nothing arrives, so readable() times out
+    for (int i = 0; state < 4 && i < 100; i++)
+	WvIStreamList::globallist.runonce(10);
+    WVPASSEQ(state, 4);
+
+    s.write("abc", 3);
+    for (int i = 0; state < 5 && i < 100; i++)
+	WvIStreamList::globallist.runonce(10);
+    WVPASSEQ(state, 5);
+
+    // the WvCoStream removed itself from the list when the session ended
+    WvIStreamList::Iter i(WvIStreamList::globallist);
+    WVFAIL(i.find(&s));
+}
@@ -197,6 +197,58 @@ WVTEST_MAIN("Recursion avoidance")
     WVPASSEQ(unlink(logfilename), 0);
 }
 
+WVTEST_MAIN("custom levels")
+{
+    WvLogBuffer logbuffer(10, WvLog::Info);
+    WvLog mysql("MySQL server", WvLog::Debug);
+    WvLog other("other", WvLog::Debug);
+
+    WVPASS(logbuffer.set_custom_levels("mysql=7"));
+    mysql("one\n");
+    other("two\n");
+    mysql("three\n");
+
+    // changing the levels has to forget what we looked up before
+    WVPASS(logbuffer.set_custom_levels("other=7"));
+    mysql("four\n");
+    other("five\n");
+
+    WvLogBuffer::MsgList::Iter i(logbuffer.messages());
+    i.rewind();
+    WVPASS(i.next());
+    WVPASSEQ(i->message, "one");
+    WVPASS(i.next());
+    WVPASSEQ(i->message, "three");
+    WVPASS(i.next());
+    WVPASSEQ(i->message, "five");
+    WVFAIL(i.next());
+}
+
+
+WVTEST_MAIN("unprintable characters")
+{
+    WvLogBuffer logbuffer(10);
+    WvLog log("escapes", WvLog::Info);
+
+    log("a\tb\001\002c\r\xe9\n");
+    WvString longline("%s", WvString("x\001").cstr());
+    for (int n = 0; n < 6; n++)
+        longline = WvString("%s%s", longline, longline);
+    log("%s\n", longline);
+
+    WvLogBuffer::MsgList::Iter i(logbuffer.messages());
+    i.rewind();
+    WVPASS(i.next());
+    WVPASSEQ(i->message, "a b[01][02]c");
+    WVPASS(i.next());
+    WVPASSEQ(i->message, "\xe9");
+    WVPASS(i.next());
+    WVPASSEQ(i->message.len(), 64 * 5);
+    WVPASSEQ(WvString(i->message).cstr() + 310, "x[01]x[01]");
+    WVFAIL(i.next());
+}
+
+
 #if 0
 WVTEST_MAIN("wvlog performance")
 {
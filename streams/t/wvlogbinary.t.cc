@@ -0,0 +1,101 @@
+#include "wvtest.h"
+#include "wvlogbinary.h"
+#include "wvfileutils.h"
+#include <sys/stat.h>
+
+WVTEST_MAIN("binary log round trip")
+{
+    WvString name(wvtmpfilename("wvtest-binlog"));
+    {
+	WvLogBinary bin(name, 65536, 0, WvLog::Debug);
+	WVPASS(bin.isok());
+
+	WvLog a("first source", WvLog::Info), b("second", WvLog::Debug);
+	a("hello\n");
+	b("raw\001bytes\tand all\n");
+	a(WvLog::Debug5, "too noisy\n");
+	a("partial ");
+	a("line\n");
+    }
+
+    // not bigger than it needs to be
+    struct stat st;
+    WVPASS(stat(name, &st) == 0);
+    WVPASS(st.st_size < 1024);
+
+    WvLogBinaryReader r(name);
+    WVPASS(r.isok());
+    WVPASS(r.next());
+    WVPASSEQ(r.source, "first source");
+    WVPASSEQ(r.level, WvLog::Info);
+    WVPASS(!memcmp(r.text, "hello\n", 6) && r.len == 6);
+    WVPASS(r.when.tv_sec > 0);
+
+    WVPASS(r.next());
+    WVPASSEQ(r.source, "second");
+    WVPASSEQ(r.level, WvLog::Debug);
+    WVPASS(r.len == 18 && !memcmp(r.text, "raw\001bytes\tand all\n", 18));
+
+    WVPASS(r.next());
+    WVPASSEQ(r.source, "first source");
+    WVPASS(r.len == 8 && !memcmp(r.text, "partial ", 8));
+    WVPASS(r.next());
+    WVPASS(r.len == 5 && !memcmp(r.text, "line\n", 5));
+    WVFAIL(r.next());
+
+    // starting again adds to the same file
+    {
+	WvLogBinary bin(name, 65536, 0, WvLog::Debug);
+	WvLog c("third", WvLog::Info);
+	c("more\n");
+    }
+    WvLogBinaryReader r2(name);
+    int count = 0;
+    while (r2.next())
+	count++;
+    WVPASSEQ(count, 5);
+    WVPASSEQ(r2.source, "third");
+
+    unlink(name);
+}
+
+
+WVTEST_MAIN("binary log rotation")
+{
+    WvString name(wvtmpfilename("wvtest-binlog"));
+    {
+	WvLogBinary bin(name, 4096, 2, WvLog::Debug);
+	WvLog log("rotating", WvLog::Info);
+	for (int i = 0; i < 300; i++)
+	    log("message number %s\n", i);
+    }
+
+    WVPASS(access(name, R_OK) == 0);
+    WVPASS(access(WvString("%s.1", name), R_OK) == 0);
+    WVPASS(access(WvString("%s.2", name), R_OK) == 0);
+    WVFAIL(access(WvString("%s.3", name), R_OK) == 0);
+
+    // every file starts by naming its sources again, and the newest
+    // file ends with the last message
+    WvLogBinaryReader r1(WvString("%s.1", name));
+    WVPASS(r1.next());
+    WVPASSEQ(r1.source, "rotating");
+    WvLogBinaryReader r(name);
+    WvString last;
+    while (r.next())
+    {
+	WVPASSEQ(r.source, "rotating");
+	last.setsize(r.len + 1);
+	memcpy(last.edit(), r.text, r.len);
+	last.edit()[r.len] = 0;
+    }
+    WVPASSEQ(last, "message number 299\n");
+
+    unlink(name);
+    unlink(WvString("%s.1", name));
+    unlink(WvString("%s.2", name));
+
+    WvLogBinaryReader bad("/dev/null");
+    WVFAIL(bad.isok());
+    WVFAIL(bad.next());
+}
@@ -1,6 +1,7 @@
 #include "wvtest.h"
 #include "wvlogfile.h"
 #include "wvfileutils.h"
+#include "wvdiriter.h"
 
 WVTEST_MAIN("wvlogfile")
 {
@@ -17,3 +18,149 @@ WVTEST_MAIN("wvlogfile")
     log.print("log test\n");
     WVPASS(true);
 }
+
+
+WVTEST_MAIN("async wvlogfilebase")
+{
+    WvString name(wvtmpfilename("wvtest-asynclog"));
+    {
+	WvLogFileBase f(name, WvLog::Debug);
+	WVPASS(f.set_async(16));
+	
+	WvLog log("async", WvLog::Info);
+	log("first\n");
+	log("second part, ");
+	log("and the rest\n");
+	log(WvLog::Debug, "bad\001char\n");
+	f.drain();
+	WVPASSEQ(f.async_dropped(), 0);
+	
+	WvFile in(name, O_RDONLY);
+	WvString line1(in.getline(0)), line2(in.getline(0)),
+	    line3(in.getline(0));
+	WVPASS(strstr(line1, ": async<Info>: first"));
+	WVPASS(strstr(line2, ": async<Info>: second part, and the rest"));
+	WVPASS(strstr(line3, ": async<*1>: bad[01]char"));
+	WVFAIL(in.getline(0));
+	
+	// the ring only holds 16 lines, and nobody waits for it
+	for (int i = 0; i < 10000; i++)
+	    log("line %s\n", i);
+	log("last\n");
+    }
+    
+    // whatever wasn't dropped gets written before the destructor returns
+    WvFile in(name, O_RDONLY);
+    int count = 0;
+    char *line;
+    WvString last;
+    while ((line = in.getline(0)) != NULL)
+    {
+	count++;
+	last = line;
+    }
+    WVPASS(count > 3);
+    WVPASS(strstr(last, "last") || strstr(last, "dropped"));
+    unlink(name);
+}
+
+
+WVTEST_MAIN("async wvlogfilebase, blocking")
+{
+    WvString name(wvtmpfilename("wvtest-asynclog"));
+    {
+	WvLogFileBase f(name, WvLog::Debug);
+	WVPASS(f.set_async(4, WvLogFileBase::AsyncBlock));
+	WvLog log("async", WvLog::Info);
+	for (int i = 0; i < 1000; i++)
+	    log("line %s\n", i);
+	WVPASSEQ(f.async_dropped(), 0);
+    }
+    
+    WvFile in(name, O_RDONLY);
+    int count = 0;
+    char *line;
+    bool inorder = true;
+    while ((line = in.getline(0)) != NULL)
+    {
+	if (!strstr(line, WvString("line %s", count)))
+	    inorder = false;
+	count++;
+    }
+    WVPASSEQ(count, 1000);
+    WVPASS(inorder);
+    unlink(name);
+}
+
+
+// The number of times our threads have gone to sleep, or -1 if we can't
+// tell (no /proc).
+static long context_switches()
+{
+    long total = -1;
+    WvDirIter i("/proc/self/task", false);
+    for (i.rewind(); i.next(); )
+    {
+	WvFile status(WvString("%s/status", i->fullname), O_RDONLY);
+	char *line;
+	while (status.isok() && (line = status.blocking_getline(0)) != NULL)
+	{
+	    if (!strncmp(line, "voluntary_ctxt_switches:", 24))
+		total = (total < 0 ? 0 : total) + atol(line + 24);
+	}
+    }
+    return total;
+}
+
+
+WVTEST_MAIN("async wvlogfilebase, idle")
+{
+    WvString name(wvtmpfilename("wvtest-asynclog"));
+    {
+	WvLogFileBase f(name, WvLog::Debug);
+	WVPASS(f.set_async(16));
+	WvLog log("async", WvLog::Info);
+	log("before\n");
+	f.drain();
+	
+	// with nothing to write, the writer thread shouldn't wake up
+	long before = context_switches();
+	usleep(200 * 1000);
+	long after = context_switches();
+	if (before >= 0)
+	    WVPASS(after - before < 10);
+	
+	log("after\n");
+	f.drain();
+	WvFile in(name, O_RDONLY);
+	WVPASS(strstr(in.getline(0), "before"));
+	WVPASS(strstr(in.getline(0), "after"));
+    }
+    unlink(name);
+}
+
+
+WVTEST_MAIN("wvlogfilebase prefixes")
+{
+    WvString name(wvtmpfilename("wvtest-prefixlog"));
+    {
+	WvLogFileBase f(name, WvLog::Debug);
+	WvLog a("a", WvLog::Info);
+	WvLog longer("a much longer source name", WvLog::Warning);
+	a("one\n");
+	longer("two\n");
+	a("three\n");
+	a(WvLog::Critical, "four\n");
+    }
+    
+    WvFile in(name, O_RDONLY);
+    WvString line1(in.getline(0)), line2(in.getline(0)),
+	line3(in.getline(0)), line4(in.getline(0));
+    WVPASS(strstr(line1, ": a<Info>: one"));
+    WVPASS(strstr(line2, ": a much longer source name<Warn>: two"));
+    WVPASS(strstr(line3, ": a<Info>: three"));
+    WVPASS(strstr(line4, ": a<Crit>: four"));
+    WVPASSEQ(strstr(line1, ": a<") - line1.cstr(),
+	     strstr(line4, ": a<") - line4.cstr());
+    unlink(name);
+}
@@ -88,3 +88,32 @@ WVTEST_MAIN("loopback eof2")
     WVPASSEQ(s.blocking_getline(1000), "nonewline");
     WVFAIL(s.isok());
 }
+
+
+WVTEST_MAIN("loopback partial lines")
+{
+    WvLoopback s;
+    
+    // a line arriving in pieces comes out whole
+    s.write("abc");
+    WVFAIL(s.blocking_getline(100));
+    s.write("def");
+    WVFAIL(s.blocking_getline(100));
+    s.write("ghi\njkl");
+    WVPASSEQ(s.blocking_getline(1000), "abcdefghi");
+    
+    // reading from the buffer doesn't make us skip anything
+    s.write("mn\n");
+    WVFAIL(s.blocking_getline(100, 'x'));
+    char buf[2];
+    s.queuemin(0); // left over from the failed getline
+    WVPASSEQ(s.read(buf, 2), 2);
+    WVPASS(!strncmp(buf, "jk", 2));
+    WVPASSEQ(s.blocking_getline(1000), "lmn");
+    
+    // neither does switching separators
+    s.write("op:q\n");
+    WVFAIL(s.blocking_getline(100, 'x'));
+    WVPASSEQ(s.blocking_getline(1000, ':'), "op");
+    WVPASSEQ(s.blocking_getline(1000), "q");
+}
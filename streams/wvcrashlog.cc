@@ -21,6 +21,5 @@ void WvCrashLog::_mid_line(const char *str, size_t len)
 
 void WvCrashLog::_make_prefix(time_t timenow)
 {
-    prefix = WvString("%s<%s>: ", last_source, loglevels[last_level]);
-    prelen = prefix.len();
+    set_prefix(NULL);
 }
@@ -13,10 +13,6 @@
 
 #include <ctype.h>
 
-#ifdef _WIN32
-#define snprintf _snprintf
-#endif
-
 WvLogRcvBaseList *WvLog::receivers;
 int WvLog::num_receivers = 0, WvLog::num_logs = 0;
 WvLogRcvBase *WvLog::default_receiver = NULL;
@@ -222,9 +218,12 @@ void WvLogRcvBase::cleanup_on_fork(pid_t p)
 
 
 
-WvLogRcv::WvLogRcv(WvLog::LogLevel _max_level) : custom_levels(5)
+WvLogRcv::WvLogRcv(WvLog::LogLevel _max_level)
+    : custom_levels(5), custom_matches(5)
 {
     last_source = WvString();
+    prefix_buf = NULL;
+    prefix_size = 0;
     last_level = WvLog::NUM_LOGLEVELS;
     last_time = 0;
     max_level = _max_level;
@@ -239,9 +238,44 @@ WvLogRcv::~WvLogRcv()
 
 void WvLogRcv::_make_prefix(time_t now)
 {
-    prefix = WvString("%s<%s>: ",
-        last_source, loglevels[last_level]);
-    prelen = prefix.len();
+    set_prefix(NULL);
+}
+
+
+void WvLogRcv::set_prefix(const char *timestr)
+{
+    const char *src = last_source.cstr(), *lvl = loglevels[last_level];
+    if (!src)
+	src = "(nil)";
+    size_t tlen = timestr ? strlen(timestr) : 0;
+    size_t slen = strlen(src), llen = strlen(lvl);
+    size_t len = (timestr ? tlen + 2 : 0) + slen + 1 + llen + 3;
+
+    // someone else might have replaced or copied the string since we
+    // made it, in which case we need a new one.
+    if (len >= prefix_size || prefix.cstr() != prefix_buf
+	|| !prefix.is_unique())
+    {
+	prefix_size = len + 32;
+	prefix.setsize(prefix_size);
+	prefix_buf = prefix.cstr();
+    }
+
+    char *cptr = prefix.edit();
+    if (timestr)
+    {
+	memcpy(cptr, timestr, tlen);
+	cptr += tlen;
+	*cptr++ = ':';
+	*cptr++ = ' ';
+    }
+    memcpy(cptr, src, slen);
+    cptr += slen;
+    *cptr++ = '<';
+    memcpy(cptr, lvl, llen);
+    cptr += llen;
+    memcpy(cptr, ">: ", 4);
+    prelen = len;
 }
 
 
@@ -258,37 +292,63 @@ void WvLogRcv::_end_line()
 
 
 // like isprint(), but always treats chars >128 as printable, because they
-// always are (even if they're meaningless)
-static bool my_isprint(char _c)
+// always are (even if they're meaningless).
+static bool printable[256];
+
+static void init_printable()
 {
-    unsigned char c = _c;
-    if (isprint(c) || c >= 128)
-	return true;
-    else
-	return false;
+    static bool init = false;
+    if (init)
+	return;
+    for (int c = 0; c < 256; c++)
+	printable[c] = isprint(c) || c >= 128;
+    init = true;
 }
 
 
-void WvLogRcv::log(WvStringParm source, int _loglevel,
-			const char *_buf, size_t len)
+// the most sources we remember custom levels for, in case someone makes
+// up a new source name for every message
+#define MAX_CUSTOM_MATCHES 256
+
+WvLogRcv::Src_Lvl *WvLogRcv::find_custom_level(WvStringParm source)
 {
-    WvLog::LogLevel loglevel = (WvLog::LogLevel)_loglevel;
-    char hex[5];
-    WvLog::LogLevel threshold = max_level;
+    Src_Match *m = custom_matches[source];
+    if (m)
+	return m->match;
+
     WvString srcname(source);
     strlwr(srcname.edit());
 
+    Src_Lvl *match = NULL;
     Src_LvlDict::Iter i(custom_levels);
-    i.rewind(); 
+    for (i.rewind(); i.next(); )
+    {
+	if (strstr(srcname, i->src))
+	{
+	    match = i.ptr();
+	    break;
+	}
+    }
+
+    if (custom_matches.count() >= MAX_CUSTOM_MATCHES)
+	custom_matches.zap();
+    custom_matches.add(new Src_Match(source, match), true);
+    return match;
+}
+
+
+void WvLogRcv::log(WvStringParm source, int _loglevel,
+			const char *_buf, size_t len)
+{
+    WvLog::LogLevel loglevel = (WvLog::LogLevel)_loglevel;
+    WvLog::LogLevel threshold = max_level;
 
     // Check if the debug level for the source has been overridden
-    while (i.next())
+    if (!custom_levels.isempty())
     {
-        if (strstr(srcname, i->src))
-        {
-            threshold = i->lvl;
-            break;
-        }
+	Src_Lvl *custom = find_custom_level(source);
+	if (custom)
+	    threshold = custom->lvl;
     }
      
     if (loglevel > threshold)
@@ -319,10 +379,18 @@ void WvLogRcv::log(WvStringParm source, int _loglevel,
 	    _make_prefix(now);
     }
     
-    const char *buf = (const char *)_buf, *bufend = buf + len, *cptr;
-
-    // loop through the buffer, printing each character or its [hex] equivalent
-    // if it is unprintable.  Also eat newlines unless they are appropriate.
+    init_printable();
+    
+    const unsigned char *buf = (const unsigned char *)_buf,
+	*bufend = buf + len, *cptr;
+    static const char hexdigits[] = "0123456789abcdef";
+    char esc[128];
+    size_t esclen;
+
+    // loop through the buffer, printing each run of printable characters
+    // in one go.  Unprintable ones are replaced by their [hex] equivalent
+    // (or a space, for tabs), and a run of them is printed in one go too.
+    // Also eat newlines unless they are appropriate.
     while (buf < bufend)
     {
 	if (buf[0] == '\n' || buf[0] == '\r')
@@ -334,42 +402,30 @@ void WvLogRcv::log(WvStringParm source, int _loglevel,
 
 	begin_line();
 
-	if (buf[0] == '\t')
-	{
-	    mid_line(" ", 1);
-	    buf++;
-	    continue;
-	}
-	else if (!my_isprint(buf[0]))
+	for (cptr = buf; cptr < bufend && printable[*cptr]; cptr++)
+	    ;
+	if (cptr > buf)
 	{
-	    snprintf(hex, 5, "[%02x]", buf[0]);
-	    mid_line(hex, 4);
-	    buf++;
+	    mid_line((const char *)buf, cptr - buf);
+	    buf = cptr;
 	    continue;
 	}
 
-	// like strchr, but size-limited instead of null-terminated
-	for (cptr = buf; cptr < bufend; cptr++)
+	for (esclen = 0; buf < bufend && esclen <= sizeof(esc) - 4; buf++)
 	{
-	    if (*cptr == '\n' || !my_isprint(*cptr))
+	    if (buf[0] == '\t')
+		esc[esclen++] = ' ';
+	    else if (!printable[buf[0]] && buf[0] != '\n' && buf[0] != '\r')
+	    {
+		esc[esclen++] = '[';
+		esc[esclen++] = hexdigits[buf[0] >> 4];
+		esc[esclen++] = hexdigits[buf[0] & 15];
+		esc[esclen++] = ']';
+	    }
+	    else
 		break;
 	}
-	
-	if (cptr >= bufend) // end of buffer
-	{
-	    mid_line(buf, bufend - buf);
-	    buf = bufend;
-	}
-	else if (*cptr == '\n') // end of line
-	{
-	    mid_line((const char *)buf, cptr - buf);
-	    buf = cptr;
-	}
-	else // therefore (!my_isprint(*cptr))
-	{
-	    mid_line(buf, cptr - buf);
-	    buf = cptr;
-	}
+	mid_line(esc, esclen);
     }
 }
 
@@ -378,6 +434,7 @@ void WvLogRcv::log(WvStringParm source, int _loglevel,
 //    'number' is the number of the log level to use.
 bool WvLogRcv::set_custom_levels(WvString descr)
 {
+    custom_matches.zap();
     custom_levels.zap();
 
     // Parse the filter line into individual rules
@@ -0,0 +1,289 @@
+/*
+ * Worldvisions Weaver Software:
+ *   Copyright (C) 1997-2002 Net Integration Technologies, Inc.
+ *
+ * A "Log Receiver" that saves log messages in a compact binary file.  See
+ * wvlogbinary.h.
+ */
+#include "wvlogbinary.h"
+#include "wvtimeutils.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PAD8(n) (((n) + 7) & ~(size_t)7)
+
+// the biggest source id; after that, we start a new file
+#define MAX_SOURCE_ID 65535
+
+
+//----------------------------------- WvLogBinary --------------------
+
+WvLogBinary::WvLogBinary(WvStringParm _filename, size_t _max_size,
+			 int _keep, WvLog::LogLevel _max_level)
+    : filename(_filename), max_size(_max_size), keep(_keep),
+      max_level(_max_level), fd(-1), hdr(NULL), sources(16)
+{
+    if (max_size < 4096)
+	max_size = 4096;
+    open_file();
+}
+
+
+WvLogBinary::~WvLogBinary()
+{
+    close_file();
+}
+
+
+bool WvLogBinary::open_file()
+{
+    sources.zap();
+
+    fd = ::open(filename, O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+	return false;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    // keep adding to an existing file, as long as it's one of ours
+    struct stat st;
+    bool fresh = (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*hdr));
+    if (!fresh)
+    {
+	WvLogBinaryHeader old;
+	if (pread(fd, &old, sizeof(old), 0) != (ssize_t)sizeof(old)
+	    || memcmp(old.magic, WVLOGBINARY_MAGIC, sizeof(old.magic))
+	    || old.version != WVLOGBINARY_VERSION
+	    || old.used > max_size || old.used < old.hdrsize)
+	{
+	    fresh = true;
+	}
+    }
+    if (fresh && ftruncate(fd, 0) < 0)
+    {
+	close_file();
+	return false;
+    }
+
+    if (ftruncate(fd, max_size) < 0)
+    {
+	close_file();
+	return false;
+    }
+
+    void *map = mmap(NULL, max_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		     fd, 0);
+    if (map == MAP_FAILED)
+    {
+	close_file();
+	return false;
+    }
+    hdr = (WvLogBinaryHeader *)map;
+
+    if (fresh)
+    {
+	memcpy(hdr->magic, WVLOGBINARY_MAGIC, sizeof(hdr->magic));
+	hdr->version = WVLOGBINARY_VERSION;
+	hdr->hdrsize = PAD8(sizeof(*hdr));
+	hdr->used = hdr->hdrsize;
+    }
+    hdr->size = max_size;
+    return true;
+}
+
+
+void WvLogBinary::close_file()
+{
+    if (hdr)
+    {
+	size_t used = hdr->used;
+	munmap(hdr, max_size);
+	hdr = NULL;
+
+	// don't waste space on the part we didn't use
+	if (ftruncate(fd, used) < 0)
+	    ; // oh well, it's just bigger than it needs to be
+    }
+    if (fd >= 0)
+	::close(fd);
+    fd = -1;
+}
+
+
+void WvLogBinary::rotate()
+{
+    close_file();
+
+    if (keep > 0)
+    {
+	for (int i = keep - 1; i >= 1; i--)
+	    ::rename(WvString("%s.%s", filename, i),
+		     WvString("%s.%s", filename, i + 1));
+	::rename(filename, WvString("%s.1", filename));
+    }
+    else
+	::unlink(filename);
+
+    open_file();
+}
+
+
+bool WvLogBinary::append(uint64_t usec, unsigned source, int level,
+			 int type, const void *data, size_t len)
+{
+    size_t need = sizeof(WvLogBinaryRecord) + PAD8(len);
+    if (hdr->used + need > max_size)
+	return false;
+
+    char *where = (char *)hdr + hdr->used;
+    WvLogBinaryRecord *rec = (WvLogBinaryRecord *)where;
+    rec->usec = usec;
+    rec->len = len;
+    rec->source = source;
+    rec->level = level;
+    rec->type = type;
+    memcpy(where + sizeof(*rec), data, len);
+
+    // only now does the record officially exist
+    hdr->used += need;
+    return true;
+}
+
+
+void WvLogBinary::log(WvStringParm source, int loglevel,
+		      const char *_buf, size_t len)
+{
+    if (loglevel > max_level || !len)
+	return;
+    if (!hdr && !open_file())
+	return;
+
+    // a single message can't be bigger than a whole file
+    size_t room = max_size - PAD8(sizeof(*hdr))
+	- 2 * sizeof(WvLogBinaryRecord) - PAD8(source.len());
+    if (len > room)
+	len = room;
+
+    WvTime now = wvtime();
+    uint64_t usec = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+    const char *name = appname(source);
+
+    for (int tries = 0; tries < 2; tries++)
+    {
+	SourceId *src = sources[name];
+	size_t need = sizeof(WvLogBinaryRecord) + PAD8(len);
+	if (!src)
+	    need += sizeof(WvLogBinaryRecord) + PAD8(strlen(name));
+	if (hdr->used + need > max_size
+	    || (!src && sources.count() >= MAX_SOURCE_ID))
+	{
+	    rotate();
+	    if (!hdr)
+		return;
+	    continue;
+	}
+
+	if (!src)
+	{
+	    src = new SourceId(name, sources.count() + 1);
+	    sources.add(src, true);
+	    append(usec, src->id, 0, WvLogBinaryRecord::Source,
+		   name, strlen(name));
+	}
+	append(usec, src->id, loglevel, WvLogBinaryRecord::Message,
+	       _buf, len);
+	return;
+    }
+}
+
+
+//----------------------------------- WvLogBinaryReader --------------
+
+WvLogBinaryReader::WvLogBinaryReader(WvStringParm filename)
+    : text(NULL), len(0), hdr(NULL), mapsize(0), pos(0), names(16)
+{
+    when.tv_sec = when.tv_usec = 0;
+    level = WvLog::Info;
+
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0)
+	return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(*hdr))
+    {
+	mapsize = st.st_size;
+	void *map = mmap(NULL, mapsize, PROT_READ, MAP_SHARED, fd, 0);
+	if (map != MAP_FAILED)
+	{
+	    hdr = (const WvLogBinaryHeader *)map;
+	    if (memcmp(hdr->magic, WVLOGBINARY_MAGIC, sizeof(hdr->magic))
+		|| hdr->version != WVLOGBINARY_VERSION
+		|| hdr->hdrsize < sizeof(*hdr) || hdr->hdrsize > mapsize)
+	    {
+		munmap(map, mapsize);
+		hdr = NULL;
+	    }
+	    else
+		pos = hdr->hdrsize;
+	}
+    }
+    ::close(fd);
+}
+
+
+WvLogBinaryReader::~WvLogBinaryReader()
+{
+    if (hdr)
+	munmap((void *)hdr, mapsize);
+}
+
+
+bool WvLogBinaryReader::next()
+{
+    if (!hdr)
+	return false;
+
+    // the writer might still be adding to it, so check every time
+    size_t end = hdr->used < mapsize ? hdr->used : mapsize;
+    while (pos + sizeof(WvLogBinaryRecord) <= end)
+    {
+	const char *where = (const char *)hdr + pos;
+	const WvLogBinaryRecord *rec = (const WvLogBinaryRecord *)where;
+	size_t need = sizeof(*rec) + PAD8((size_t)rec->len);
+	if (pos + need > end)
+	    break; // corrupt
+	pos += need;
+
+	const char *data = where + sizeof(*rec);
+	if (rec->type == WvLogBinaryRecord::Source)
+	{
+	    // a later definition of the same id replaces the old one
+	    SourceName *old = names[rec->source];
+	    if (old)
+		names.remove(old);
+	    WvString name;
+	    name.setsize(rec->len + 1);
+	    memcpy(name.edit(), data, rec->len);
+	    name.edit()[rec->len] = 0;
+	    names.add(new SourceName(rec->source, name), true);
+	}
+	else if (rec->type == WvLogBinaryRecord::Message)
+	{
+	    SourceName *name = names[rec->source];
+	    source = name ? name->name : WvString("unknown");
+	    level = (WvLog::LogLevel)rec->level;
+	    when.tv_sec = rec->usec / 1000000;
+	    when.tv_usec = rec->usec % 1000000;
+	    text = data;
+	    len = rec->len;
+	    return true;
+	}
+	// else some record type we don't know about yet; skip it
+    }
+
+    text = NULL;
+    len = 0;
+    return false;
+}
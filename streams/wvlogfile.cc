@@ -14,6 +14,7 @@
 #include <sys/types.h>
 #ifndef _WIN32
 #include <sys/wait.h>
+#include <pthread.h>
 #endif
 
 #define MAX_LOGFILE_SZ	1024*1024*100	// 100 Megs
@@ -32,6 +33,386 @@ static time_t gmtoffset()
 }
 
 
+#ifdef _WIN32
+#define TIME_FORMAT "%b %d %H:%M:%S" // timezones in win32 look stupid
+#else
+#define TIME_FORMAT "%b %d %H:%M:%S %Z"
+#endif
+
+
+//----------------------------------- WvLogFileBase::AsyncWriter -----
+
+#ifndef _WIN32
+
+// Start writing once a batch gets this big, even if there's more queued.
+#define ASYNC_BATCH_MAX 65536
+
+/*
+ * The ring is a bounded multi-producer, single-consumer queue: each slot
+ * has a sequence number that says whether it's ready to be filled (seq ==
+ * position) or emptied (seq == position + 1), so producers only need a
+ * compare-and-swap to claim a slot, and nobody takes a lock while the
+ * writer thread is busy.  When the ring is empty the writer sleeps on a
+ * condition variable, and only then do producers need to wake it up.
+ * Anyone waiting for the writer to catch up (drain(), or a full ring with
+ * AsyncBlock) sleeps on another one.
+ *
+ * Records are plain malloc()ed blocks, not WvStrings, because WvString's
+ * reference counts aren't thread-safe.
+ */
+class WvLogFileBase::AsyncWriter
+{
+public:
+    struct Record
+    {
+	time_t when;
+	int level;
+	size_t srclen, textlen;
+	// followed by the source and the text, not nul-terminated
+
+	const char *source() const
+	    { return (const char *)(this + 1); }
+	const char *text() const
+	    { return source() + srclen; }
+    };
+
+    struct Slot
+    {
+	size_t seq;
+	Record *rec;
+    };
+
+    WvLogFileBase &file;
+    AsyncOverflow overflow;
+    Slot *ring;
+    size_t mask;
+    size_t head, tail;          // next slot to fill, next slot to empty
+    size_t queued, written;     // counts of records
+    size_t dropped, reported_dropped;
+    bool stopping;
+    pid_t owner;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work, progress; // for the writer, and for the others
+    bool sleeping;                 // the writer is waiting for work
+    int waiters;                   // others waiting for progress
+
+    // only used by the writer thread
+    char *batch;
+    size_t batchlen, batchsize;
+    int since_fsync;
+    time_t last_when;
+    char timestr[30];
+
+    AsyncWriter(WvLogFileBase &_file, size_t size, AsyncOverflow _overflow);
+    ~AsyncWriter();
+
+    bool start();
+    bool push(time_t when, int level, WvStringParm source,
+	      const void *text, size_t textlen);
+    void drain();
+
+private:
+    Record *pop();
+    bool ready() const;
+    void wait_progress(size_t pos);
+    void append(const char *str, size_t len);
+    void format(const Record *rec);
+    void flush_batch();
+    void run();
+
+    static void *thread_main(void *userdata)
+	{ ((AsyncWriter *)userdata)->run(); return NULL; }
+};
+
+
+WvLogFileBase::AsyncWriter::AsyncWriter(WvLogFileBase &_file, size_t size,
+					AsyncOverflow _overflow)
+    : file(_file), overflow(_overflow)
+{
+    size_t n = 2;
+    while (n < size)
+	n *= 2;
+    ring = new Slot[n];
+    mask = n - 1;
+    for (size_t i = 0; i < n; i++)
+    {
+	ring[i].seq = i;
+	ring[i].rec = NULL;
+    }
+    head = tail = queued = written = dropped = reported_dropped = 0;
+    stopping = false;
+    owner = getpid();
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&work, NULL);
+    pthread_cond_init(&progress, NULL);
+    sleeping = false;
+    waiters = 0;
+
+    batchsize = ASYNC_BATCH_MAX + 1024;
+    batch = (char *)malloc(batchsize);
+    batchlen = 0;
+    since_fsync = 0;
+    last_when = 0;
+    timestr[0] = 0;
+}
+
+
+WvLogFileBase::AsyncWriter::~AsyncWriter()
+{
+    // after a fork, the thread only exists in the parent
+    if (owner == getpid())
+    {
+	pthread_mutex_lock(&lock);
+	__atomic_store_n(&stopping, true, __ATOMIC_RELEASE);
+	pthread_cond_signal(&work);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+    }
+
+    Record *rec;
+    while ((rec = pop()) != NULL)
+	free(rec);
+    deletev ring;
+    free(batch);
+    pthread_cond_destroy(&work);
+    pthread_cond_destroy(&progress);
+    pthread_mutex_destroy(&lock);
+}
+
+
+bool WvLogFileBase::AsyncWriter::start()
+{
+    return pthread_create(&thread, NULL, thread_main, this) == 0;
+}
+
+
+bool WvLogFileBase::AsyncWriter::push(time_t when, int level,
+				      WvStringParm source,
+				      const void *text, size_t textlen)
+{
+    size_t srclen = source.len();
+    Record *rec = (Record *)malloc(sizeof(Record) + srclen + textlen);
+    if (!rec)
+	return false;
+    rec->when = when;
+    rec->level = level;
+    rec->srclen = srclen;
+    rec->textlen = textlen;
+    memcpy((char *)rec->source(), source.cstr(), srclen);
+    memcpy((char *)rec->text(), text, textlen);
+
+    size_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    for (;;)
+    {
+	Slot &slot = ring[pos & mask];
+	size_t seq = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+	long diff = (long)seq - (long)pos;
+	if (diff == 0)
+	{
+	    if (__atomic_compare_exchange_n(&head, &pos, pos + 1, true,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+	    {
+		slot.rec = rec;
+		__atomic_store_n(&slot.seq, pos + 1, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&queued, 1, __ATOMIC_RELEASE);
+
+		// the writer sets 'sleeping' before it looks at the ring one
+		// last time, so either it saw this record or we see the flag
+		if (__atomic_load_n(&sleeping, __ATOMIC_SEQ_CST))
+		{
+		    pthread_mutex_lock(&lock);
+		    pthread_cond_signal(&work);
+		    pthread_mutex_unlock(&lock);
+		}
+		return true;
+	    }
+	    // someone else got it; pos has been updated for us
+	}
+	else if (diff < 0) // full
+	{
+	    if (overflow == AsyncDrop)
+	    {
+		free(rec);
+		__atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+		return false;
+	    }
+	    wait_progress(pos);
+	    pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	}
+	else
+	    pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    }
+}
+
+
+// Is there a record for pop()?
+bool WvLogFileBase::AsyncWriter::ready() const
+{
+    return __atomic_load_n(&ring[tail & mask].seq, __ATOMIC_SEQ_CST)
+	== tail + 1;
+}
+
+
+WvLogFileBase::AsyncWriter::Record *WvLogFileBase::AsyncWriter::pop()
+{
+    Slot &slot = ring[tail & mask];
+    size_t seq = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE);
+    if (seq != tail + 1)
+	return NULL;
+    Record *rec = slot.rec;
+    slot.rec = NULL;
+    __atomic_store_n(&slot.seq, tail + mask + 1, __ATOMIC_RELEASE);
+    tail++;
+    return rec;
+}
+
+
+/*
+ * Waits until the writer has written something: until the slot at 'pos'
+ * is free, or, if pos is (size_t)-1, until everything queued is written.
+ */
+void WvLogFileBase::AsyncWriter::wait_progress(size_t pos)
+{
+    pthread_mutex_lock(&lock);
+    __atomic_add_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+    for (;;)
+    {
+	bool more;
+	if (pos == (size_t)-1)
+	    more = __atomic_load_n(&written, __ATOMIC_SEQ_CST)
+		!= __atomic_load_n(&queued, __ATOMIC_SEQ_CST);
+	else
+	    more = (long)__atomic_load_n(&ring[pos & mask].seq,
+					 __ATOMIC_SEQ_CST) - (long)pos < 0;
+	if (!more)
+	    break;
+	pthread_cond_wait(&progress, &lock);
+    }
+    __atomic_sub_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&lock);
+}
+
+
+void WvLogFileBase::AsyncWriter::drain()
+{
+    wait_progress((size_t)-1);
+}
+
+
+void WvLogFileBase::AsyncWriter::append(const char *str, size_t len)
+{
+    if (batchlen + len > batchsize)
+    {
+	batchsize = batchlen + len + 1024;
+	batch = (char *)realloc(batch, batchsize);
+    }
+    memcpy(batch + batchlen, str, len);
+    batchlen += len;
+}
+
+
+void WvLogFileBase::AsyncWriter::format(const Record *rec)
+{
+    // lines tend to come in bunches, so the time rarely changes
+    if (rec->when != last_when || !timestr[0])
+    {
+	struct tm tmstamp;
+	localtime_r(&rec->when, &tmstamp);
+	strftime(timestr, sizeof(timestr), TIME_FORMAT, &tmstamp);
+	last_when = rec->when;
+    }
+    append(timestr, strlen(timestr));
+    append(": ", 2);
+    append(rec->source(), rec->srclen);
+    append("<", 1);
+    const char *lvl = WvLogRcv::loglevels[rec->level];
+    append(lvl, strlen(lvl));
+    append(">: ", 3);
+    append(rec->text(), rec->textlen);
+    append("\n", 1);
+}
+
+
+void WvLogFileBase::AsyncWriter::flush_batch()
+{
+    int fd = file.getwfd();
+    size_t done = 0;
+    while (done < batchlen && fd >= 0)
+    {
+	ssize_t len = ::write(fd, batch + done, batchlen - done);
+	if (len < 0 && errno == EINTR)
+	    continue;
+	if (len <= 0)
+	    break; // nowhere to complain to, so just lose it
+	done += len;
+    }
+    batchlen = 0;
+
+    if (file.fsync_every && since_fsync >= file.fsync_every && fd >= 0)
+    {
+	fsync(fd);
+	since_fsync = 0;
+    }
+}
+
+
+void WvLogFileBase::AsyncWriter::run()
+{
+    for (;;)
+    {
+	size_t count = 0;
+	Record *rec;
+	while (batchlen < ASYNC_BATCH_MAX && (rec = pop()) != NULL)
+	{
+	    format(rec);
+	    free(rec);
+	    count++;
+	}
+
+	size_t d = __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+	if (d != reported_dropped)
+	{
+	    char msg[100];
+	    int len = snprintf(msg, sizeof(msg),
+			       "%s: WvLog<%s>: %lu log lines dropped\n",
+			       timestr, WvLogRcv::loglevels[WvLog::Warning],
+			       (unsigned long)(d - reported_dropped));
+	    append(msg, len);
+	    reported_dropped = d;
+	}
+
+	if (batchlen)
+	{
+	    since_fsync += count;
+	    flush_batch();
+	    __atomic_add_fetch(&written, count, __ATOMIC_SEQ_CST);
+	    if (__atomic_load_n(&waiters, __ATOMIC_SEQ_CST))
+	    {
+		pthread_mutex_lock(&lock);
+		pthread_cond_broadcast(&progress);
+		pthread_mutex_unlock(&lock);
+	    }
+	    continue;
+	}
+
+	// nothing to do, so sleep until there is
+	pthread_mutex_lock(&lock);
+	__atomic_store_n(&sleeping, true, __ATOMIC_SEQ_CST);
+	while (!ready() && !__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+	    pthread_cond_wait(&work, &lock);
+	__atomic_store_n(&sleeping, false, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&lock);
+	if (!ready() && __atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+	    break;
+    }
+}
+
+#endif // !_WIN32
+
+
 //----------------------------------- WvLogFileBase ------------------
 
 WvLogFileBase::WvLogFileBase(WvStringParm _filename, WvLog::LogLevel _max_level)
@@ -39,6 +420,10 @@ WvLogFileBase::WvLogFileBase(WvStringParm _filename, WvLog::LogLevel _max_level)
       WvFile(_filename, O_WRONLY|O_APPEND|O_CREAT|O_LARGEFILE, 0644)
 {
     fsync_every = fsync_count = 0;
+    async = NULL;
+    async_time = 0;
+    timestr_time = 0;
+    timestr[0] = 0;
 }
 
 
@@ -46,17 +431,98 @@ WvLogFileBase::WvLogFileBase(WvLog::LogLevel _max_level)
     : WvLogRcv(_max_level) 
 { 
     fsync_every = fsync_count = 0;
+    async = NULL;
+    async_time = 0;
+    timestr_time = 0;
+    timestr[0] = 0;
+}
+
+
+WvLogFileBase::~WvLogFileBase()
+{
+#ifndef _WIN32
+    if (async)
+    {
+	end_line();
+	delete async; // writes out whatever is left
+	async = NULL;
+    }
+#endif
+}
+
+
+bool WvLogFileBase::set_async(size_t ring_size, AsyncOverflow overflow)
+{
+#ifndef _WIN32
+    if (async)
+	return true;
+    end_line();
+    WvFile::flush(1000);
+
+    async = new AsyncWriter(*this, ring_size, overflow);
+    if (!async->start())
+    {
+	delete async;
+	async = NULL;
+    }
+#endif
+    return async != NULL;
+}
+
+
+void WvLogFileBase::drain()
+{
+#ifndef _WIN32
+    if (async)
+	async->drain();
+#endif
+}
+
+
+size_t WvLogFileBase::async_dropped() const
+{
+#ifndef _WIN32
+    if (async)
+	return __atomic_load_n(&async->dropped, __ATOMIC_RELAXED);
+#endif
+    return 0;
+}
+
+
+void WvLogFileBase::_begin_line()
+{
+    if (async)
+	async_time = last_time;
+    else
+	WvLogRcv::_begin_line();
 }
 
 
 void WvLogFileBase::_mid_line(const char *str, size_t len)
 {
-    WvFile::write(str, len);
+    if (async)
+	async_line.put(str, len);
+    else
+	WvFile::write(str, len);
 }
 
 
 void WvLogFileBase::_end_line()
 {
+#ifndef _WIN32
+    if (async)
+    {
+	// end_line() adds a newline, which the writer puts back itself
+	size_t len = async_line.used();
+	const unsigned char *line = async_line.get(len);
+	if (len && line[len-1] == '\n')
+	    len--;
+	async->push(async_time, last_level, last_source, line, len);
+	async_line.zap();
+	return;
+    }
+#endif
+
     if (fsync_every)
     {
         fsync_count--;
@@ -70,21 +536,20 @@ void WvLogFileBase::_end_line()
     }
 }
 
-#ifdef _WIN32
-#define TIME_FORMAT "%b %d %H:%M:%S" // timezones in win32 look stupid
-#else
-#define TIME_FORMAT "%b %d %H:%M:%S %Z"
-#endif
-
 void WvLogFileBase::_make_prefix(time_t timenow)
 {
-    struct tm* tmstamp = localtime(&timenow);
-    char timestr[30];
-    strftime(&timestr[0], 30, TIME_FORMAT, tmstamp);
+    if (async)
+	return; // the writer thread does it
 
-    prefix = WvString("%s: %s<%s>: ", timestr, last_source,
-        loglevels[last_level]);
-    prelen = prefix.len();
+    // lots of lines get logged in the same second
+    if (timenow != timestr_time || !timestr[0])
+    {
+	struct tm* tmstamp = localtime(&timenow);
+	strftime(&timestr[0], sizeof(timestr), TIME_FORMAT, tmstamp);
+	timestr_time = timenow;
+    }
+
+    set_prefix(timestr);
 }
 
 //----------------------------------- WvLogFile ----------------------
@@ -94,6 +559,7 @@ WvLogFile::WvLogFile(WvStringParm _filename, WvLog::LogLevel _max_level,
     : WvLogFileBase(_max_level), keep_for(_keep_for), filename(_filename),
       allow_append(_allow_append)
 {
+    tzoffset = tzoffset_time = 0;
     WvLogRcv::force_new_line = _force_new_line;
     // start_log(); // don't open log until the first message gets printed
 }
@@ -111,7 +577,14 @@ void WvLogFile::_make_prefix(time_t timenow)
         statbuf.st_size = 0;
 
     // Make sure we are calculating last_day in the current time zone.
-    if (last_day != ((timenow + gmtoffset())/86400) 
+    // Working out the offset is slow, so only check once an hour whether
+    // it has changed (for daylight saving time).
+    if (timenow - tzoffset_time >= 3600 || timenow < tzoffset_time)
+    {
+	tzoffset = gmtoffset();
+	tzoffset_time = timenow;
+    }
+    if (last_day != ((timenow + tzoffset)/86400) 
 	|| statbuf.st_size > MAX_LOGFILE_SZ)
         start_log();
 
@@ -138,6 +611,8 @@ static void trim_old_logs(WvStringParm filename, WvStringParm base,
 
 WvString WvLogFile::start_log()
 {
+    // make sure the writer thread is done with the old file
+    drain();
     WvFile::close();
 
     int num = 0;
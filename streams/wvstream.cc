@@ -263,6 +263,8 @@ WvStream::WvStream():
     want_to_flush(true),
     is_flushing(false),
     queue_min(0),
+    getline_scanned(0),
+    getline_sep(-1),
     autoclose_time(0),
     alarm_time(wvtime_zero),
     last_alarm_check(wvtime_zero)
@@ -522,6 +524,7 @@ size_t WvStream::read(void *buf, size_t count)
 	    bufu = count;
     
 	memcpy(buf, inbuf.get(bufu), bufu);
+	getline_scanned = 0;
     }
     
     TRACE("read  obj 0x%08x, bytes %d/%d\n", (unsigned int)this, bufu, count);
@@ -614,6 +617,16 @@ char *WvStream::blocking_getline(time_t wait_msec, int separator,
     
     maybe_autoclose();
 
+    // Don't rescan the part of inbuf that we already looked at last time,
+    // so that a long line arriving in little pieces doesn't take
+    // quadratic time.
+    if (separator != getline_sep)
+    {
+	getline_sep = separator;
+	getline_scanned = 0;
+    }
+    size_t i = 0;
+
     // if we get here, we either want to wait a bit or there is data
     // available.
     while (isok())
@@ -622,9 +635,11 @@ char *WvStream::blocking_getline(time_t wait_msec, int separator,
         queuemin(0);
     
         // if there is a newline already, we have enough data.
-        if (inbuf.strchr(separator) > 0)
+        i = inbuf.strchr(separator, getline_scanned);
+        if (i > 0)
 	    break;
-	else if (!isok() || stop_read)    // uh oh, stream is in trouble.
+	getline_scanned = inbuf.used();
+	if (!isok() || stop_read)    // uh oh, stream is in trouble.
 	    break;
 
         // make select not return true until more data is available
@@ -651,13 +666,11 @@ char *WvStream::blocking_getline(time_t wait_msec, int separator,
 
         if (hasdata)
         {
-            // read a few bytes
-	    WvDynBuf tmp;
-            unsigned char *buf = tmp.alloc(readahead);
+            // read a few bytes, straight into inbuf
+            unsigned char *buf = inbuf.alloc(readahead);
 	    assert(buf);
             size_t len = uread(buf, readahead);
-            tmp.unalloc(readahead - len);
-	    inbuf.put(tmp.get(len), len);
+            inbuf.unalloc(readahead - len);
             hasdata = len > 0; // enough?
         }
 
@@ -671,8 +684,9 @@ char *WvStream::blocking_getline(time_t wait_msec, int separator,
 	return NULL;
 
     // return the appropriate data
-    size_t i = 0;
-    i = inbuf.strchr(separator);
+    if (!i)
+	i = inbuf.strchr(separator, getline_scanned);
+    getline_scanned = 0;
     if (i > 0) {
 	char *eol = (char *)inbuf.mutablepeek(i - 1, 1);
 	assert(eol && *eol == separator);
@@ -1198,6 +1212,7 @@ void WvStream::unread(WvBuf &unreadbuf, size_t count)
     tmp.merge(inbuf);
     inbuf.zap();
     inbuf.merge(tmp);
+    getline_scanned = 0;
 }
 
 
@@ -82,3 +82,72 @@ WVTEST_MAIN("cache basics")
     // should have incurred any slow operations at all.
     WVPASSEQ(slow->how_slow(), 0);
 }
+
+
+WVTEST_MAIN("lazy cache")
+{
+    UniTempGen *t = new UniTempGen;
+    t->set("a/1", "one");
+    t->set("a/2", "two");
+    t->set("b/1", "uno");
+    t->set("c/x/y", "why");
+    UniSlowGen *slow = new UniSlowGen(t);
+    UniCacheGen *c = new UniCacheGen(slow, true, 4);
+    c->refresh();
+    WVPASSEQ(slow->how_slow(), 1);
+    slow->reset_slow();
+
+    // only the branch we touch gets loaded, in one go
+    WVPASSEQ(c->get("a/1"), "one");
+    WVPASS(c->isresident("a"));
+    WVFAIL(c->isresident("b"));
+    WVFAIL(c->isresident(""));
+    WVPASSEQ(slow->how_slow(), 2); // get + recursiveiterator
+    slow->reset_slow();
+    WVPASSEQ(c->get("a/2"), "two");
+    WVFAIL(c->get("a/3"));
+    WVPASS(c->haschildren("a"));
+    WVPASSEQ(slow->how_slow(), 0);
+
+    // missing branches are remembered too
+    WVFAIL(c->get("zot/1"));
+    WVFAIL(c->get("zot/2"));
+    WVPASSEQ(slow->how_slow(), 1);
+    slow->reset_slow();
+
+    // the top level lists everything, resident or not
+    int count = 0;
+    UniConfGen::Iter *i = c->iterator("");
+    for (i->rewind(); i->next(); )
+        count++;
+    delete i;
+    WVPASSEQ(count, 3);
+    WVPASS(c->isresident(""));
+
+    // changes to non-resident branches still notify, and are seen later
+    t->set("b/2", "dos");
+    t->set("d/z", "zed");
+    WVPASS(c->haschildren(""));
+    WVPASSEQ(c->get("b/2"), "dos");
+    WVPASSEQ(c->get("d/z"), "zed");
+    slow->reset_slow();
+
+    // with a limit of 4 keys, loading 'c' pushes out the older branches
+    WVPASSEQ(c->get("c/x/y"), "why");
+    WVPASS(c->isresident("c"));
+    WVFAIL(c->isresident("a"));
+    WVFAIL(c->isresident("b"));
+    WVPASSEQ(slow->how_slow(), 2);
+    slow->reset_slow();
+    WVPASSEQ(c->get("a/2"), "two");
+    WVPASSEQ(slow->how_slow(), 2);
+
+    // deletions work whether or not the branch is loaded
+    t->set("a", WvString::null);
+    t->set("c", WvString::null);
+    WVFAIL(c->get("a/1"));
+    WVFAIL(c->get("c/x/y"));
+    WVFAIL(c->get("c"));
+
+    WVRELEASE(c);
+}
@@ -1,5 +1,7 @@
 #include "wvtest.h"
 #include "uniconfgen.h"
+#include "unitempgen.h"
+#include "wvstringlist.h"
 #include "wvmoniker.h"
 
 static void cb(const UniConfKey &, WvStringParm)
@@ -18,3 +20,65 @@ WVTEST_MAIN("null generator, setcallback, delete")
     }
     WVRELEASE(gen);
 }
+
+
+static void mirror_cb(UniTempGen *mirror, WvStringList *got,
+		      const UniConfKey &key, WvStringParm value)
+{
+    mirror->set(key, value);
+    got->append("%s=%s", key.printable(), value.isnull() ? "<null>" : value);
+}
+
+
+WVTEST_MAIN("held deltas keep parent deletions in order")
+{
+    UniTempGen gen, mirror;
+    WvStringList got;
+    gen.add_callback(&got, wv::bind(mirror_cb, &mirror, &got, _1, _2));
+
+    // the second change to a/b can't jump ahead of a's deletion, or the
+    // deletion wipes it out
+    gen.hold_delta();
+    gen.delta("a/b", "1");
+    gen.delta("a", WvString::null);
+    gen.delta("a", "");
+    gen.delta("a/b", "2");
+    gen.unhold_delta();
+    WVPASSEQ(got.join(" "), "a=<null> a= a/b=2");
+    WVPASSEQ(mirror.get("a/b"), "2");
+    got.zap();
+
+    // the same thing through set(), which also notifies about children
+    gen.hold_delta();
+    gen.set("a/b", "1");
+    gen.set("a", WvString::null);
+    gen.set("a", "");
+    gen.set("a/b", "2");
+    gen.unhold_delta();
+    WVPASSEQ(*got.last(), "a/b=2");
+    WVPASSEQ(mirror.get("a/b"), "2");
+    WVPASSEQ(gen.get("a/b"), "2");
+    got.zap();
+
+    // deleting something twice moves the deletion after its children's
+    // changes
+    gen.hold_delta();
+    gen.set("a", WvString::null);
+    gen.set("a/c", "3");
+    gen.set("a", WvString::null);
+    gen.unhold_delta();
+    WVPASSEQ(*got.last(), "a=<null>");
+    WVFAIL(mirror.exists("a/c"));
+    WVFAIL(gen.exists("a/c"));
+    got.zap();
+
+    // changes that don't conflict are still coalesced in place
+    gen.hold_delta();
+    gen.set("x", "1");
+    gen.set("y", "1");
+    gen.set("x", "2");
+    gen.unhold_delta();
+    WVPASSEQ(got.join(" "), "x=2 y=1");
+
+    gen.del_callback(&got);
+}
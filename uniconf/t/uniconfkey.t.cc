@@ -159,3 +159,31 @@ WVTEST_MAIN("range")
     WVPASSEQ(UniConfKey("fred/barney/betty").range(1,3).printable(), "barney/betty");
     WVPASSEQ(UniConfKey("fred/barney/betty").range(2,3).printable(), "betty");
 }
+WVTEST_MAIN("case insensitivity")
+{
+    // segments that differ only in case are equal, but keep their case
+    UniConfKey a("Foo/BAR/baz"), b("foo/bar/BAZ"), c("foo/bar/bat");
+    WVPASS(a == b);
+    WVFAIL(a != b);
+    WVPASS(a != c);
+    WVPASSEQ(a.compareto(b), 0);
+    WVPASS(a.compareto(c) > 0);
+    WVPASSEQ(WvHash(a), WvHash(b));
+    WVPASSEQ(a.printable(), "Foo/BAR/baz");
+    WVPASSEQ(b.printable(), "foo/bar/BAZ");
+    WVPASS(UniConfKey("FOO").suborsame(a));
+    WVPASSEQ(UniConfKey("FOO/bar").subkey(b).printable(), "BAZ");
+    WVFAIL(UniConfKey("FOO/bar/baz/x").suborsame(a));
+
+    // interning doesn't get confused by keys that come and go
+    {
+	UniConfKey tmp("Transient/KEY");
+	WVPASS(tmp == "transient/key");
+    }
+    UniConfKey again("transient/Key");
+    WVPASSEQ(again.printable(), "transient/Key");
+    WVPASS(again == "TRANSIENT/KEY");
+    WVPASS(UniConfKey("*").iswild());
+    WVPASS(UniConfKey("a/.../b").iswild());
+    WVFAIL(UniConfKey("a/b*").iswild());
+}
@@ -1,5 +1,6 @@
 #include "wvtest.h"
 #include "uniconfroot.h"
+#include "unitempgen.h"
 #include "wvstream.h"
 
 WVTEST_MAIN("no generator")
@@ -230,6 +231,63 @@ WVTEST_MAIN("sorted iterators")
     WVPASSEQ(i->fullkey(sub).printable(), "4");
 }
 
+
+static int reversecompare(const UniConf &a, const UniConf &b)
+{
+    // sort something else in the middle, to make sure that's allowed
+    UniConf::SortedIter i(a.parent(), &compare);
+    for (i.rewind(); i.next(); )
+        ;
+    return -compare(a, b);
+}
+
+WVTEST_MAIN("presorted iterators")
+{
+    UniTempGen *gen = new UniTempGen;
+    gen->set_sorted(true);
+    UniConfRoot root(gen);
+    UniConf cfg(root["x"]);
+    for (int n = 0; n < 50; n++)
+        cfg[(n * 37) % 50 + 100].setmeint(n);
+    
+    // the generator gives us the keys in order, so nothing needs sorting
+    UniConf::Iter j(cfg);
+    j.rewind();
+    WVPASS(j.sorted());
+    
+    UniConf::SortedIter i(cfg);
+    WvString prev;
+    int count = 0;
+    bool ok = true;
+    for (i.rewind(); i.next(); count++)
+    {
+        if (!!prev && prev.num() >= i->key().printable().num())
+            ok = false;
+        prev = i->key().printable();
+    }
+    WVPASS(ok);
+    WVPASSEQ(count, 50);
+    
+    // the order is still right after adding and removing keys
+    cfg["099"].setmeint(1);
+    cfg["120"].remove();
+    UniConf::SortedIter i2(cfg);
+    for (i2.rewind(), count = 0; i2.next(); count++)
+    {
+        if (count == 0)
+            WVPASSEQ(i2->key().printable(), "099");
+        WVFAIL(i2->key() == "120");
+    }
+    WVPASSEQ(count, 50);
+    
+    UniConf::SortedIter r(cfg, &reversecompare);
+    r.rewind();
+    WVPASS(r.next());
+    WVPASSEQ(r->key().printable(), "149");
+    WVPASS(r.next());
+    WVPASSEQ(r->key().printable(), "148");
+}
+
 WVTEST_MAIN("nested iterators")
 {
     UniConfRoot root("temp:");
@@ -341,3 +399,47 @@ WVTEST_MAIN("Recursive iteration with no generator at root")
     root2["subt/mayo"].setme("baz");
     verify_recursive_iter(root2);
 }
+
+
+static void record_cb(WvStringList *got, const UniConf &cfg,
+		      const UniConfKey &key)
+{
+    UniConf c(key.isempty() ? cfg : cfg[key]);
+    got->append("%s=%s", c.fullkey().printable(),
+		c.getme(WvString("<null>")));
+}
+
+WVTEST_MAIN("held notifications")
+{
+    UniConfRoot root("temp:");
+    WvStringList got, gotdeep;
+    root.add_callback(&got, "/", wv::bind(record_cb, &got, _1, _2));
+    root.add_callback(&gotdeep, "b/c/d",
+		      wv::bind(record_cb, &gotdeep, _1, _2), false);
+    
+    // redundant changes only get one notification each...
+    root.hold_delta();
+    root["a"].setme("1");
+    root["b/c/d"].setme("2");
+    root["a"].setme("3");
+    root["a"].setme("4");
+    root.unhold_delta();
+    WVPASSEQ(got.join(" "), "a=4 b= b/c= b/c/d=2");
+    WVPASSEQ(gotdeep.join(" "), "b/c/d=2");
+    got.zap();
+    gotdeep.zap();
+    
+    // ...but deleting and recreating a key notifies about both, since
+    // the deletion wiped out the key's children too
+    root.hold_delta();
+    root["b/c/d"].setme("5");
+    root["b"].setme(WvString::null);
+    root["b"].setme("6");
+    root.unhold_delta();
+    WVPASS(!gotdeep.isempty());
+    WVPASSEQ(*gotdeep.first(), "b/c/d=<null>");
+    WVPASSEQ(got.join(" "), "b/c/d=<null> b/c=<null> b=6 b=6");
+    
+    root.del_callback(&got, "/");
+    root.del_callback(&gotdeep, "b/c/d", false);
+}
@@ -47,3 +47,127 @@ WVTEST_MAIN("recursive compare")
     
     WVPASS(a.compare(&b, keyvalcomp));
 }
+
+
+WVTEST_MAIN("value tree sorted iter")
+{
+    UniConfValueTree t(NULL, "", "");
+    for (int i = 0; i < 100; i++)
+	new UniConfValueTree(&t, WvString("%s", (i * 37) % 100 + 1000), i);
+    
+    int count = 0, last = 0;
+    UniConfValueTree::SortedIter i(t);
+    for (i.rewind(); i.next(); count++)
+    {
+	int n = i->key().printable().num();
+	WVPASS(n > last);
+	last = n;
+    }
+    WVPASSEQ(count, 100);
+    
+    // the remembered order has to notice changes
+    t.remove(1000);
+    new UniConfValueTree(&t, "0999", "x");
+    UniConfValueTree::SortedIter i2(t);
+    i2.rewind();
+    WVPASS(i2.next());
+    WVPASSEQ(i2->key().printable(), "0999");
+    WVPASS(i2.next());
+    WVPASSEQ(i2->key().printable(), "1001");
+    
+    t.zap();
+    new UniConfValueTree(&t, "only", "x");
+    UniConfValueTree::SortedIter i3(t);
+    count = 0;
+    for (i3.rewind(); i3.next(); count++)
+	WVPASSEQ(i3->key().printable(), "only");
+    WVPASSEQ(count, 1);
+    WVFAIL(i3.next());
+}
+
+
+bool compactkeyvalcomp(const UniConfCompactValueTree *a,
+		       const UniConfCompactValueTree *b)
+{
+    return a && b && a->key() == b->key() && a->value() == b->value();
+}
+
+
+WVTEST_MAIN("compact tree basics")
+{
+    UniConfCompactValueTree t(NULL, "key", "value");
+    WVPASSEQ(t.key().printable(), "key");
+    WVPASSEQ(t.value(), "value");
+    WVFAIL(t.haschildren());
+    UniConfCompactValueTree *t2 = new UniConfCompactValueTree(&t, "key2",
+							      "value2");
+    WVPASS(t.haschildren());
+    WVFAIL(t2->haschildren());
+    new UniConfCompactValueTree(t2, "Sub", "value3");
+    
+    WVPASS(t.findchild("KEY2") == t2);
+    WVPASS(t.find("key2/sub") != NULL);
+    WVPASSEQ(t.find("key2/sub")->value(), "value3");
+    WVPASSEQ(t.find("key2/sub")->fullkey().printable(), "key2/Sub");
+    WVPASSEQ(t.find("key2/sub")->fullkey(t2).printable(), "Sub");
+    WVPASS(t.find("key2/nonexistent") == NULL);
+    
+    t.remove("key2");
+    WVFAIL(t.haschildren());
+    WVPASS(t.findchild("key2") == NULL);
+}
+
+
+WVTEST_MAIN("compact tree sorted children")
+{
+    UniConfCompactValueTree t(NULL, "", "");
+    
+    // enough children to need a hash index, in a scrambled order
+    for (int i = 0; i < 100; i++)
+	new UniConfCompactValueTree(&t, WvString("%s", (i * 37) % 100 + 1000),
+				    i);
+    
+    int count = 0, last = 0;
+    UniConfCompactValueTree::Iter i(t);
+    for (i.rewind(); i.next(); count++)
+    {
+	int n = i->key().printable().num();
+	WVPASS(n > last);
+	last = n;
+    }
+    WVPASSEQ(count, 100);
+    
+    for (int j = 0; j < 100; j++)
+	WVPASS(t.findchild(j + 1000) != NULL);
+    
+    // removing most of them drops the hash index again
+    for (int j = 0; j < 95; j++)
+	t.remove(j + 1000);
+    WVPASS(t.findchild(1097) != NULL);
+    WVPASS(t.findchild(1000) == NULL);
+    count = 0;
+    for (i.rewind(); i.next(); count++)
+	;
+    WVPASSEQ(count, 5);
+}
+
+
+WVTEST_MAIN("compact tree recursive compare")
+{
+    UniConfCompactValueTree a(NULL, "key", "value");
+    UniConfCompactValueTree b(NULL, "key", "value");
+    
+    WVPASS(a.compare(&b, compactkeyvalcomp));
+    WVFAIL(a.compare(NULL, compactkeyvalcomp));
+    
+    for (int i = 1; i <= 1000; i++)
+	new UniConfCompactValueTree(&a, i, i);
+    WVFAIL(a.compare(&b, compactkeyvalcomp));
+    for (int i = 1000; i >= 1; i--)
+	new UniConfCompactValueTree(&b, i, i);
+    
+    WVPASS(a.compare(&b, compactkeyvalcomp));
+    
+    b.findchild(500)->setvalue("changed");
+    WVFAIL(a.compare(&b, compactkeyvalcomp));
+}
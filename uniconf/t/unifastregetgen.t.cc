@@ -56,12 +56,69 @@ WVTEST_MAIN("fast-reget")
     WVPASSEQ(uni.xget("a/b/d"), nil);
     WVPASSEQ(slow->how_slow(), 0); slow->reset_slow();
     
-    // checking children of non-nil nodes takes time and is not cached
+    // checking children of non-nil nodes takes time, but only once
     WVPASSEQ(uni["a/b"].haschildren(), false);
     WVPASSEQ(uni["a/b"].haschildren(), false);
-    WVPASSEQ(slow->how_slow(), 2); slow->reset_slow();
+    WVPASSEQ(slow->how_slow(), 1); slow->reset_slow();
     
     // but checking children of nil nodes is trivial, so it's fast
     WVPASSEQ(uni["a/b/d"].haschildren(), false);
     WVPASSEQ(slow->how_slow(), 0); slow->reset_slow();
 }
+
+
+static int count_children(UniConf cfg)
+{
+    int count = 0;
+    UniConf::Iter i(cfg);
+    for (i.rewind(); i.next(); )
+        count++;
+    return count;
+}
+
+
+WVTEST_MAIN("fast-reget iteration")
+{
+    UniTempGen *t = new UniTempGen;
+    t->set("x/a", 1);
+    t->set("x/b", 2);
+    t->set("x/c/d", 3);
+    UniSlowGen *slow = new UniSlowGen(t);
+    UniConfRoot uni(new UniFastRegetGen(slow), true);
+    slow->reset_slow();
+    
+    // the first iteration goes to the inner generator...
+    WVPASSEQ(count_children(uni["x"]), 3);
+    WVPASS(slow->how_slow() > 0); slow->reset_slow();
+    
+    // ...but after that, iterating and looking at children is free
+    WVPASSEQ(count_children(uni["x"]), 3);
+    WVPASSEQ(uni.xgetint("x/b"), 2);
+    WVPASSEQ(uni.xget("x/nonexistent"), WvString());
+    WVPASS(uni["x"].haschildren());
+    WVPASS(uni["x"].exists());
+    WVPASS(uni["x/a"].exists());
+    WVFAIL(uni["x/z"].exists());
+    WVPASSEQ(slow->how_slow(), 0); slow->reset_slow();
+    
+    // notifications keep the cached list up to date
+    t->set("x/e", 5);
+    t->set("x/a", WvString::null);
+    WVPASSEQ(count_children(uni["x"]), 3);
+    WVPASSEQ(uni.xgetint("x/e"), 5);
+    WVFAIL(uni["x/a"].exists());
+    WVPASSEQ(slow->how_slow(), 0); slow->reset_slow();
+    
+    t->set("x/b", WvString::null);
+    t->set("x/c", WvString::null);
+    t->set("x/e", WvString::null);
+    WVPASSEQ(count_children(uni["x"]), 0);
+    WVFAIL(uni["x"].haschildren());
+    WVPASSEQ(slow->how_slow(), 0); slow->reset_slow();
+    
+    // new keys under a node with a complete child list show up too
+    t->set("x/f/g", 6);
+    WVPASS(uni["x"].haschildren());
+    WVPASSEQ(uni.xgetint("x/f/g"), 6);
+    WVPASSEQ(count_children(uni["x"]), 1);
+}
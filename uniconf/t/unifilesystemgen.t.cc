@@ -0,0 +1,104 @@
+#include "wvtest.h"
+#include "unifilesystemgen.h"
+#include "wvfileutils.h"
+#include "wvstrutils.h"
+#include <unistd.h>
+#include <stdio.h>
+
+WVTEST_MAIN("filesystem get and set")
+{
+    WvString dir("/tmp/unifsgen-%s", getpid());
+    rm_rf(dir);
+    UniFileSystemGen *gen = new UniFileSystemGen(dir, 0700);
+    
+    WVPASS(gen->get("foo").isnull());
+    gen->set("foo", "bar");
+    WVPASSEQ(gen->get("foo"), "bar");
+    gen->set("a/b/c", "deep");
+    WVPASSEQ(gen->get("a/b/c"), "deep");
+    WVPASSEQ(gen->get("a/b"), "");
+    WVPASSEQ(gen->get("/"), "");
+    WVPASS(gen->get("a/../foo").isnull());
+    
+    // bigger than any buffer we might use
+    WvString big(WvString("0123456789abcdef").cstr());
+    for (int i = 0; i < 12; i++)
+	big = WvString("%s%s", big, big);
+    gen->set("big", big);
+    WVPASSEQ(gen->get("big").len(), big.len());
+    WVPASSEQ(gen->get("big"), big);
+    
+    gen->set("a", WvString::null);
+    WVPASS(gen->get("a/b/c").isnull());
+    WVPASS(gen->get("a").isnull());
+    
+    WVRELEASE(gen);
+    rm_rf(dir);
+}
+
+
+WVTEST_MAIN("filesystem setv")
+{
+    WvString dir("/tmp/unifsgen-%s", getpid());
+    rm_rf(dir);
+    UniFileSystemGen *gen = new UniFileSystemGen(dir, 0700);
+    
+    UniConfPairList pairs;
+    pairs.append(new UniConfPair("x/1", "one"), true);
+    pairs.append(new UniConfPair("x/2", "two"), true);
+    pairs.append(new UniConfPair("y/z/3", "three"), true);
+    pairs.append(new UniConfPair("x/2", WvString::null), true);
+    pairs.append(new UniConfPair("x/4", "four"), true);
+    pairs.append(new UniConfPair("../evil", "nope"), true);
+    pairs.append(new UniConfPair("Q/x", "upper"), true);
+    pairs.append(new UniConfPair("q/y", "lower"), true);
+    gen->setv(pairs);
+    
+    WVPASSEQ(gen->get("x/1"), "one");
+    WVPASS(gen->get("x/2").isnull());
+    WVPASSEQ(gen->get("y/z/3"), "three");
+    WVPASSEQ(gen->get("x/4"), "four");
+    WVFAIL(access(WvString("%s/../evil", dir), F_OK) == 0);
+    WVPASSEQ(gen->get("Q/x"), "upper");
+    WVPASSEQ(gen->get("q/y"), "lower");
+    WVPASS(gen->get("Q/y").isnull());
+    
+    WVRELEASE(gen);
+    rm_rf(dir);
+}
+
+
+WVTEST_MAIN("filesystem root removed or replaced")
+{
+    WvString dir("/tmp/unifsgen-%s", getpid());
+    rm_rf(dir);
+    UniFileSystemGen *gen = new UniFileSystemGen(dir, 0700);
+    
+    gen->set("a", "1");
+    WVPASSEQ(gen->get("a"), "1");
+    gen->set(UniConfKey::EMPTY, WvString::null);
+    WVPASS(gen->get("a").isnull());
+    gen->set("b", "2");
+    WVPASSEQ(gen->get("b"), "2");
+    WVPASS(gen->get("a").isnull());
+    
+    // someone else swaps the directory out from under us
+    WvString old("%s.old", dir);
+    rm_rf(old);
+    WVPASS(rename(dir, old) == 0);
+    WVPASS(gen->get("b").isnull());
+    gen->set("c", "3");
+    WVPASSEQ(gen->get("c"), "3");
+    WVFAIL(access(WvString("%s/c", old), F_OK) == 0);
+    
+    UniConfPairList pairs;
+    pairs.append(new UniConfPair("/", WvString::null), true);
+    pairs.append(new UniConfPair("d", "4"), true);
+    gen->setv(pairs);
+    WVPASS(gen->get("c").isnull());
+    WVPASSEQ(gen->get("d"), "4");
+    
+    WVRELEASE(gen);
+    rm_rf(dir);
+    rm_rf(old);
+}
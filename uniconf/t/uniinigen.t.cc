@@ -329,3 +329,92 @@ WVTEST_MAIN("do not refresh if not requested")
     ::unlink(ininame);
 }
 
+
+
+WVTEST_MAIN("journaled commits")
+{
+    WvString ininame = inigen("[foo]\n"
+			      "bar = baz\n"
+			      "gone = soon\n");
+    WvString journalname("%s.journal", ininame);
+    ::unlink(journalname);
+    
+    UniIniGen *gen = new UniIniGen(ininame);
+    gen->set_journal(4096);
+    UniConfRoot cfg(gen);
+    
+    ino_t inode1 = inode_of(ininame);
+    off_t size1 = size_of(ininame);
+    cfg["foo/bar"].setme("new value\nwith a newline");
+    cfg["foo/gone"].setme(WvString::null);
+    cfg["x/y"].setme("");
+    cfg.commit();
+    
+    // the .ini file was left alone, and the changes went to the journal
+    WVPASSEQ(inode_of(ininame), inode1);
+    WVPASSEQ(size_of(ininame), size1);
+    WVPASS(size_of(journalname) > 0);
+    
+    // committing without changes doesn't touch anything
+    off_t jsize1 = size_of(journalname);
+    cfg["foo/bar"].setme("new value\nwith a newline");
+    cfg.commit();
+    WVPASSEQ(size_of(journalname), jsize1);
+    
+    // a reader that doesn't journal still sees the changes
+    {
+	UniConfRoot cfg2(WvString("ini:%s", ininame));
+	WVPASSEQ(cfg2["foo/bar"].getme(), "new value\nwith a newline");
+	WVFAIL(cfg2["foo/gone"].exists());
+	WVPASSEQ(cfg2["x/y"].getme(), "");
+    }
+    
+    // a half-written record at the end of the journal is ignored
+    {
+	WvFile f(journalname, O_WRONLY|O_APPEND);
+	f.print("foo/bar {trunc");
+    }
+    {
+	UniConfRoot cfg2(WvString("ini:%s", ininame));
+	WVPASSEQ(cfg2["foo/bar"].getme(), "new value\nwith a newline");
+    }
+    
+    // ...and the next append doesn't get glued onto it
+    off_t jsize2 = size_of(journalname);
+    cfg["foo/after"].setme("torn");
+    cfg.commit();
+    WVPASS(size_of(journalname) < jsize2 + 20);
+    {
+	UniConfRoot cfg2(WvString("ini:%s", ininame));
+	WVPASSEQ(cfg2["foo/after"].getme(), "torn");
+	WVPASSEQ(cfg2["foo/bar"].getme(), "new value\nwith a newline");
+	WVPASSEQ(cfg2["x/y"].getme(), "");
+    }
+    
+    // compacting folds the journal back into the .ini file
+    gen->compact();
+    WVFAILEQ(inode_of(ininame), inode1);
+    WVPASSEQ(size_of(journalname), 0);
+    {
+	UniConfRoot cfg2(WvString("ini:%s", ininame));
+	WVPASSEQ(cfg2["foo/bar"].getme(), "new value\nwith a newline");
+	WVFAIL(cfg2["foo/gone"].exists());
+    }
+    
+    // a journal that grows too big gets compacted on commit
+    gen->set_journal(64);
+    cfg.refresh();
+    for (int i = 0; i < 4; i++)
+    {
+	cfg.xset(WvString("big/%s", i), "0123456789012345678901234567890");
+	cfg.commit();
+    }
+    WVPASSEQ(size_of(journalname), 0);
+    {
+	UniConfRoot cfg2(WvString("ini:%s", ininame));
+	WVPASSEQ(cfg2["big/3"].getme(), "0123456789012345678901234567890");
+    }
+    
+    ::unlink(ininame);
+    ::unlink(journalname);
+}
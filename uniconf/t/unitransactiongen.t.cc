@@ -811,3 +811,35 @@ WVTEST_MAIN("processing many keys")
     cfg.del_callback(NULL, "/");
 }
 #endif // BUGZID: 14057
+
+
+static void check_complete(IUniConfGen *base, int *calls, int *incomplete,
+			   const UniConfKey &key, WvStringParm value)
+{
+    (*calls)++;
+    if (base->get("k99") != "99")
+	(*incomplete)++;
+}
+
+WVTEST_MAIN("commit is a single batch")
+{
+    UniTempGen *base = new UniTempGen();
+    UniTransactionGen *gen = new UniTransactionGen(base);
+    int calls = 0, incomplete = 0;
+    base->add_callback(&calls, wv::bind(check_complete, base, &calls,
+					&incomplete, _1, _2));
+    
+    for (int i = 0; i < 100; i++)
+	gen->set(WvString("k%s", i), i);
+    WVPASSEQ(calls, 0);
+    
+    // the underlying generator only tells anyone about the changes once
+    // they've all been made
+    gen->commit();
+    WVPASS(calls >= 100);
+    WVPASSEQ(incomplete, 0);
+    WVPASSEQ(base->get("k42"), "42");
+    
+    base->del_callback(&calls);
+    WVRELEASE(gen);
+}
@@ -1,4 +1,5 @@
 #include "uniconfroot.h"
+#include "uniconftree.h"
 #include <unistd.h>
 
 class Report
@@ -26,13 +27,30 @@ public:
     }
 };
 
-int main()
+// Builds a tree shaped like a big uniconfd config: lots of sections with a
+// handful of similarly-named keys in each.
+template<class Tree>
+static void filltree(Tree &root, int sections, int keys)
 {
-    printf("uniconfvaluetree: %d bytes\n", sizeof(UniConfValueTree));
-    printf("wvstring: %d bytes\n", sizeof(WvString));
+    WvString s("this is a value");
+    for (int i = 0; i < sections; i++)
+    {
+	Tree *sect = new Tree(&root, WvString("section%s", i), WvString::empty);
+	for (int j = 0; j < keys; j++)
+	    new Tree(sect, WvString("key%s", j), s);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    printf("uniconfvaluetree: %d bytes\n", (int)sizeof(UniConfValueTree));
+    printf("uniconfcompactvaluetree: %d bytes\n",
+	   (int)sizeof(UniConfCompactValueTree));
+    printf("wvstring: %d bytes\n", (int)sizeof(WvString));
     Report r;
 
-    int mode = 2;
+    int mode = argc > 1 ? atoi(argv[1]) : 2;
     switch (mode)
     {
     case -1:
@@ -89,6 +107,24 @@ int main()
 	    }
 	    r.go();
 	}
+	break;
+    case 3:
+	{
+	    // 500k keys in a plain UniConfValueTree
+	    UniConfValueTree root(NULL, UniConfKey::EMPTY, WvString::empty);
+	    filltree(root, 50000, 10);
+	    r.go();
+	}
+	break;
+    case 4:
+	{
+	    // the same 500k keys in a UniConfCompactValueTree
+	    UniConfCompactValueTree root(NULL, UniConfKey::EMPTY,
+					 WvString::empty);
+	    filltree(root, 50000, 10);
+	    r.go();
+	}
+	break;
     }
 
     r.go();
@@ -19,13 +19,21 @@ static IUniConfGen *creator(WvStringParm s, IObject *_obj)
     return new UniCacheGen(wvcreate<IUniConfGen>(s, _obj));
 }
 
+static IUniConfGen *lazycreator(WvStringParm s, IObject *_obj)
+{
+    return new UniCacheGen(wvcreate<IUniConfGen>(s, _obj), true);
+}
+
 static WvMoniker<IUniConfGen> reg("cache", creator);
+static WvMoniker<IUniConfGen> lazyreg("lazycache", lazycreator);
 
 
 /***** UniCacheGen *****/
 
-UniCacheGen::UniCacheGen(IUniConfGen *_inner)
-    : log("UniCache", WvLog::Debug1), inner(_inner)
+UniCacheGen::UniCacheGen(IUniConfGen *_inner, bool _lazy, size_t _max_keys)
+    : log("UniCache", WvLog::Debug1), inner(_inner),
+      lazy(_lazy), max_keys(_max_keys), root_loaded(false),
+      branches(16), resident_keys(0), usecount(0)
 {
     if (inner)
         inner->add_callback(this, wv::bind(&UniCacheGen::deltacallback, this,
@@ -52,7 +60,8 @@ bool UniCacheGen::refresh()
     if (!refreshed_once)
     {
 	bool ret = inner->refresh();
-	loadtree();
+	if (!lazy)
+	    loadtree();
 	refreshed_once = true;
 	return ret;
     }
@@ -90,9 +99,192 @@ void UniCacheGen::loadtree(const UniConfKey &key)
 
 void UniCacheGen::deltacallback(const UniConfKey &key, WvStringParm value)
 {
-    UniTempGen::set(key, value);
+    if (!lazy)
+    {
+        UniTempGen::set(key, value);
+        return;
+    }
+
+    if (key.isempty())
+    {
+        if (value.isnull())
+        {
+            // everything is gone, so there's nothing left to be lazy about
+            branches.zap();
+            resident_keys = 0;
+            root_loaded = false;
+        }
+        UniTempGen::set(key, value);
+        return;
+    }
+
+    if (branches[key.first()])
+        UniTempGen::set(key, value);
+    else if (root_loaded && key.numsegments() == 1)
+        UniTempGen::set(key, value); // keep the list of top-level keys right
+    else
+    {
+        // not in memory: just make sure the branch shows up in the list of
+        // top-level keys, and pass the notification on.
+        if (root_loaded && !value.isnull()
+            && !(root && root->findchild(key.first())))
+            store(key.first(), WvString::empty);
+        delta(key, value);
+    }
+}
+
+
+void UniCacheGen::store(const UniConfKey &key, WvStringParm value)
+{
+    // like UniTempGen::set(), but without any notifications, since the
+    // inner generator already sent (or will send) them.
+    if (!root)
+        root = new UniConfValueTree(NULL, UniConfKey::EMPTY, WvString::empty);
+
+    UniConfValueTree *node = root;
+    UniConfKey::Iter it(key);
+    for (it.rewind(); it.next(); )
+    {
+        UniConfValueTree *child = node->findchild(*it);
+        if (!child)
+            child = new UniConfValueTree(node, *it, WvString::empty);
+        node = child;
+    }
+    node->setvalue(value);
 }
 
+
+void UniCacheGen::load_root()
+{
+    if (root_loaded)
+        return;
+    root_loaded = true;
+
+    WvString value(inner->get(UniConfKey::EMPTY));
+    if (value.isnull())
+        return;
+    if (!root)
+        store(UniConfKey::EMPTY, value);
+
+    UniConfGen::Iter *i = inner->iterator(UniConfKey::EMPTY);
+    if (!i) return;
+
+    for (i->rewind(); i->next(); )
+    {
+        // resident branches are already up to date
+        if (root->findchild(i->key()))
+            continue;
+
+        WvString value(i->value());
+        if (!value.isnull())
+            store(i->key(), value);
+    }
+
+    delete i;
+}
+
+
+size_t UniCacheGen::load_branch(const UniConfKey &branch)
+{
+    WvString value(inner->get(branch));
+    if (value.isnull())
+    {
+        UniConfValueTree *node = root ? root->findchild(branch) : NULL;
+        if (node)
+            delete node;
+        return 0;
+    }
+
+    size_t numkeys = 1;
+    store(branch, value);
+
+    UniConfGen::Iter *i = inner->recursiveiterator(branch);
+    if (!i) return numkeys;
+
+    for (i->rewind(); i->next(); )
+    {
+        WvString value(i->value());
+        if (!value.isnull())
+        {
+            store(UniConfKey(branch, i->key()), value);
+            numkeys++;
+        }
+    }
+
+    delete i;
+    return numkeys;
+}
+
+
+void UniCacheGen::fault_in(const UniConfKey &key)
+{
+    if (key.isempty())
+    {
+        load_root();
+        return;
+    }
+
+    UniConfKey first(key.first());
+    Branch *b = branches[first];
+    if (!b)
+    {
+        log("Loading '%s'.\n", first);
+        // a missing branch still counts as one key, so that looking up
+        // lots of nonexistent keys can't grow the cache forever.
+        size_t numkeys = load_branch(first);
+        if (!numkeys)
+            numkeys = 1;
+        b = new Branch(first, numkeys);
+        branches.add(b, true);
+        resident_keys += numkeys;
+    }
+    b->lastused = ++usecount;
+
+    evict();
+}
+
+
+void UniCacheGen::evict()
+{
+    // never evicts the most recently used branch, so whatever fault_in()
+    // just loaded stays put.
+    while (max_keys && resident_keys > max_keys && branches.count() > 1)
+    {
+        Branch *oldest = NULL;
+        BranchDict::Iter i(branches);
+        for (i.rewind(); i.next(); )
+            if (!oldest || i->lastused < oldest->lastused)
+                oldest = i.ptr();
+
+        log("Dropping '%s' (%s keys).\n", oldest->key, oldest->numkeys);
+
+        // keep the branch node itself, so the list of top-level keys
+        // stays complete; it gets refreshed when the branch is reloaded.
+        UniConfValueTree *node = root ? root->findchild(oldest->key) : NULL;
+        if (node)
+        {
+            if (root_loaded)
+                node->zap();
+            else
+                delete node;
+        }
+
+        resident_keys -= oldest->numkeys;
+        branches.remove(oldest);
+    }
+}
+
+
+bool UniCacheGen::isresident(const UniConfKey &key)
+{
+    if (!lazy)
+        return true;
+    if (key.isempty())
+        return root_loaded;
+    return branches[key.first()] != NULL;
+}
+
+
 void UniCacheGen::set(const UniConfKey &key, WvStringParm value)
 {
     inner->set(key, value);
@@ -102,5 +294,29 @@ WvString UniCacheGen::get(const UniConfKey &key)
 {
     //inner->get(key);
     inner->flush_buffers(); // update all pending notifications
+    if (lazy)
+        fault_in(key);
     return UniTempGen::get(key);
 }
+
+
+bool UniCacheGen::haschildren(const UniConfKey &key)
+{
+    if (lazy)
+    {
+        inner->flush_buffers();
+        fault_in(key);
+    }
+    return UniTempGen::haschildren(key);
+}
+
+
+UniConfGen::Iter *UniCacheGen::iterator(const UniConfKey &key)
+{
+    if (lazy)
+    {
+        inner->flush_buffers();
+        fault_in(key);
+    }
+    return UniTempGen::iterator(key);
+}
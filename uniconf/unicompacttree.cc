@@ -0,0 +1,429 @@
+/*
+ * Worldvisions Weaver Software:
+ *   Copyright (C) 1997-2002 Net Integration Technologies, Inc.
+ *
+ * UniConf low-level tree storage abstraction, optimized for size.
+ */
+#include "unicompacttree.h"
+#include "assert.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+/***** Node allocation *****/
+
+// Nodes are carved out of big blocks, and freed nodes are kept on a free
+// list (one per node size) for reuse.  The blocks themselves are never
+// returned to the system, but nodes are all the same few sizes, so they
+// get reused nicely.
+#define ARENA_BLOCK_SIZE 65536
+#define ARENA_MAX_NODE 256
+#define ARENA_ALIGN sizeof(void *)
+
+struct ArenaFree
+{
+    ArenaFree *next;
+};
+
+static ArenaFree *arena_free[ARENA_MAX_NODE / ARENA_ALIGN + 1];
+static ArenaFree *arena_blocks; // so that the blocks are still reachable
+static char *arena_next, *arena_end;
+
+
+void *UniCompactTreeBase::operator new(size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (size > ARENA_MAX_NODE)
+	return ::operator new(size);
+
+    ArenaFree *&list = arena_free[size / ARENA_ALIGN];
+    if (list)
+    {
+	ArenaFree *node = list;
+	list = node->next;
+	return node;
+    }
+
+    if (arena_next + size > arena_end)
+    {
+	ArenaFree *block = (ArenaFree *)malloc(ARENA_BLOCK_SIZE);
+	if (!block)
+	    return ::operator new(size); // let it throw
+	block->next = arena_blocks;
+	arena_blocks = block;
+	arena_next = (char *)block + ARENA_ALIGN;
+	arena_end = (char *)block + ARENA_BLOCK_SIZE;
+    }
+
+    void *node = arena_next;
+    arena_next += size;
+    return node;
+}
+
+
+void UniCompactTreeBase::operator delete(void *p, size_t size)
+{
+    if (!p)
+	return;
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (size > ARENA_MAX_NODE)
+    {
+	::operator delete(p);
+	return;
+    }
+
+    ArenaFree *&list = arena_free[size / ARENA_ALIGN];
+    ArenaFree *node = (ArenaFree *)p;
+    node->next = list;
+    list = node;
+}
+
+
+/***** Key interning *****/
+
+UniCompactTreeBase::NameTable *UniCompactTreeBase::names;
+
+
+UniCompactTreeBase::Name *UniCompactTreeBase::intern(const UniConfKey &key)
+{
+    if (!names)
+	names = new NameTable;
+
+    WvString str(key.printable());
+    Name *name = (*names)[str];
+    if (!name)
+    {
+	name = new Name(str);
+	names->add(name, false);
+    }
+    name->refs++;
+    return name;
+}
+
+
+void UniCompactTreeBase::release(Name *name)
+{
+    if (--name->refs)
+	return;
+
+    names->remove(name);
+    delete name;
+    if (names->isempty())
+    {
+	delete names;
+	names = NULL;
+    }
+}
+
+
+/***** UniCompactTreeBase *****/
+
+UniCompactTreeBase::UniCompactTreeBase(UniCompactTreeBase *parent,
+    const UniConfKey &key) :
+    xname(intern(key))
+{
+    xparent = parent;
+    xchildren = NULL;
+
+    if (xparent)
+        xparent->link(this);
+}
+
+
+UniCompactTreeBase::~UniCompactTreeBase()
+{
+    if (xchildren)
+    {
+        Container *oldchildren = xchildren;
+        xchildren = NULL;
+
+        delete oldchildren;
+    }
+
+    // This happens only after the children are deleted by our
+    // subclass.  This ensures that we do not confuse them
+    // about their parentage as their destructors are invoked
+    if (xparent)
+        xparent->unlink(this);
+
+    release(xname);
+}
+
+
+void UniCompactTreeBase::_setparent(UniCompactTreeBase *parent)
+{
+    if (xparent == parent)
+        return;
+    if (xparent)
+        xparent->unlink(this);
+    xparent = parent;
+    if (xparent)
+        xparent->link(this);
+}
+
+
+UniCompactTreeBase *UniCompactTreeBase::_root() const
+{
+    const UniCompactTreeBase *node = this;
+    while (node->xparent)
+        node = node->xparent;
+    return const_cast<UniCompactTreeBase*>(node);
+}
+
+
+UniConfKey UniCompactTreeBase::_fullkey(
+    const UniCompactTreeBase *ancestor) const
+{
+    UniConfKey result;
+    const UniCompactTreeBase *node = this;
+    while (node != ancestor && node->xparent)
+    {
+	result.prepend(node->key());
+	node = node->xparent;
+    }
+    assert(!ancestor || node == ancestor
+	   || ! "ancestor was not a node in the tree");
+    return result;
+}
+
+
+UniCompactTreeBase *UniCompactTreeBase::_find(const UniConfKey &key) const
+{
+    const UniCompactTreeBase *node = this;
+    UniConfKey::Iter it(key);
+    it.rewind();
+    while (it.next())
+    {
+        node = node->_findchild(it());
+        if (!node)
+            break;
+    }
+    return const_cast<UniCompactTreeBase*>(node);
+}
+
+
+UniCompactTreeBase *UniCompactTreeBase::_findchild(
+    const UniConfKey &key) const
+{
+    if (key.isempty())
+        return const_cast<UniCompactTreeBase*>(this);
+
+    return xchildren ? (*xchildren)[key] : NULL;
+}
+
+
+bool UniCompactTreeBase::haschildren() const
+{
+    return xchildren && !xchildren->isempty();
+}
+
+
+void UniCompactTreeBase::link(UniCompactTreeBase *node)
+{
+    if (!xchildren)
+        xchildren = new Container();
+
+    xchildren->add(node);
+}
+
+
+void UniCompactTreeBase::unlink(UniCompactTreeBase *node)
+{
+    if (!xchildren)
+        return;
+
+    xchildren->remove(node);
+    if (xchildren->count() == 0)
+    {
+        delete xchildren;
+	xchildren = NULL;
+    }
+}
+
+
+void UniCompactTreeBase::_recursive_unsorted_visit(
+    const UniCompactTreeBase *a,
+    const UniCompactTreeBaseVisitor &visitor, void *userdata,
+    bool preorder, bool postorder)
+{
+    if (preorder)
+	visitor(a, userdata);
+    Container::Iter i(a->xchildren);
+    for (i.rewind(); i.next();)
+        _recursive_unsorted_visit(i.ptr(), visitor, userdata,
+            preorder, postorder);
+    if (postorder)
+        visitor(a, userdata);
+}
+
+
+bool UniCompactTreeBase::_recursivecompare(
+    const UniCompactTreeBase *a, const UniCompactTreeBase *b,
+    const UniCompactTreeBaseComparator &comparator)
+{
+    bool equal = true;
+
+    // see UniHashTreeBase::_recursivecompare() for why we don't
+    // short-circuit here.
+    if (!comparator(a, b))
+        equal = false;
+
+    // the children are already sorted, so just walk them side by side
+    Container::Iter ait(a ? a->xchildren : NULL);
+    Container::Iter bit(b ? b->xchildren : NULL);
+    ait.rewind();
+    bit.rewind();
+    a = ait.next() ? ait.ptr() : NULL;
+    b = bit.next() ? bit.ptr() : NULL;
+
+    // compare each key
+    while (a != NULL && b != NULL)
+    {
+        int order = a->key().compareto(b->key());
+        if (order < 0)
+        {
+	    equal = false;
+	    _recursivecompare(a, NULL, comparator);
+            a = ait.next() ? ait.ptr() : NULL;
+        }
+        else if (order > 0)
+        {
+	    equal = false;
+            _recursivecompare(NULL, b, comparator);
+            b = bit.next() ? bit.ptr() : NULL;
+        }
+        else // keys are equal
+        {
+	    if (!_recursivecompare(a, b, comparator))
+		equal = false;
+            a = ait.next() ? ait.ptr() : NULL;
+            b = bit.next() ? bit.ptr() : NULL;
+        }
+    }
+
+    // finish up if one side is bigger than the other
+    while (a != NULL)
+    {
+	equal = false;
+        _recursivecompare(a, NULL, comparator);
+        a = ait.next() ? ait.ptr() : NULL;
+    }
+    while (b != NULL)
+    {
+	equal = false;
+        _recursivecompare(NULL, b, comparator);
+        b = bit.next() ? bit.ptr() : NULL;
+    }
+
+    return equal;
+}
+
+
+/***** UniCompactTreeBase::Container *****/
+
+UniCompactTreeBase::Container::Container() :
+    vec(NULL), used(0), size(0), index(NULL)
+{
+}
+
+
+UniCompactTreeBase::Container::~Container()
+{
+    deletev vec;
+    delete index;
+}
+
+
+unsigned int UniCompactTreeBase::Container::search(const UniConfKey &key,
+						   bool &found) const
+{
+    unsigned int lo = 0, hi = used;
+    while (lo < hi)
+    {
+	unsigned int mid = (lo + hi) / 2;
+	int order = vec[mid]->key().compareto(key);
+	if (order < 0)
+	    lo = mid + 1;
+	else if (order > 0)
+	    hi = mid;
+	else
+	{
+	    found = true;
+	    return mid;
+	}
+    }
+    found = false;
+    return lo;
+}
+
+
+UniCompactTreeBase *UniCompactTreeBase::Container::operator[] (
+    const UniConfKey &key) const
+{
+    if (index)
+	return (*index)[key];
+
+    bool found;
+    unsigned int i = search(key, found);
+    return found ? vec[i] : NULL;
+}
+
+
+void UniCompactTreeBase::Container::add(UniCompactTreeBase *node)
+{
+    if (used == size)
+    {
+	size = size ? size * 2 : 2;
+	UniCompactTreeBase **newvec = new UniCompactTreeBase*[size];
+	if (used)
+	    memcpy(newvec, vec, used * sizeof(*vec));
+	deletev vec;
+	vec = newvec;
+    }
+
+    bool found;
+    unsigned int i = search(node->key(), found);
+    memmove(vec + i + 1, vec + i, (used - i) * sizeof(*vec));
+    vec[i] = node;
+    used++;
+
+    if (index)
+	index->add(node);
+    else if (used > HASH_THRESHOLD)
+    {
+	index = new Index(used * 2);
+	for (unsigned int j = 0; j < used; j++)
+	    index->add(vec[j]);
+    }
+}
+
+
+void UniCompactTreeBase::Container::remove(UniCompactTreeBase *node)
+{
+    bool found;
+    unsigned int i = search(node->key(), found);
+    if (!found)
+	return;
+
+    // there might be more than one node with the same key
+    while (i > 0 && vec[i-1]->key() == node->key())
+	i--;
+    while (i < used && vec[i] != node)
+	i++;
+    if (i == used)
+	return;
+
+    used--;
+    memmove(vec + i, vec + i + 1, (used - i) * sizeof(*vec));
+
+    if (index)
+    {
+	index->remove(node);
+	if (used <= HASH_THRESHOLD / 2)
+	{
+	    delete index;
+	    index = NULL;
+	}
+    }
+}
@@ -410,7 +410,8 @@ bool UniConf::XIter::next()
 
 UniConf::SortedIterBase::SortedIterBase(const UniConf &root,
     UniConf::SortedIterBase::Comparator comparator) 
-    : IterBase(root), xcomparator(comparator), xkeys()
+    : IterBase(root), xcomparator(comparator), index(0), count(0),
+      direct(NULL), xkeys()
 {
 }
 
@@ -428,18 +429,25 @@ int UniConf::SortedIterBase::defcomparator(const UniConf &a,
 }
 
 
-static UniConf::SortedIterBase::Comparator innercomparator = NULL;
-
-static bool wrapcomparator(const UniConf &a, const UniConf &b)
+// std::sort() wants a "less than" function, and we have to carry the
+// comparator along with it so that sorting is reentrant.
+class UniConfLess
 {
-    return innercomparator(a, b) < 0;
-}
+    UniConf::SortedIterBase::Comparator comparator;
+public:
+    UniConfLess(UniConf::SortedIterBase::Comparator _comparator)
+        : comparator(_comparator)
+        { }
+    bool operator() (const UniConf &a, const UniConf &b) const
+        { return comparator(a, b) < 0; }
+};
 
 
 void UniConf::SortedIterBase::_purge()
 {
     count = xkeys.size();
     xkeys.clear();
+    direct = NULL;
 }
 
 
@@ -447,15 +455,39 @@ void UniConf::SortedIterBase::_rewind()
 {
     index = 0;
     count = xkeys.size();
-    
-    // This code is NOT reentrant because qsort makes it too hard
-    innercomparator = xcomparator;
-    std::sort(xkeys.begin(), xkeys.end(), wrapcomparator);
+    std::sort(xkeys.begin(), xkeys.end(), UniConfLess(xcomparator));
+}
+
+
+void UniConf::SortedIterBase::populate(UniConf::Iter &i)
+{
+    _purge();
+    i.rewind();
+
+    // all the children have the same parent, so if the generator gave
+    // them to us sorted by key, they're sorted by full key too.
+    if (xcomparator == defcomparator && i.sorted())
+    {
+        direct = &i;
+        index = count = 0;
+        return;
+    }
+
+    while (i.next())
+        xkeys.push_back(*i);
+    _rewind();
 }
 
 
 bool UniConf::SortedIterBase::next()
 {
+    if (direct)
+    {
+        if (!direct->next())
+            return false;
+        current = **direct;
+        return true;
+    }
     if (index >= count)
         return false;
     current = xkeys[index];
@@ -20,12 +20,15 @@ UUID_MAP_BEGIN(UniConfGen)
 UniConfGen::UniConfGen()
 {
     hold_nesting = 0;
+    delta_index = NULL;
+    delta_seq = 0;
 }
 
 
 UniConfGen::~UniConfGen()
 {
     assert(cblist.isempty());
+    delete delta_index;
 }
 
 
@@ -46,6 +49,8 @@ void UniConfGen::unhold_delta()
 
 void UniConfGen::clear_delta()
 {
+    if (delta_index)
+        delta_index->zap();
     deltas.zap();
 }
 
@@ -62,6 +67,12 @@ void UniConfGen::flush_delta()
         UniConfKey key((*it).key());
         WvString value((*it).value());
 
+        if (delta_index)
+        {
+            UniConfPendingDelta *pending = (*delta_index)[key];
+            if (pending && pending->pair == it.ptr())
+                delta_index->remove(pending);
+        }
         it.xunlink();
         dispatch_delta(key, value);
     }
@@ -84,12 +95,57 @@ void UniConfGen::delta(const UniConfKey &key, WvStringParm value)
     else
     {
         hold_delta();
-        deltas.add(new UniConfPair(key, value), true);
+
+        // Coalesce this with the key's pending notification, if any, so
+        // that changing a key over and over while held only notifies
+        // once.  But a key that was deleted and then recreated needs
+        // both notifications, since the deletion covers its children.
+        //
+        // A new value can only replace the old one where it is if no
+        // parent was deleted in between.  A deletion always moves to the
+        // end, so that it comes after any changes to the key's children.
+        if (!delta_index)
+            delta_index = new UniConfPendingDeltaDict(16);
+        UniConfPendingDelta *pending = (*delta_index)[key];
+        bool recreated = pending && pending->pair->value().isnull()
+            && !value.isnull();
+        if (pending && !value.isnull() && !recreated
+            && !parent_changed_since(key, pending->seq))
+            pending->pair->setvalue(value);
+        else
+        {
+            if (pending)
+            {
+                if (!recreated)
+                    deltas.unlink(pending->pair);
+                delta_index->remove(pending);
+            }
+            UniConfPair *pair = new UniConfPair(key, value);
+            deltas.add(pair, true);
+            delta_index->add(new UniConfPendingDelta(key, pair, ++delta_seq),
+                             true);
+        }
+
         unhold_delta();
     }
 }
 
 
+// True if any parent of 'key' has had a notification queued after 'seq'.
+// Only the newest one for each key is indexed, but a newer notification
+// for the parent is queued later still, so that's good enough.
+bool UniConfGen::parent_changed_since(const UniConfKey &key, unsigned int seq)
+{
+    for (int n = key.numsegments() - 1; n >= 0; n--)
+    {
+        UniConfPendingDelta *parent = (*delta_index)[key.first(n)];
+        if (parent && parent->seq > seq)
+            return true;
+    }
+    return false;
+}
+
+
 void UniConfGen::setv_naive(const UniConfPairList &pairs)
 {
     UniConfPairList::Iter pair(pairs);
@@ -8,7 +8,9 @@
 #include "wvstream.h"
 #include "uniconfkey.h"
 #include "wvhash.h"
+#include "wvscatterhash.h"
 #include <climits>
+#include <ctype.h>
 #include <assert.h>
 #include <strutils.h>
 
@@ -22,17 +24,91 @@ unsigned WvHash(const UniConfKey &k)
             result = 0;
             break;
         case 1:
-            result = WvHash(k.store->segments[k.left]);
+            result = k.store->segments[k.left].hash();
             break;
         default:
-            result = WvHash(k.store->segments[k.left])
-                ^ WvHash(k.store->segments[k.right - 1])
+            result = k.store->segments[k.left].hash()
+                ^ k.store->segments[k.right - 1].hash()
                 ^ numsegs;
             break;
     }
     return result;
 }
 
+
+/***** Segment interning *****/
+
+struct UniConfKeyNameAccessor
+{
+    template <class T>
+    static const WvFastString *get_key(const T *obj)
+        { return &obj->str; }
+};
+
+class UniConfKey::NameTable
+    : public WvScatterHash<Name, WvFastString, UniConfKeyNameAccessor>
+{
+};
+
+// Created on demand, since static UniConfKeys elsewhere might need it
+// before our own static initializers have run.
+UniConfKey::NameTable *UniConfKey::names;
+
+
+UniConfKey::Name *UniConfKey::intern(WvStringParm str)
+{
+    if (!str || !*str)
+        return NULL;
+    if (!names)
+        names = new NameTable;
+
+    Name *name = (*names)[str];
+    if (name)
+    {
+        name->refs++;
+        return name;
+    }
+
+    name = new Name;
+    name->str = str;
+    name->hash = WvHash(str);
+    name->refs = 1;
+    name->wild = (str == "*" || str == "...");
+    names->add(name, false);
+
+    // find (or create) the lowercase version that comparisons will use
+    const char *cptr;
+    for (cptr = str; *cptr && !isupper((unsigned char)*cptr); cptr++)
+        ;
+    if (*cptr)
+    {
+        WvString lower(str);
+        strlwr(lower.edit());
+        name->folded = intern(lower);
+    }
+    else
+        name->folded = name;
+    
+    return name;
+}
+
+
+void UniConfKey::free_name(Name *name)
+{
+    Name *folded = name->folded;
+    
+    names->remove(name);
+    delete name;
+    if (names->isempty())
+    {
+        delete names;
+        names = NULL;
+    }
+    
+    if (folded != name)
+        release(folded);
+}
+
 // The initial value of 1 for the ref_count of these guarantees
 // that they won't ever be deleted
 UniConfKey::Store UniConfKey::EMPTY_store(1, 1);
@@ -52,18 +128,34 @@ UniConfKey::Store::Store(int size, int _ref_count,
     if (!key)
         return;
 
-    WvStringList parts;
-    parts.split(key, "/");
+    // the common case: just one segment, which can share the string
+    if (!strchr(key, '/'))
+    {
+        if (!!*key)
+            segments.append(key);
+        return;
+    }
 
-    segments.resize(parts.count());
-    WvStringList::Iter part(parts);
-    for (part.rewind(); part.next(); )
+    // split the key in place in a private copy, so that we don't have to
+    // allocate anything for segments that are already interned
+    WvString tmp(key);
+    char *cptr = tmp.edit(), *part;
+    int count = 1;
+    for (part = cptr; *part; part++)
+        if (*part == '/')
+            count++;
+    segments.resize(count + 1);
+    
+    while (cptr)
     {
-        if (!*part)
-            continue;
-        segments.append(*part);
+        part = cptr;
+        cptr = strchr(cptr, '/');
+        if (cptr)
+            *cptr++ = '\0';
+        if (*part)
+            segments.append(WvFastString(part));
     }
-    if (!!key && key[key.len()-1] == '/' && segments.used() > 0)
+    if (key[key.len()-1] == '/' && segments.used() > 0)
         segments.append(Segment());
 }
 
@@ -216,13 +308,13 @@ WvString UniConfKey::printable() const
         case 0:
             return WvString::empty;
         case 1:
-            return store->segments[left];
+            return store->segments[left].str();
         default:
         {
             WvDynBuf buf;
             for (int i=left; i<right; ++i)
             {
-                buf.putstr(store->segments[i]);
+                buf.putstr(store->segments[i].str());
                 if (i < right-1)
                     buf.put('/');
             }
@@ -237,7 +329,10 @@ int UniConfKey::compareto(const UniConfKey &other) const
     int i, j;
     for (i=left, j=other.left; i<right && j<other.right; ++i, ++j)
     {
-        int val = strcasecmp(store->segments[i], other.store->segments[j]);
+        const Segment &a = store->segments[i], &b = other.store->segments[j];
+        if (a.sameas(b))
+            continue;
+        int val = strcasecmp(a.str(), b.str());
         if (val != 0)
             return val;
     }
@@ -297,9 +392,7 @@ bool UniConfKey::suborsame(const UniConfKey &key) const
     if (hastrailingslash())
 	n -= 1;
 
-    if (key.first(n) == first(n))
-	return true;
-    return false;
+    return key.numsegments() >= n && samesegments(key, n);
 }
 
 
@@ -312,7 +405,7 @@ bool UniConfKey::suborsame(const UniConfKey &key, UniConfKey &subkey) const
     if (hastrailingslash())
 	n -= 1;
 
-    if (key.first(n) == first(n))
+    if (key.numsegments() >= n && samesegments(key, n))
     {
 	subkey = key.removefirst(n);
 	return true;
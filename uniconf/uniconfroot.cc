@@ -140,28 +140,48 @@ void UniConfRoot::del_setbool(const UniConfKey &key, bool *flag, bool recurse)
 void UniConfRoot::check(UniWatchInfoTree *node,
 			const UniConfKey &key, int segleft)
 {
+    // skip ahead to the first interested watch, so that we only build
+    // the keys if somebody actually wants them
     UniWatchInfoList::Iter i(node->watches);
     for (i.rewind(); i.next(); )
+        if (i->recursive() || segleft <= 0)
+            break;
+    if (!i.cur())
+        return;
+
+    UniConf cfg(this, key.removelast(segleft));
+    UniConfKey subkey(key.last(segleft));
+    for (; i.cur(); i.next())
     {
         if (!i->recursive() && segleft > 0)
             continue;
 
-        i->notify(UniConf(this, key.removelast(segleft)), key.last(segleft));
+        i->notify(cfg, subkey);
     }
 }
 
 
 void UniConfRoot::deletioncheck(UniWatchInfoTree *node, const UniConfKey &key)
+{
+    deletioncheck(node, node, key);
+}
+
+
+void UniConfRoot::deletioncheck(UniWatchInfoTree *top, UniWatchInfoTree *node,
+				const UniConfKey &key)
 {
     UniWatchInfoTree::Iter i(*node);
     for (i.rewind(); i.next(); )
     {
         UniWatchInfoTree *w = i.ptr();
-        UniConfKey subkey(key, w->key());
         
-        // pretend that we wiped out just this key
-        check(w, subkey, 0);
-        deletioncheck(w, subkey);
+        // pretend that we wiped out just this key.  Most nodes in the
+        // watch tree are just there to hold their children, so don't
+        // bother making up their full names unless they have watches.
+        if (!w->watches.isempty())
+            check(w, UniConfKey(key, w->fullkey(top)), 0);
+        if (w->haschildren())
+            deletioncheck(top, w, key);
     }
 }
 
@@ -145,3 +145,11 @@ void UniDefGen::set(const UniConfKey &key, WvStringParm value)
     if (inner())
 	inner()->set(key, value);
 }
+
+
+void UniDefGen::setv(const UniConfPairList &pairs)
+{
+    // no keymap() on setv() either
+    if (inner())
+	inner()->setv(pairs);
+}
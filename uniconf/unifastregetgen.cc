@@ -8,6 +8,7 @@
 
 #include "unifastregetgen.h"
 #include "uniconftree.h"
+#include "unilistiter.h"
 #include "wvmoniker.h"
 
 // if 'obj' is non-NULL and is a UniConfGen, wrap that; otherwise wrap the
@@ -20,11 +21,69 @@ static IUniConfGen *creator(WvStringParm s, IObject *_obj)
 static WvMoniker<IUniConfGen> reg("fast-reget", creator);
 
 
+/**
+ * A node in the cache.  Besides the value, it remembers whether the key
+ * has any children, and whether *all* of its existing children are in the
+ * tree ('complete').  A node with a null value is known not to exist, so
+ * it has no children either.
+ */
+class UniFastRegetGen::CacheTree : public UniConfTree<CacheTree>
+{
+    WvString xvalue;
+
+public:
+    enum Kids { UNKNOWN, NO, YES };
+    Kids kids;
+    bool complete;
+
+    CacheTree(CacheTree *parent, const UniConfKey &key, WvStringParm value)
+        : UniConfTree<CacheTree>(parent, key)
+        { setvalue(value); }
+
+    const WvString &value() const
+        { return xvalue; }
+
+    void setvalue(WvStringParm value)
+    {
+        if (value.isnull())
+        {
+            zap();
+            kids = NO;
+            complete = true;
+        }
+        else if (xvalue.isnull())
+        {
+            kids = UNKNOWN;
+            complete = false;
+        }
+        xvalue = value;
+    }
+
+    /** Recalculates 'kids' from the children, if we have all of them. */
+    void recount()
+    {
+        if (!complete)
+        {
+            kids = UNKNOWN;
+            return;
+        }
+        kids = NO;
+        Iter i(*this);
+        for (i.rewind(); i.next(); )
+            if (!i->value().isnull())
+            {
+                kids = YES;
+                break;
+            }
+    }
+};
+
+
 UniFastRegetGen::UniFastRegetGen(IUniConfGen *_inner) :
     UniFilterGen(_inner),
     tree(NULL)
 {
-    tree = new UniConfValueTree(NULL, "/", UniFilterGen::get("/"));
+    tree = new CacheTree(NULL, "/", UniFilterGen::get("/"));
 }
 
 
@@ -43,14 +102,44 @@ void UniFastRegetGen::gencallback(const UniConfKey &key, WvStringParm value)
     if (tree == NULL)
         return; // initialising
 
-    UniConfValueTree *t = tree->find(key);
-    if (t) // never previously retrieved; don't cache it
-	t->setvalue(value);
+    // walk down to the changed node, fixing up what we know about the
+    // children of each ancestor on the way
+    CacheTree *t = tree;
+    int n = key.numsegments();
+    for (int i = 0; t && i < n; i++)
+    {
+        if (!value.isnull())
+        {
+            if (t->value().isnull())
+                t->setvalue(WvString::empty); // parents spring into existence
+            t->kids = CacheTree::YES;
+        }
+
+        CacheTree *child = t->findchild(key.segment(i));
+        if (!child && i == n - 1)
+        {
+            if (!value.isnull() && t->complete)
+                new CacheTree(t, key.segment(i), value);
+            else if (value.isnull() && !t->complete)
+                t->kids = CacheTree::UNKNOWN; // maybe that was the last one
+        }
+        else if (!child && !value.isnull())
+            t->complete = false; // never previously retrieved; don't cache
+        t = child;
+    }
+
+    if (t)
+    {
+        bool existed = !t->value().isnull();
+        t->setvalue(value);
+        if (existed && value.isnull() && t->parent())
+            t->parent()->recount();
+    }
     UniFilterGen::gencallback(key, value);
 }
 
 
-WvString UniFastRegetGen::get(const UniConfKey &key)
+UniFastRegetGen::CacheTree *UniFastRegetGen::findnode(const UniConfKey &key)
 {
     if (!tree)
     {
@@ -58,26 +147,61 @@ WvString UniFastRegetGen::get(const UniConfKey &key)
 	abort();
     }
 
+    CacheTree *t = tree;
+    int n = key.numsegments();
+    for (int i = 0; i < n; i++)
+    {
+        UniConfKey segment(key.segment(i));
+        CacheTree *child = t->findchild(segment);
+        if (!child)
+        {
+            // if the parent is null, or we already have all of its
+            // children, then this one is guaranteed null
+            WvString value;
+            if (!t->complete && t->kids != CacheTree::NO)
+                value = UniFilterGen::get(key.first(i + 1));
+            child = new CacheTree(t, segment, value);
+        }
+        t = child;
+    }
+    return t;
+}
+
+
+void UniFastRegetGen::loadchildren(CacheTree *t, const UniConfKey &key)
+{
+    // Children that are cached but don't show up here would already have
+    // been nulled out by a notification, so we only need to add new ones.
+    Iter *i = UniFilterGen::iterator(key);
+    if (i)
+    {
+        for (i->rewind(); i->next(); )
+        {
+            WvString value(i->value());
+            if (value.isnull())
+                continue;
+
+            CacheTree *child = t->findchild(i->key());
+            if (child)
+                child->setvalue(value);
+            else
+                new CacheTree(t, i->key(), value);
+        }
+        delete i;
+    }
+
+    t->complete = true;
+    t->recount();
+}
+
+
+WvString UniFastRegetGen::get(const UniConfKey &key)
+{
     // Keys with trailing slashes can't have values set on them
     if (key.hastrailingslash())
         return WvString::null;
 
-    UniConfValueTree *t = tree->find(key);
-    if (!t)
-    {
-        UniConfKey parentkey(key.removelast());
-	get(parentkey); // guaranteed to create parent node
-	t = tree->find(parentkey);
-	assert(t);
-	
-	WvString value;
-	if (!t->value().isnull()) // if parent is null, child guaranteed null
-	    value = UniFilterGen::get(key);
-	new UniConfValueTree(t, key.last(), value);
-	return value;
-    }
-    else
-	return t->value();
+    return findnode(key)->value();
 }
 
 
@@ -91,15 +215,28 @@ bool UniFastRegetGen::exists(const UniConfKey &key)
 
 bool UniFastRegetGen::haschildren(const UniConfKey &key)
 {
-    if (!tree)
-    {
-	wvassert(tree, "key: '%s'", key);
-	abort();
-    }
+    CacheTree *t = findnode(key);
+    if (t->kids == CacheTree::UNKNOWN)
+        t->kids = UniFilterGen::haschildren(key)
+            ? CacheTree::YES : CacheTree::NO;
+    return t->kids == CacheTree::YES;
+}
 
-    // if we already know the node is null, we can short circuit this one
-    UniConfValueTree *t = tree->find(key);
-    if (t && t->value().isnull())
-	return false; // definitely no children
-    return UniFilterGen::haschildren(key);
+
+UniConfGen::Iter *UniFastRegetGen::iterator(const UniConfKey &key)
+{
+    CacheTree *t = findnode(key);
+    if (t->value().isnull())
+        return new NullIter;
+    if (!t->complete)
+        loadchildren(t, key);
+
+    // copy the list, since notifications could change the tree while the
+    // caller is still iterating
+    ListIter *i = new ListIter(this);
+    CacheTree::Iter ci(*t);
+    for (ci.rewind(); ci.next(); )
+        if (!ci->value().isnull())
+            i->add(ci->key(), ci->value());
+    return i;
 }
@@ -8,6 +8,8 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <string.h>
 
 WV_LINK(UniFileSystemGen);
 
@@ -21,11 +23,18 @@ WvMoniker<IUniConfGen> UniFileSystemGenMoniker("fs", creator);
 
 
 UniFileSystemGen::UniFileSystemGen(WvStringParm _dir, mode_t _mode)
-    : dir(_dir), mode(_mode)
+    : dir(_dir), mode(_mode), dirfd(-1), dirdev(0), dirino(0)
 {
 }
 
 
+UniFileSystemGen::~UniFileSystemGen()
+{
+    if (dirfd >= 0)
+	close(dirfd);
+}
+
+
 static bool key_safe(const UniConfKey &key)
 {
     UniConfKey::Iter i(key);
@@ -40,37 +49,149 @@ static bool key_safe(const UniConfKey &key)
 }
 
 
+bool UniFileSystemGen::open_root(bool create)
+{
+    struct stat st;
+    if (dirfd >= 0)
+    {
+	// make sure 'dir' is still the directory we have open: it might
+	// have been deleted (possibly by set(UniConfKey::EMPTY, NULL)),
+	// renamed or replaced since.
+	if (stat(dir, &st) == 0 && st.st_dev == dirdev && st.st_ino == dirino)
+	    return true;
+	close(dirfd);
+	dirfd = -1;
+    }
+    
+    if (create)
+	mkdirp(dir, mode);
+    dirfd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (dirfd < 0)
+	return false;
+    fcntl(dirfd, F_SETFD, FD_CLOEXEC);
+    if (fstat(dirfd, &st) == 0)
+    {
+	dirdev = st.st_dev;
+	dirino = st.st_ino;
+    }
+    return true;
+}
+
+
+int UniFileSystemGen::open_dir(const UniConfKey &key)
+{
+    if (!open_root(true))
+	return -1;
+    if (key.isempty())
+	return dirfd;
+    
+    // the usual case: it's already there
+    int fd = openat(dirfd, key.printable(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0 || errno != ENOENT)
+	return fd;
+    
+    // create it one level at a time, without resolving the whole path
+    // over and over
+    fd = dirfd;
+    UniConfKey::Iter i(key);
+    for (i.rewind(); i.next(); )
+    {
+	mkdirat(fd, i().printable(), mode); // might already exist
+	int next = openat(fd, i().printable(), O_RDONLY | O_DIRECTORY);
+	if (fd != dirfd)
+	    close(fd);
+	fd = next;
+	if (fd < 0)
+	    break;
+    }
+    return fd;
+}
+
+
+void UniFileSystemGen::write_file(int fd, const char *name, WvStringParm value)
+{
+    int file = openat(fd, name, O_WRONLY | O_CREAT | O_TRUNC, mode & 0666);
+    if (file < 0)
+	return;
+    
+    const char *cptr = value.cstr();
+    size_t left = value.len();
+    while (left)
+    {
+	ssize_t len = write(file, cptr, left);
+	if (len < 0 && errno == EINTR)
+	    continue;
+	if (len <= 0)
+	    break;
+	cptr += len;
+	left -= len;
+    }
+    close(file);
+}
+
+
 WvString UniFileSystemGen::get(const UniConfKey &key)
 {
     WvString null;
     
-    if (!key_safe(key))
+    if (!key_safe(key) || !open_root(false))
 	return null;
     
-    WvString path("%s/%s", dir, key);
-    
     // WARNING: this code depends on the ability to open() a directory
     // as long as we don't read it, because we want to fstat() it after.
-    WvFile file(path, O_RDONLY);
-    if (!file.isok())
+    int fd = openat(dirfd, key.isempty() ? "." : key.printable().cstr(),
+		    O_RDONLY | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0)
 	return null; // unreadable; pretend it doesn't exist
     
     struct stat st;
-    if (fstat(file.getrfd(), &st) < 0)
+    if (fstat(fd, &st) < 0)
+    {
+	close(fd);
 	return null; // openable but can't stat?  That's odd.
+    }
 
-    if (S_ISREG(st.st_mode))
+    if (!S_ISREG(st.st_mode))
+    {
+	close(fd);
+	return ""; // exists, but pretend it's an empty file
+    }
+    
+    // read it all in one go, using the size from fstat() as a hint
+    size_t size = st.st_size, used = 0;
+    WvString result;
+    result.setsize(size + 1);
+    for (;;)
     {
-	WvDynBuf buf;
-	while (file.isok())
-	    file.read(buf, 4096);
-	if (file.geterr())
+	if (used == size)
+	{
+	    // the file might have grown since the fstat()
+	    char c;
+	    if (pread(fd, &c, 1, used) <= 0)
+		break;
+	    WvString bigger;
+	    size = size * 2 + 4096;
+	    bigger.setsize(size + 1);
+	    memcpy(bigger.edit(), result.cstr(), used);
+	    result = bigger;
+	}
+	
+	ssize_t len = pread(fd, result.edit() + used, size - used, used);
+	if (len < 0 && errno == EINTR)
+	    continue;
+	if (len < 0)
+	{
+	    close(fd);
 	    return null;
-	else
-	    return buf.getstr();
+	}
+	if (len == 0)
+	    break;
+	used += len;
     }
-    else
-	return ""; // exists, but pretend it's an empty file
+    close(fd);
+    
+    result.edit()[used] = 0;
+    return result;
 }
 
 
@@ -79,24 +200,62 @@ void UniFileSystemGen::set(const UniConfKey &key, WvStringParm value)
     if (!key_safe(key))
 	return;
     
-    WvString base("%s/%s", dir, key.removelast(1));
-    WvString path("%s/%s", dir, key);
-    
-    mkdirp(base, mode);
-    
     if (value.isnull())
-	rm_rf(path);
-    else
     {
-	WvFile file(path, O_WRONLY|O_CREAT|O_TRUNC, mode & 0666);
-	file.write(value);
+	rm_rf(WvString("%s/%s", dir, key));
+	return;
     }
+    
+    int fd = open_dir(key.removelast(1));
+    if (fd < 0)
+	return;
+    write_file(fd, key.last().printable(), value);
+    if (fd != dirfd)
+	close(fd);
 }
 
 
 void UniFileSystemGen::setv(const UniConfPairList &pairs)
 {
-    setv_naive(pairs);
+    // Changes usually come in groups of keys in the same directory, so
+    // keep the last directory open instead of creating and finding it
+    // again for each file.
+    UniConfKey lastdir;
+    int fd = -1;
+    
+    UniConfPairList::Iter pair(pairs);
+    for (pair.rewind(); pair.next(); )
+    {
+	const UniConfKey &key = pair->key();
+	if (!key_safe(key))
+	    continue;
+	
+	if (pair->value().isnull())
+	{
+	    // we might be deleting the directory we have open
+	    if (fd >= 0 && fd != dirfd)
+		close(fd);
+	    fd = -1;
+	    rm_rf(WvString("%s/%s", dir, key));
+	    continue;
+	}
+	
+	// UniConfKey comparisons ignore case, but the filesystem doesn't
+	UniConfKey dirkey(key.removelast(1));
+	if (fd < 0 || strcmp(dirkey.printable(), lastdir.printable()))
+	{
+	    if (fd >= 0 && fd != dirfd)
+		close(fd);
+	    fd = open_dir(dirkey);
+	    lastdir = dirkey;
+	    if (fd < 0)
+		continue;
+	}
+	write_file(fd, key.last().printable(), pair->value());
+    }
+    
+    if (fd >= 0 && fd != dirfd)
+	close(fd);
 }
 
 
@@ -100,8 +100,19 @@ void UniFilterGen::set(const UniConfKey &key, WvStringParm value)
 
 void UniFilterGen::setv(const UniConfPairList &pairs)
 {
-    if (xinner)
-	xinner->setv(pairs);
+    if (!xinner)
+	return;
+
+    // rename the keys just like set() does
+    UniConfPairList mapped;
+    UniConfPairList::Iter pair(pairs);
+    for (pair.rewind(); pair.next(); )
+    {
+	UniConfKey mapped_key;
+	if (keymap(pair->key(), mapped_key))
+	    mapped.append(new UniConfPair(mapped_key, pair->value()), true);
+    }
+    xinner->setv(mapped);
 }
 
 
@@ -6,6 +6,7 @@
  */
 #include "unihashtree.h"
 #include "assert.h"
+#include <stdlib.h>
 
 
 UniHashTreeBase::UniHashTreeBase(UniHashTreeBase *parent, 
@@ -122,6 +123,7 @@ void UniHashTreeBase::link(UniHashTreeBase *node)
     if (!xchildren)
         xchildren = new Container();
 
+    xchildren->unsort();
     xchildren->add(node);
 }
 
@@ -131,6 +133,7 @@ void UniHashTreeBase::unlink(UniHashTreeBase *node)
     if (!xchildren)
         return;
 
+    xchildren->unsort();
     xchildren->remove(node);
     if (xchildren->count() == 0)
     {
@@ -145,6 +148,30 @@ static int keysorter(const UniHashTreeBase *a, const UniHashTreeBase *b)
     return a->key().compareto(b->key());
 }
 
+
+static int qkeysorter(const void *a, const void *b)
+{
+    return keysorter(*(const UniHashTreeBase **)a,
+                     *(const UniHashTreeBase **)b);
+}
+
+
+UniHashTreeBase **UniHashTreeBase::Container::sorted()
+{
+    if (xsorted)
+        return xsorted;
+
+    size_t n = count(), used = 0;
+    xsorted = new UniHashTreeBase*[n + 1];
+    Iter i(*this);
+    for (i.rewind(); i.next() && used < n; )
+        xsorted[used++] = i.ptr();
+    qsort(xsorted, used, sizeof(*xsorted), qkeysorter);
+    xsorted[used] = NULL;
+    return xsorted;
+}
+
+
 void UniHashTreeBase::_recursive_unsorted_visit(
     const UniHashTreeBase *a,
     const UniHashTreeBaseVisitor &visitor, void *userdata,
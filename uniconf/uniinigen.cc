@@ -28,22 +28,56 @@ WvMoniker<IUniConfGen> UniIniGenMoniker("ini", creator);
 /***** UniIniGen *****/
 
 UniIniGen::UniIniGen(WvStringParm _filename, int _create_mode, UniIniGen::SaveCallback _save_cb)
-    : filename(_filename), create_mode(_create_mode), log(_filename), save_cb(_save_cb)
+    : filename(_filename), create_mode(_create_mode), log(_filename), save_cb(_save_cb),
+      journalname("%s.journal", _filename), journal_max(0),
+      journal_pending_size(0), journal_full(true)
 {
     // Create the root, since this generator can't handle it not existing.
     UniTempGen::set(UniConfKey::EMPTY, WvString::empty);
     memset(&old_st, 0, sizeof(old_st));
+    memset(&old_journal_st, 0, sizeof(old_journal_st));
 }
 
 
 void UniIniGen::set(const UniConfKey &key, WvStringParm value)
 {
+    // find out whether *this* set() changed anything
+    bool was_dirty = dirty;
+    dirty = false;
+    
     UniTempGen::set(key, value);
 
     // Re-create the root, since this generator can't handle it not existing.
     if (value.isnull() && key.isempty())
         UniTempGen::set(UniConfKey::EMPTY, WvString::empty);
 
+    if (dirty && journal_max && !journal_full)
+    {
+	// a deletion is a record with only a key in it
+	WvStringList record;
+	record.append(key.printable());
+	if (!value.isnull())
+	    record.append(value);
+	WvString s = wvtcl_encode(record);
+	journal_pending.append(s);
+	journal_pending_size += s.len() + 1;
+	
+	// there's no point in journaling more than we'd compact anyway
+	if (journal_pending_size > journal_max)
+	{
+	    journal_pending.zap();
+	    journal_pending_size = 0;
+	    journal_full = true;
+	}
+    }
+    
+    dirty = dirty || was_dirty;
+}
+
+
+void UniIniGen::set_journal(size_t max_size)
+{
+    journal_max = max_size;
 }
 
 
@@ -71,17 +105,25 @@ bool UniIniGen::refresh()
 	file.seterr(EAGAIN);
     }
     
+    struct stat jstatbuf;
+    if (stat(journalname, &jstatbuf) == -1)
+	memset(&jstatbuf, 0, sizeof(jstatbuf));
+    
     if (file.isok() // guarantes statbuf is valid from above
 	&& statbuf.st_ctime == old_st.st_ctime
 	&& statbuf.st_dev == old_st.st_dev
 	&& statbuf.st_ino == old_st.st_ino
 	&& statbuf.st_blocks == old_st.st_blocks
-	&& statbuf.st_size == old_st.st_size)
+	&& statbuf.st_size == old_st.st_size
+	&& jstatbuf.st_ctime == old_journal_st.st_ctime
+	&& jstatbuf.st_ino == old_journal_st.st_ino
+	&& jstatbuf.st_size == old_journal_st.st_size)
     {
 	log(WvLog::Debug3, "refresh: file hasn't changed; do nothing.\n");
 	return true;
     }
     memcpy(&old_st, &statbuf, sizeof(statbuf));
+    memcpy(&old_journal_st, &jstatbuf, sizeof(jstatbuf));
 #endif
 
     if (!file.isok())
@@ -189,6 +231,13 @@ bool UniIniGen::refresh()
         return false;
     }
 
+    load_journal(*newgen);
+    
+    // we now match what's on disk, so we can journal on top of it
+    journal_pending.zap();
+    journal_pending_size = 0;
+    journal_full = false;
+
     // switch the trees and send notifications
     hold_delta();
     UniConfValueTree *oldtree = root;
@@ -209,6 +258,50 @@ bool UniIniGen::refresh()
 }
 
 
+void UniIniGen::load_journal(UniTempGen &gen)
+{
+    WvFile file(journalname, O_RDONLY);
+    if (!file.isok())
+	return; // no journal is the usual case
+    
+    WvDynBuf buf;
+    while (file.isok())
+	file.read(buf, 65536);
+    
+    // A record is only complete once its newline is on the disk, so ignore
+    // anything after the last one in case we crashed in mid-append.
+    WvString data = buf.getstr();
+    char *end = strrchr(data.edit(), '\n');
+    if (!end)
+	return;
+    end[1] = '\0';
+    
+    WvConstStringBuffer records(data);
+    WvString record;
+    while (!(record = wvtcl_getword(records,
+				    WVTCL_NASTY_NEWLINES,
+				    false)).isnull())
+    {
+	if (!*trim_string(record.edit()))
+	    continue; // blank line
+	
+	WvStringList l;
+	wvtcl_decode(l, record);
+	if (l.count() == 1)
+	    gen.set(*l.first(), WvString::null);
+	else if (l.count() == 2)
+	    gen.set(*l.first(), *l.last());
+	else
+	    log(WvLog::Warning,
+		"Ignoring malformed journal record: \"%s\"\n", record);
+    }
+    
+    // a journaled deletion of the root may have taken it away
+    if (!gen.root)
+	gen.set(UniConfKey::EMPTY, WvString::empty);
+}
+
+
 // returns: true if a==b
 bool UniIniGen::refreshcomparator(const UniConfValueTree *a,
 				  const UniConfValueTree *b)
@@ -298,6 +391,99 @@ void UniIniGen::commit()
 
     UniTempGen::commit();
 
+    if (!journal_max || journal_full || !commit_journal())
+	commit_full();
+
+    dirty = false;
+}
+
+
+void UniIniGen::compact()
+{
+    struct stat statbuf;
+    if (dirty || stat(journalname, &statbuf) == 0)
+    {
+	UniTempGen::commit();
+	commit_full();
+	dirty = false;
+    }
+}
+
+
+// Cuts off a record at the end of the journal that never got its newline,
+// so that the next one doesn't get glued onto it.
+static bool trim_torn_record(int fd)
+{
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == -1)
+	return false;
+
+    char buf[4096];
+    off_t end = statbuf.st_size;
+    while (end > 0)
+    {
+	size_t len = end < (off_t)sizeof(buf) ? (size_t)end : sizeof(buf);
+	if (lseek(fd, end - len, SEEK_SET) == -1
+	    || read(fd, buf, len) != (ssize_t)len)
+	    return false;
+	size_t i = len;
+	while (i > 0 && buf[i-1] != '\n')
+	    i--;
+	end -= len - i;
+	if (i > 0)
+	    break;
+    }
+
+    return end == statbuf.st_size || ftruncate(fd, end) == 0;
+}
+
+
+bool UniIniGen::commit_journal()
+{
+    if (journal_pending.isempty())
+	return true; // the changes cancelled each other out
+    
+    WvFile file(journalname, O_RDWR|O_APPEND|O_CREAT, create_mode);
+    if (!file.isok() || !trim_torn_record(file.getwfd()))
+    {
+	log(WvLog::Warning, "Can't append to '%s': %s\n",
+	    journalname, file.isok() ? strerror(errno) : file.errstr().cstr());
+	return false;
+    }
+    
+    // write all the records at once, so they're all either there or not
+    WvDynBuf buf;
+    WvStringList::Iter i(journal_pending);
+    for (i.rewind(); i.next(); )
+    {
+	buf.putstr(*i);
+	buf.put('\n');
+    }
+    file.write(buf);
+    
+    struct stat statbuf;
+    bool toobig = fstat(file.getwfd(), &statbuf) == 0
+	&& (size_t)statbuf.st_size > journal_max;
+    file.close();
+    
+    if (file.geterr())
+    {
+	log(WvLog::Warning, "Error writing '%s': %s\n",
+	    journalname, file.errstr());
+	return false;
+    }
+    
+    journal_pending.zap();
+    journal_pending_size = 0;
+    
+    if (toobig)
+	commit_full();
+    return true;
+}
+
+
+void UniIniGen::commit_full()
+{
 #ifdef _WIN32
     // Windows doesn't support all that fancy stuff, just open the
     // file and be done with it
@@ -308,6 +494,7 @@ void UniIniGen::commit()
     {
         log(WvLog::Warning, "Can't write '%s': %s\n",
 	    filename, file.errstr());
+	commit_failed();
 	return;
     }
 #else
@@ -326,12 +513,14 @@ void UniIniGen::commit()
         {
             log(WvLog::Warning, "Can't write '%s' ('%s'): %s\n",
                 filename, real_filename, strerror(errno));
+	    commit_failed();
             return;
         }
 
         fchmod(file.getwfd(), (statbuf.st_mode & 07777) | S_ISVTX);
 
         save(file, *root);
+	file.flush(0);
     
         if (!file.geterr())
         {
@@ -340,13 +529,33 @@ void UniIniGen::commit()
 	    statbuf.st_mode = statbuf.st_mode & ~S_ISVTX;
 	    fchmod(file.getwfd(), statbuf.st_mode & 07777);
 	}
-	else
+	file.close();
+	if (file.geterr())
+	{
 	    log(WvLog::Warning, "Error writing '%s' ('%s'): %s\n",
 		filename, real_filename, file.errstr());
+	    commit_failed();
+	    return;
+	}
     }
 #endif
 
-    dirty = false;
+    // the .ini file now contains everything the journal did
+    unlink(journalname);
+    journal_pending.zap();
+    journal_pending_size = 0;
+    journal_full = false;
+}
+
+
+void UniIniGen::commit_failed()
+{
+    // keep the journal: it may be the only good copy of some changes.  What
+    // we have in memory can't be journaled on top of a broken file, though,
+    // so the next commit() has to rewrite everything again.
+    journal_pending.zap();
+    journal_pending_size = 0;
+    journal_full = true;
 }
 
 
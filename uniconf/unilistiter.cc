@@ -7,7 +7,7 @@
 #include "unilistiter.h"
 
 UniListIter::UniListIter(IUniConfGen *_gen)
-    : ki(keys), vi(values)
+    : ki(keys), vi(values), issorted(true)
 {
     gen = _gen;
 }
@@ -15,6 +15,9 @@ UniListIter::UniListIter(IUniConfGen *_gen)
 
 void UniListIter::add(const UniConfKey &k, WvStringParm v)
 { 
+    if (issorted && !keys.isempty() && keys.last()->compareto(k) >= 0)
+	issorted = false;
+    
     UniConfKey *nk = new UniConfKey(k);
     keys.append(nk, true);
     keylook.add(nk, false);
@@ -59,3 +62,9 @@ WvString UniListIter::value() const
     else
 	return gen->get(*ki);
 }
+
+
+bool UniListIter::sorted() const
+{
+    return issorted;
+}
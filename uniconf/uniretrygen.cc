@@ -197,6 +197,17 @@ void UniRetryGen::set(const UniConfKey &key, WvStringParm value)
 }
 
 
+void UniRetryGen::setv(const UniConfPairList &pairs)
+{
+    maybe_reconnect();
+    
+    if (UniFilterGen::isok())
+    	UniFilterGen::setv(pairs);
+    
+    maybe_disconnect();
+}
+
+
 bool UniRetryGen::exists(const UniConfKey &key)
 {
     maybe_reconnect();
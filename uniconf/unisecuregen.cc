@@ -116,6 +116,17 @@ void UniSecureGen::set(const UniConfKey &key, WvStringParm value)
 }
 
 
+void UniSecureGen::setv(const UniConfPairList &pairs)
+{
+    UniConfPairList allowed;
+    UniConfPairList::Iter pair(pairs);
+    for (pair.rewind(); pair.next(); )
+	if (findperm(pair->key(), UniPermGen::WRITE))
+	    allowed.append(new UniConfPair(pair->key(), pair->value()), true);
+    UniFilterGen::setv(allowed);
+}
+
+
 bool UniSecureGen::haschildren(const UniConfKey &key)
 {
     if (findperm(key, UniPermGen::EXEC))
@@ -24,7 +24,7 @@ static WvMoniker<IUniConfGen> reg("temp", creator);
 /***** UniTempGen *****/
 
 UniTempGen::UniTempGen()
-    : root(NULL)
+    : sorted(false), root(NULL)
 {
 }
 
@@ -149,7 +149,11 @@ void UniTempGen::set(const UniConfKey &_key, WvStringParm _value)
 
 void UniTempGen::setv(const UniConfPairList &pairs)
 {
+    // make all the changes before telling anyone about them, so that
+    // callbacks never see the list half-applied
+    hold_delta();
     setv_naive(pairs);
+    unhold_delta();
 }
 
 
@@ -172,9 +176,18 @@ UniConfGen::Iter *UniTempGen::iterator(const UniConfKey &key)
         if (node)
 	{
 	    ListIter *it = new ListIter(this);
-	    UniConfValueTree::Iter i(*node);
-	    for (i.rewind(); i.next(); )
-		it->add(i->key(), i->value());
+	    if (sorted)
+	    {
+		UniConfValueTree::SortedIter i(*node);
+		for (i.rewind(); i.next(); )
+		    it->add(i->key(), i->value());
+	    }
+	    else
+	    {
+		UniConfValueTree::Iter i(*node);
+		for (i.rewind(); i.next(); )
+		    it->add(i->key(), i->value());
+	    }
             return it;
 	}
     }
@@ -270,11 +270,16 @@ void UniTransactionGen::commit()
 {
     if (root)
     {
-	// Apply our changes to the inner generator.  We can't optimise
-	// away callbacks at this point, because we may get notified of
-	// changes caused by our changes.
+	// Apply our changes to the inner generator, all in one setv() so
+	// that generators that can do it atomically don't show anyone a
+	// half-applied transaction.  We can't optimise away callbacks at
+	// this point, because we may get notified of changes caused by our
+	// changes.
 	hold_delta();
-	apply_changes(root, UniConfKey());
+	UniConfPairList pairs;
+	apply_changes(root, UniConfKey(), pairs);
+	if (!pairs.isempty())
+	    base->setv(pairs);
 
 	// make sure the inner generator also commits
 	base->commit();
@@ -351,9 +356,10 @@ UniConfGen::Iter *UniTransactionGen::iterator(const UniConfKey &key)
 }
 
 void UniTransactionGen::apply_values(UniConfValueTree *newcontents,
-				     const UniConfKey &section)
+				     const UniConfKey &section,
+				     UniConfPairList &pairs)
 {
-    base->set(section, newcontents->value());
+    pairs.append(new UniConfPair(section, newcontents->value()), true);
 
     UniConfGen::Iter *j = base->iterator(section);
     if (j)
@@ -364,7 +370,8 @@ void UniTransactionGen::apply_values(UniConfValueTree *newcontents,
 		// Delete all children of the current value in the
 		// underlying generator that do not exist in our
 		// replacement tree.
-		base->set(UniConfKey(section, j->key()), WvString::null);
+		pairs.append(new UniConfPair(UniConfKey(section, j->key()),
+					     WvString::null), true);
 	}
 	delete j;
     }
@@ -372,27 +379,31 @@ void UniTransactionGen::apply_values(UniConfValueTree *newcontents,
     // Repeat for each child in the replacement tree.
     UniConfValueTree::Iter i(*newcontents);
     for (i.rewind(); i.next();)
-	apply_values(i.ptr(), UniConfKey(section, i->key()));
+	apply_values(i.ptr(), UniConfKey(section, i->key()), pairs);
 }
 
 void UniTransactionGen::apply_changes(UniConfChangeTree *node,
-				      const UniConfKey &section)
+				      const UniConfKey &section,
+				      UniConfPairList &pairs)
 {
+    // Note that nothing has been applied to the underlying generator
+    // yet, but none of the changes we've already collected can affect
+    // the parts of it that we look at here.
     if (node->mode == NEWTREE)
     {
 	// If the current change is a NEWTREE change, then replace the
 	// tree in the underlying generator with the stored one.
 	if (node->newtree == NULL)
-	    base->set(section, WvString::null);
+	    pairs.append(new UniConfPair(section, WvString::null), true);
 	else
-	    apply_values(node->newtree, section);
+	    apply_values(node->newtree, section, pairs);
 	// Since such changes have no children, return immediately.
 	return;
     }
     else if (node->mode == NEWVALUE)
     {
 	// Else if the current change is a NEWVALUE change, ...
-	base->set(section, node->newvalue);
+	pairs.append(new UniConfPair(section, node->newvalue), true);
     }
     else if (node->mode == NEWNODE)
     {
@@ -400,7 +411,7 @@ void UniTransactionGen::apply_changes(UniConfChangeTree *node,
 	if (!base->exists(section))
 	    // ... and the current value in the underlying generator doesn't
 	    // exist, then create it.
-	    base->set(section, WvString::empty);
+	    pairs.append(new UniConfPair(section, WvString::empty), true);
 	// Note: This *is* necessary. We can't ignore this change and have
 	// the underlying generator handle it, because it's possible that
 	// this NEWNODE was the result of a set() which was later deleted.
@@ -409,7 +420,7 @@ void UniTransactionGen::apply_changes(UniConfChangeTree *node,
     // Repeat for each child in the change tree.
     UniConfChangeTree::Iter i(*node);
     for (i.rewind(); i.next();)
-	apply_changes(i.ptr(), UniConfKey(section, i->key()));
+	apply_changes(i.ptr(), UniConfKey(section, i->key()), pairs);
 }
 
 struct my_userdata
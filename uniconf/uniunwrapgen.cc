@@ -96,9 +96,19 @@ void UniUnwrapGen::set(const UniConfKey &key, WvStringParm value)
 
 void UniUnwrapGen::setv(const UniConfPairList &pairs)
 {
+    // the keys are relative to xinner, just like in set()
+    UniConfPairList fullpairs;
+    UniConfPairList::Iter pair(pairs);
+    for (pair.rewind(); pair.next(); )
+    {
+	UniConfKey key(pair->key().isempty()
+		       ? xfullkey : UniConfKey(xfullkey, pair->key()));
+	fullpairs.append(new UniConfPair(key, pair->value()), true);
+    }
+    
     // Extremely evil.  This pokes directly into UniMountGen, because we
     // don't want to expose setv to users.
-    xinner.rootobj()->mounts.setv(pairs);
+    xinner.rootobj()->mounts.setv(fullpairs);
 }
 
 
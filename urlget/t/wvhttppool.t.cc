@@ -5,6 +5,7 @@
 
 #ifndef _WIN32
 #include <netdb.h>
+#include <sys/socket.h>
 #endif
 
 
@@ -260,3 +261,252 @@ WVTEST_MAIN("WvHttpPool pipelining")
     WVPASS(listener->isok());
 }
 
+
+static unsigned int par_conns = 0, par_open = 0;
+
+static void par_closed()
+{
+    par_open--;
+}
+
+
+// answers every request right away, without caring about pipelining
+static void par_callback(WvStream &s)
+{
+    char *line;
+    while ((line = s.getline()) != NULL)
+    {
+        if (!strncmp(line, "GET", 3))
+            s.print("HTTP/1.1 200 OK\n"
+                    "Content-Length: 5\n"
+                    "Content-Type: text/html\n\n"
+                    "Foo!\n");
+    }
+}
+
+
+static void par_listener_callback(WvIStreamList *list, IWvStream *_newconn)
+{
+    par_conns++;
+    par_open++;
+    WvStreamClone *newconn = new WvStreamClone(_newconn);
+    newconn->setcallback(wv::bind(par_callback, wv::ref(*newconn)));
+    newconn->setclosecallback(par_closed);
+    list->append(newconn, true, "incoming http conn");
+}
+
+
+static void par_fetch(WvIStreamList &l, WvHttpPool &pool, unsigned int port,
+		      int num_requests)
+{
+    WvIStreamList bufs;
+    l.append(&bufs, false, "list of bufs");
+    for (int i = 0; i < num_requests; i++)
+    {
+        WvStream *buf = pool.addurl(WvString("http://localhost:%s/%s.html",
+					     port, i));
+        bufs.append(buf, true, "poolbuf");
+    }
+
+    for (int tries = 0; bufs.count() && tries < 10000; tries++)
+    {
+        l.runonce(10);
+        WvIStreamList::Iter j(bufs);
+        for (j.rewind(); j.next(); )
+        {
+            char tmp[64];
+            j->read(tmp, sizeof(tmp));
+            if (!j->isok())
+                j.xunlink();
+        }
+    }
+    WVPASSEQ(bufs.count(), 0);
+    l.unlink(&bufs);
+}
+
+
+WVTEST_MAIN("WvHttpPool parallel connections")
+{
+    WvIStreamList l;
+    unsigned int port = 4300;
+    WvTCPListener *listener;
+    while (!(listener = new WvTCPListener(port))->isok())
+    {
+        WVRELEASE(listener);
+        ++port;
+    }
+    listener->onaccept(wv::bind(par_listener_callback, &l, _1));
+    l.append(listener, true, "http listener");
+
+    // without pipelining, each connection does one request at a time
+    WvHttpStream::global_enable_pipelining = false;
+
+    {
+        WvHttpPool pool;
+        l.append(&pool, false, "WvHttpPool");
+        pool.set_max_conns_per_target(3);
+
+        par_conns = 0;
+        par_fetch(l, pool, port, 9);
+        WVPASSEQ(par_conns, 3);
+        WVPASSEQ(pool.conn_count(), 3);
+
+        // the idle connections get reused for more requests
+        par_fetch(l, pool, port, 2);
+        WVPASSEQ(par_conns, 3);
+
+        l.unlink(&pool);
+    }
+
+    {
+        // idle connections are closed once they've been idle long enough
+        WvHttpPool pool;
+        l.append(&pool, false, "WvHttpPool");
+        pool.set_idle_timeout(50);
+
+        par_fetch(l, pool, port, 1);
+        WVPASSEQ(pool.conn_count(), 1);
+        for (int i = 0; pool.conn_count() && i < 100; i++)
+            l.runonce(10);
+        WVPASSEQ(pool.conn_count(), 0);
+        l.unlink(&pool);
+    }
+
+    {
+        // a global limit applies across all the servers
+        WvHttpPool pool;
+        l.append(&pool, false, "WvHttpPool");
+        pool.set_max_conns_per_target(3);
+        pool.set_max_conns(2);
+
+        par_conns = 0;
+        par_fetch(l, pool, port, 6);
+        WVPASSEQ(par_conns, 2);
+        WVPASS(pool.conn_count() <= 2);
+        l.unlink(&pool);
+    }
+
+    {
+        // lots of requests at once all get through
+        WvHttpPool pool;
+        l.append(&pool, false, "WvHttpPool");
+        pool.set_max_conns_per_target(4);
+
+        par_conns = 0;
+        par_fetch(l, pool, port, 500);
+        // each connection reconnects after WvUrlStream::max_requests
+        WVPASS(par_conns >= 4);
+        WVPASS(par_conns <= 500 / WvUrlStream::max_requests + 4);
+        WVPASS(pool.idle());
+        l.unlink(&pool);
+    }
+
+    for (int i = 0; par_open && i < 100; i++)
+        l.runonce(10);
+    WVPASSEQ(par_open, 0);
+
+    WvHttpStream::global_enable_pipelining = true;
+}
+
+
+static unsigned int reset_conns = 0, reset_answered = 0;
+
+// On the first connection, answers the pipelining check and one real
+// request, then resets the connection when the next ones arrive, so the
+// client has several requests in flight when it dies.  Everything on the
+// other connections gets answered.
+static void reset_callback(WvStream &s, unsigned int conn)
+{
+    WvString buf("");
+    char *line;
+    while ((line = s.getline()) != NULL)
+    {
+        if (strncmp(line, "GET", 3) && strncmp(line, "HEAD", 4))
+            continue;
+        if (strstr(line, "wvhttp-pipeline-check-should-not-exist"))
+            buf.append("HTTP/1.1 404 Not Found\n\n");
+        else if (conn == 1 && reset_answered)
+        {
+            s.print(buf);
+#ifndef _WIN32
+            struct linger l = { 1, 0 };
+            setsockopt(((IWvStream &)s).getrfd(), SOL_SOCKET, SO_LINGER,
+                       &l, sizeof(l));
+#endif
+            s.close();
+            return;
+        }
+        else
+        {
+            buf.append("HTTP/1.1 200 OK\n"
+                       "Content-Length: 5\n"
+                       "Content-Type: text/html\n\n"
+                       "Foo!\n");
+            if (conn == 1)
+                reset_answered++;
+        }
+    }
+    s.print(buf);
+}
+
+
+static void reset_listener_callback(WvIStreamList *list, IWvStream *_newconn)
+{
+    reset_conns++;
+    WvStreamClone *newconn = new WvStreamClone(_newconn);
+    newconn->setcallback(wv::bind(reset_callback, wv::ref(*newconn),
+                                  reset_conns));
+    list->append(newconn, true, "incoming http conn");
+}
+
+
+WVTEST_MAIN("WvHttpPool connection reset with requests queued")
+{
+    WvIStreamList l;
+    unsigned int port = 4400;
+    WvTCPListener *listener;
+    while (!(listener = new WvTCPListener(port))->isok())
+    {
+        WVRELEASE(listener);
+        ++port;
+    }
+    listener->onaccept(wv::bind(reset_listener_callback, &l, _1));
+    l.append(listener, true, "http listener");
+
+    {
+        // the requests behind the one that failed go back to the pool,
+        // and have to be retried on a new connection without being freed
+        // or finished twice on the way.
+        WvHttpPool pool;
+        l.append(&pool, false, "WvHttpPool");
+        WvIStreamList bufs;
+        l.append(&bufs, false, "list of bufs");
+        for (int i = 0; i < 6; i++)
+            bufs.append(pool.addurl(WvString("http://localhost:%s/%s.html",
+                                             port, i)), true, "poolbuf");
+
+        int got = 0;
+        for (int tries = 0; bufs.count() && tries < 1000; tries++)
+        {
+            l.runonce(10);
+            WvIStreamList::Iter j(bufs);
+            for (j.rewind(); j.next(); )
+            {
+                char tmp[64];
+                size_t len = j->read(tmp, sizeof(tmp));
+                if (len == 5 && !strncmp(tmp, "Foo!\n", 5))
+                    got++;
+                if (!j->isok())
+                    j.xunlink();
+            }
+        }
+        WVPASSEQ(bufs.count(), 0);
+        WVPASS(reset_conns >= 2);
+        WVPASS(got >= 4);
+        for (int i = 0; !pool.idle() && i < 100; i++)
+            l.runonce(10);
+        WVPASS(pool.idle());
+        l.unlink(&bufs);
+        l.unlink(&pool);
+    }
+}
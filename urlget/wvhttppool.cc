@@ -31,6 +31,7 @@ WvUrlRequest::WvUrlRequest(WvStringParm _url, WvStringParm _method,
     : url(_url), headers(_headers)
 { 
     instream = NULL;
+    pool = NULL;
     create_dirs = _create_dirs;
     pipeline_test = _pipeline_test;
     method = _method;
@@ -61,6 +62,12 @@ WvUrlRequest::~WvUrlRequest()
 
 void WvUrlRequest::done()
 {
+    if (pool)
+    {
+        WvHttpPool *p = pool;
+        pool = NULL;
+        p->url_done(this);
+    }
     if (outstream)
     {
         outstream->seteof();
@@ -96,11 +103,15 @@ void WvUrlStream::delurl(WvUrlRequest *url, WvStringParm reason)
 
 
 WvHttpPool::WvHttpPool() 
-    : log("HTTP Pool", WvLog::Debug), conns(10),
+    : log("HTTP Pool", WvLog::Debug), targets(10), resolving(10),
       pipeline_incompatible(50)
 {
     log(WvLog::Debug2, "Pool initializing.\n");
-    num_streams_created = 0;
+    dispatch_needed = false;
+    num_streams_created = num_conns = 0;
+    max_conns_per_target = 1;
+    max_conns = 0;
+    idle_timeout = 5000;
 }
 
 
@@ -114,36 +125,42 @@ WvHttpPool::~WvHttpPool()
     // these must get zapped before the URL list, since they have pointers
     // to URLs.
     zap();
-    conns.zap();
+    targets.zap();
+    resolving.zap();
+    ready.zap();
+    finished.zap();
+
+    // don't let the URLs tell us they're done while we're deleting them
+    WvUrlRequestList::Iter i(urls);
+    for (i.rewind(); i.next(); )
+        i->pool = NULL;
 }
 
 
 void WvHttpPool::pre_select(SelectInfo &si)
 {
     //    log(WvLog::Debug5, "pre_select: main:%s conns:%s urls:%s\n",
-    //         count(), conns.count(), urls.count());
+    //         count(), num_conns, urls.count());
 
     WvIStreamList::pre_select(si);
 
-    WvUrlStreamDict::Iter ci(conns);
-    for (ci.rewind(); ci.next(); )
-    {
-        if (!ci->isok())
-            si.msec_timeout = 0;
-    }
-    
-    WvUrlRequestList::Iter i(urls);
-    for (i.rewind(); i.next(); )
+    WvUrlTargetConnsDict::Iter ti(targets);
+    for (ti.rewind(); ti.next(); )
     {
-        if (!i->instream)
+        WvUrlStreamList::Iter ci(ti->conns);
+        for (ci.rewind(); ci.next(); )
         {
-            log(WvLog::Debug4, "Checking dns for '%s'\n", i->url.gethost());
-            if (i->url.resolve())
+            if (!ci->isok())
                 si.msec_timeout = 0;
-            else
-                dns.pre_select(i->url.gethost(), si);    
         }
     }
+
+    if (!finished.isempty() || (dispatch_needed && !ready.isempty()))
+        si.msec_timeout = 0;
+
+    WvUrlHostWaitDict::Iter hi(resolving);
+    for (hi.rewind(); hi.next(); )
+        dns.pre_select(hi->hostname, si);
 }
 
 
@@ -151,51 +168,86 @@ bool WvHttpPool::post_select(SelectInfo &si)
 {
     bool sure = false;
 
-    WvUrlStreamDict::Iter ci(conns);
-    for (ci.rewind(); ci.next(); )
+    WvUrlTargetConnsDict::Iter ti(targets);
+    for (ti.rewind(); ti.next(); )
     {
-        if (!ci->isok())
+        WvUrlStreamList::Iter ci(ti->conns);
+        for (ci.rewind(); ci.next(); )
         {
-            log(WvLog::Debug4, "Stream died: %s\n", *ci->src());
-            unconnect(ci.ptr());
-            ci.rewind();
-            sure = true;
+            if (!ci->isok())
+            {
+                log(WvLog::Debug4, "Stream died: %s\n", *ci->src());
+                // this might delete ti's entry too, so start over
+                unconnect(ci.ptr());
+                ti.rewind();
+                sure = true;
+                break;
+            }
         }
     }
 
-    WvUrlRequestList::Iter i(urls);
+    WvUrlRequestList::Iter i(finished);
     for (i.rewind(); i.next(); )
     {
-        if ((!i->outstream && !i->inuse) || !i->url.isok())
+        WvUrlRequest *url = i.ptr();
+	WvString reason(url->url.isok() ? "URL done" : "URL failed");
+        // nicely delete the url request
+        if (url->instream)
+            url->instream->delurl(url, reason);
+        else
+            log(WvLog::Debug4, "%s: '%s'\n", reason, url->url);
+        i.xunlink();
+        urls.unlink(url);
+        dispatch_needed = true;
+    }
+
+    // one check for each hostname, no matter how many URLs are waiting
+    WvUrlHostWaitDict::Iter hi(resolving);
+    for (hi.rewind(); hi.next(); )
+    {
+        // everything that was waiting might have finished already
+        if (hi->urls.isempty())
         {
-	    WvString reason;
-            if (!i->url.isok())
-            {
-		reason = "URL failed";
-                i->done();
-            }
-	    else
-		reason = "URL done";
-            // nicely delete the url request
-            WvUrlStream::Target target(i->url.getaddr(), i->url.getuser());
-            WvUrlStream *s = conns[target];
-            if (s)
-                s->delurl(i.ptr(), reason);
-            i.xunlink();
+            resolving.remove(hi.ptr());
+            hi.rewind();
             continue;
         }
 
-        if (!i->instream)
+        // if the resolver forgot about it somehow, resolve() starts over
+        WvUrl &first = hi->urls.first()->url;
+        if (!dns.post_select(hi->hostname, si)
+                && !first.resolve() && first.isok())
+            continue;
+
+        log(WvLog::Debug4, "DNS check done: %s\n", hi->hostname);
+        WvUrlRequestList::Iter ui(hi->urls);
+        for (ui.rewind(); ui.next(); )
         {
-            log(WvLog::Debug4, "Checking dns for '%s'\n", i->url.gethost());
-            if (i->url.resolve() || dns.post_select(i->url.gethost(), si))
+            WvUrlRequest *url = ui.ptr();
+            if (url->url.resolve())
             {
-                log(WvLog::Debug4, "DNS check done: %s\n", i->url);
-                sure = true;
+                ready.append(url, false, "ready_url");
+                dispatch_needed = true;
+                ui.xunlink();
             }
+            else if (!url->url.isok())
+            {
+                // done() takes it out of hi->urls itself
+                ui.xunlink();
+                url->done();
+            }
+        }
+        if (hi->urls.isempty())
+        {
+            resolving.remove(hi.ptr());
+            hi.rewind();
         }
+        sure = true;
     }
 
+    if (dispatch_needed && !ready.isempty())
+        sure = true;
+
     return WvIStreamList::post_select(si) || sure;
 }
 
@@ -204,48 +256,145 @@ void WvHttpPool::execute()
 {
     WvIStreamList::execute();
 
-    WvUrlRequestList::Iter i(urls);
+    if (!dispatch_needed)
+        return;
+    dispatch_needed = false;
+
+    WvUrlRequestList::Iter i(ready);
     for (i.rewind(); i.next(); )
     {
-        WvUrlStream *s;
+        WvUrlRequest *url = i.ptr();
+        if (!url->outstream)
+        {
+            // it's already done; post_select() will clean it up
+            i.xunlink();
+            continue;
+        }
+
+        WvUrlStream *s = find_conn(url);
+        if (!s)
+            continue; // too many connections; wait for one to finish
+
+        // take it off 'ready' first, in case addurl() finishes it
+        i.xunlink();
+        url->instream = s;
+        s->addurl(url);
+    }
+}
 
-        if (!i->outstream || !i->url.isok() || !i->url.resolve())
-            continue; // skip it for now
 
-        WvUrlStream::Target target(i->url.getaddr(), i->url.getuser());
+WvUrlStream *WvHttpPool::find_conn(WvUrlRequest *url)
+{
+    WvUrlStream::Target target(url->url.getaddr(), url->url.getuser());
+    WvUrlTargetConns *tc = targets[target];
 
-        s = conns[target];
-        if (s && !s->isok())
+    // get rid of any dead connections first, so they don't count
+    while (tc)
+    {
+        WvUrlStream *dead = NULL;
+        WvUrlStreamList::Iter ci(tc->conns);
+        for (ci.rewind(); ci.next(); )
         {
-            unconnect(s);
-            s = NULL;
+            if (!ci->isok())
+            {
+                dead = ci.ptr();
+                break;
+            }
         }
+        if (!dead)
+            break;
+        unconnect(dead);
+        tc = targets[target];
+    }
 
-        if (!i->outstream)
-            continue; // unconnect might have caused this URL to be marked bad
-
-        if (!s)
+    // the connection with the least work to do
+    WvUrlStream *best = NULL;
+    size_t best_queued = 0;
+    int count = 0;
+    if (tc)
+    {
+        WvUrlStreamList::Iter ci(tc->conns);
+        for (ci.rewind(); ci.next(); )
         {
-            num_streams_created++;
-            if (!strncasecmp(i->url.getproto(), "http", 4))
-                s = new WvHttpStream(target.remaddr, target.username,
-                        i->url.getproto() == "https",
-                        pipeline_incompatible);
-            else if (!strcasecmp(i->url.getproto(), "ftp"))
-                s = new WvFtpStream(target.remaddr, target.username,
-                        i->url.getpassword());
-            conns.add(s, true);
-
-            // add it to the streamlist, so it can do things
-            append(s, false, "http/ftp stream");
+            size_t queued = ci->queued();
+            if (!best || queued < best_queued)
+            {
+                best = ci.ptr();
+                best_queued = queued;
+            }
+            count++;
         }
+    }
+
+    // only open another connection if all the existing ones are busy
+    if (best && !best_queued)
+        return best;
+    if (count >= max_conns_per_target)
+        return best;
+    if (max_conns && num_conns >= max_conns && !close_idle_conn())
+        return best;
+
+    return new_conn(url);
+}
+
+
+WvUrlStream *WvHttpPool::new_conn(WvUrlRequest *url)
+{
+    WvUrlStream::Target target(url->url.getaddr(), url->url.getuser());
+    WvUrlStream *s;
+
+    if (!strncasecmp(url->url.getproto(), "http", 4))
+    {
+        WvHttpStream *h = new WvHttpStream(target.remaddr, target.username,
+                url->url.getproto() == "https",
+                pipeline_incompatible);
+        h->idle_timeout = idle_timeout;
+        s = h;
+    }
+    else if (!strcasecmp(url->url.getproto(), "ftp"))
+        s = new WvFtpStream(target.remaddr, target.username,
+                url->url.getpassword());
+    else
+    {
+        log(WvLog::Debug3, "Unknown protocol: %s\n", url->url);
+        url->done();
+        return NULL;
+    }
+
+    num_streams_created++;
+    num_conns++;
+
+    WvUrlTargetConns *tc = targets[target];
+    if (!tc)
+    {
+        tc = new WvUrlTargetConns(target);
+        targets.add(tc, true);
+    }
+    tc->conns.append(s, true, "http/ftp stream");
+
+    // add it to the streamlist, so it can do things
+    append(s, false, "http/ftp stream");
+    return s;
+}
+
 
-        if (!i->instream)
+bool WvHttpPool::close_idle_conn()
+{
+    WvUrlTargetConnsDict::Iter ti(targets);
+    for (ti.rewind(); ti.next(); )
+    {
+        WvUrlStreamList::Iter ci(ti->conns);
+        for (ci.rewind(); ci.next(); )
         {
-            s->addurl(i.ptr());
-            i->instream = s;
+            if (!ci->isok() || !ci->queued())
+            {
+                log(WvLog::Debug4, "Closing idle stream to make room.\n");
+                unconnect(ci.ptr());
+                return true;
+            }
         }
     }
+    return false;
 }
 
 
@@ -256,8 +405,47 @@ WvBufUrlStream *WvHttpPool::addurl(WvStringParm _url, WvStringParm _method,
     WvUrlRequest *url = new WvUrlRequest(_url, _method, _headers, content_source,
                                          create_dirs, false);
     urls.append(url, true, "addurl");
+    url->pool = this;
 
-    return url->outstream;
+    // hang on to the stream, since done() forgets about it
+    WvBufUrlStream *outstream = url->outstream;
+    url_resolving(url);
+    return outstream;
+}
+
+
+void WvHttpPool::url_resolving(WvUrlRequest *url)
+{
+    if (url->url.resolve())
+    {
+        ready.append(url, false, "ready_url");
+        dispatch_needed = true;
+    }
+    else if (!url->url.isok())
+        url->done();
+    else
+    {
+        log(WvLog::Debug4, "Waiting for dns for '%s'\n", url->url.gethost());
+        WvUrlHostWait *w = resolving[url->url.gethost()];
+        if (!w)
+        {
+            w = new WvUrlHostWait(url->url.gethost());
+            resolving.add(w, true);
+        }
+        w->urls.append(url, false, "resolving_url");
+    }
+}
+
+
+void WvHttpPool::url_done(WvUrlRequest *url)
+{
+    // it might still be waiting for a stream or for DNS, and once
+    // post_select() has deleted it, nobody else may point to it.
+    ready.unlink(url);
+    WvUrlHostWait *w = resolving[url->url.gethost()];
+    if (w)
+        w->urls.unlink(url);
+    finished.append(url, false, "finished_url");
 }
 
 
@@ -269,13 +457,27 @@ void WvHttpPool::unconnect(WvUrlStream *s)
         log(WvLog::Debug3, "Unconnecting stream to %s@%s.\n",
 	    s->target.username, s->target.remaddr);
 
+    // anything that wasn't finished needs to go somewhere else
     WvUrlRequestList::Iter i(urls);
     for (i.rewind(); i.next(); )
     {
         if (i->instream == s)
+        {
             i->instream = NULL;
+            if (i->outstream)
+            {
+                ready.append(i.ptr(), false, "ready_url");
+                dispatch_needed = true;
+            }
+        }
     }
 
     unlink(s);
-    conns.remove(s);
+
+    WvUrlTargetConns *tc = targets[s->target];
+    assert(tc);
+    num_conns--;
+    tc->conns.unlink(s);
+    if (tc->conns.isempty())
+        targets.remove(tc);
 }
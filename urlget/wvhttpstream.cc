@@ -42,6 +42,7 @@ WvHttpStream::WvHttpStream(const WvIPPortAddr &_remaddr, WvStringParm _username,
     enable_pipelining = global_enable_pipelining 
         && !pipeline_incompatible[target.remaddr];
     expect_keep_alive = true;
+    idle_timeout = IDLE_TIMEOUT;
     ssl = _ssl;
 
     if (ssl)
@@ -656,7 +657,7 @@ void WvHttpStream::execute()
     }
 
     if (urls.isempty())
-        alarm(IDLE_TIMEOUT);
+        alarm(idle_timeout);
     else
         alarm(ACTIVITY_TIMEOUT);
 }
@@ -3,6 +3,7 @@
 #include "wvtest.h"
 #include "wvbuf.h"
 #include "wvbase64.h"
+#include "wvsimd.h"
 #include "wvstream.h"
 
 #define THREE_LETTERS 		"ken"
@@ -550,3 +551,89 @@ WVTEST_MAIN("resetting")
     }
 
 }
+
+
+// the simplest possible base64 encoder, to check the fast one against
+static WvString slow_base64(const unsigned char *data, size_t len)
+{
+    WvDynBuf out;
+    for (size_t i = 0; i < len; i += 3)
+    {
+        unsigned int bits = data[i] << 16;
+        if (i + 1 < len) bits |= data[i + 1] << 8;
+        if (i + 2 < len) bits |= data[i + 2];
+        for (size_t j = 0; j < 4; j++)
+        {
+            if (i + j > len)
+                out.putch('=');
+            else
+                out.putch(BASE64_ALPHABET[(bits >> (18 - 6 * j)) & 0x3f]);
+        }
+    }
+    return out.getstr();
+}
+
+
+static void check_long_data()
+{
+    unsigned char data[1000];
+    srand(42);
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = rand();
+
+    // every length from 0 to 100, plus some big ones
+    for (size_t len = 0; len < 1000; len += (len < 100 ? 1 : 97))
+    {
+        WvString expect(slow_base64(data, len));
+
+        WvBase64Encoder enc;
+        WvString encoded(enc.strflushmem(data, len, true));
+        if (!WVPASSEQ(encoded, expect))
+            break;
+
+        WvBase64Decoder dec;
+        WvDynBuf decoded;
+        WVPASS(dec.flushstrbuf(encoded, decoded));
+        WVPASSEQ(decoded.used(), len);
+        WVPASS(!memcmp(decoded.get(decoded.used()), data, len));
+
+        // a bad character in the middle of the block gets noticed
+        if (len > 30)
+        {
+            WvString bad(encoded);
+            bad.edit()[len / 2] = '*';
+            WvBase64Decoder dec2;
+            WvDynBuf junk;
+            WVFAIL(dec2.flushstrbuf(bad, junk, true));
+            WVFAIL(dec2.isok());
+        }
+    }
+
+    // line breaks all over the place
+    WvString encoded(slow_base64(data, sizeof(data)));
+    WvDynBuf wrapped;
+    for (size_t i = 0; i < encoded.len(); i += 19)
+    {
+        wrapped.put(encoded.cstr() + i,
+                    i + 19 < encoded.len() ? 19 : encoded.len() - i);
+        wrapped.putstr("\r\n");
+    }
+    WvBase64Decoder dec;
+    WvDynBuf decoded;
+    WVPASS(dec.flush(wrapped, decoded));
+    WVPASSEQ(decoded.used(), sizeof(data));
+    WVPASS(!memcmp(decoded.get(decoded.used()), data, sizeof(data)));
+}
+
+
+WVTEST_MAIN("long random data")
+{
+    // try the plain version and each of the SIMD ones this CPU has
+    for (int level = WVSIMD_AVX2; level >= WVSIMD_NONE; level--)
+    {
+        wvsimd_limit((WvSimdLevel)level);
+        if (wvsimd_level() == level)
+            check_long_data();
+    }
+    wvsimd_limit(WVSIMD_AVX2);
+}
@@ -56,6 +56,20 @@ WVTEST_MAIN("DynBuf")
         WVPASS(b.strchr('c') == b.strchr((unsigned char)'c'));
     }
 
+    {
+        // searching from an offset, across several internal buffers
+        WvDynBuf b;
+        b.put("ab", 2);
+        b.put("cdc", 3);
+        b.put("xyc", 3);
+        WVPASSEQ(b.strchr('c'), 3);
+        WVPASSEQ(b.strchr('c', 2), 3);
+        WVPASSEQ(b.strchr('c', 3), 5);
+        WVPASSEQ(b.strchr('c', 5), 8);
+        WVPASSEQ(b.strchr('c', 8), 0);
+        WVPASSEQ(b.strchr('a', 1), 0);
+    }
+
     {
         WvDynBuf buf;
         buf.put("get \0", 5);
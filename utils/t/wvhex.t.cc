@@ -31,6 +31,7 @@ char *alloca ();
 #include "wvtest.h"
 #include "wvbuf.h"
 #include "wvhex.h"
+#include "wvsimd.h"
 #include "wvstream.h"
 
 #define THREE_LETTERS 		"abz"
@@ -786,3 +787,82 @@ WVTEST_MAIN("resetting")
 
 }
 
+
+
+static void check_long_data()
+{
+    unsigned char data[256];
+    char expect[sizeof(data) * 2 + 1];
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = i;
+        snprintf(expect + i * 2, 3, "%02x", (int)i);
+    }
+    
+    WvHexEncoder enc;
+    WvString encoded(enc.strflushmem(data, sizeof(data), true));
+    WVPASSEQ(encoded, expect);
+    
+    // decode it back, with some spaces thrown in to break up the pairs
+    WvDynBuf in, out;
+    in.put(expect, 101);
+    in.putstr(" ");
+    in.putstr(expect + 101);
+    WvHexDecoder dec;
+    WVPASS(dec.flush(in, out, true));
+    WVPASSEQ(out.used(), sizeof(data));
+    WVPASS(!memcmp(out.get(out.used()), data, sizeof(data)));
+    
+    WvHexDecoder dec2;
+    in.putstr(expect);
+    in.putstr("zz");
+    WVFAIL(dec2.flush(in, out, true));
+    
+    // odd lengths, uppercase, and a bad digit somewhere in every block
+    unsigned char rdata[1000];
+    srand(42);
+    for (size_t i = 0; i < sizeof(rdata); i++)
+        rdata[i] = rand();
+    for (size_t len = 0; len < sizeof(rdata); len += (len < 100 ? 1 : 97))
+    {
+        WvString expect2;
+        expect2.setsize(len * 2 + 1);
+        for (size_t i = 0; i < len; i++)
+            sprintf(expect2.edit() + i * 2, "%02X", rdata[i]);
+        expect2.edit()[len * 2] = 0;
+
+        WvHexEncoder enc2(true);
+        WvString encoded2(enc2.strflushmem(rdata, len, true));
+        if (!WVPASSEQ(encoded2, expect2))
+            break;
+
+        WvHexDecoder dec3;
+        WvDynBuf decoded;
+        WVPASS(dec3.flushstrbuf(encoded2, decoded, true));
+        WVPASSEQ(decoded.used(), len);
+        WVPASS(!memcmp(decoded.get(decoded.used()), rdata, len));
+
+        if (len > 30)
+        {
+            WvString bad(encoded2);
+            bad.edit()[len] = 'g';
+            WvHexDecoder dec4;
+            WvDynBuf junk;
+            WVFAIL(dec4.flushstrbuf(bad, junk, true));
+            WVPASSEQ(junk.used(), len / 2);
+        }
+    }
+}
+
+
+WVTEST_MAIN("long data")
+{
+    // try the plain version and each of the SIMD ones this CPU has
+    for (int level = WVSIMD_AVX2; level >= WVSIMD_NONE; level--)
+    {
+        wvsimd_limit((WvSimdLevel)level);
+        if (wvsimd_level() == level)
+            check_long_data();
+    }
+    wvsimd_limit(WVSIMD_AVX2);
+}
@@ -111,6 +111,55 @@ WVTEST_MAIN("simple")
     WVPASS("--REPEATING TEST--");
     testme(); // make sure deletion/creation works
 }
+
+WVTEST_MAIN("recycling")
+{
+    WvTaskMan *taskman = WvTaskMan::get();
+    WvTaskMan::set_release_stacks(true);
+    
+    WvTask *a = taskman->start("task-a", gentask, (void *)1000, 16384);
+    while (a->isrunning())
+	taskman->run(*a);
+    WVPASSEQ(glob, 1003);
+    a->recycle();
+    
+    // a smaller stack fits in the same size class, so 'a' gets reused,
+    // even though its stack was thrown away in the meantime
+    WvTask *b = taskman->start("task-b", gentask, (void *)2000, 10000);
+    WVPASS(b == a);
+    while (b->isrunning())
+	taskman->run(*b);
+    WVPASSEQ(glob, 2003);
+    
+    // but a bigger one doesn't
+    WvTask *c = taskman->start("task-c", gentask, (void *)3000, 65536);
+    WVPASS(c != b);
+    WVPASS(c->isrunning());
+    while (c->isrunning())
+	taskman->run(*c);
+    b->recycle();
+    c->recycle();
+    
+    // lots of tasks at once
+    WvTaskList tasks;
+    for (int i = 0; i < 2000; i++)
+	tasks.append(taskman->start("many", gentask, (void *)0, 16384), false);
+    WvTaskList::Iter i(tasks);
+    for (i.rewind(); i.next(); )
+	taskman->run(*i);
+    WVPASSEQ(glob, 1);
+    for (i.rewind(); i.next(); )
+    {
+	while (i->isrunning())
+	    taskman->run(*i);
+	i->recycle();
+    }
+    WVPASSEQ(glob, 3);
+    
+    WvTaskMan::set_release_stacks(false);
+    taskman->unlink();
+}
+
 #ifdef TASKTEST_IS_CONVERTED
 WVTEST_MAIN("tasktest.cc")
 {
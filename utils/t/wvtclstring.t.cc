@@ -371,3 +371,41 @@ WVTEST_MAIN("wvtcl_getword comprehensive nounescape")
     
     fprintf(stderr, "\n");
 }
+
+
+static WvString head(WvStringParm s, size_t n)
+{
+    WvString result(s);
+    result.edit()[n] = '\0';
+    return result;
+}
+
+
+WVTEST_MAIN("long strings")
+{
+    // long enough that the nasty bits land in different parts of the
+    // blocks that get scanned in bulk
+    WvString plain("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789");
+    WVPASSEQ(wvtcl_escape(plain), plain);
+    WVPASSEQ(wvtcl_unescape(plain), plain);
+    
+    for (size_t i = 0; i < plain.len(); i++)
+    {
+        WvString s(plain);
+        s.edit()[i] = ' ';
+        WVPASSEQ(wvtcl_escape(s), WvString("{%s}", s));
+        WVPASSEQ(wvtcl_unescape(wvtcl_escape(s)), s);
+        
+        s.edit()[i] = '}';
+        WvString bs("%s\\}%s", head(plain, i), plain.cstr() + i + 1);
+        WVPASSEQ(wvtcl_escape(s), bs);
+        WVPASSEQ(wvtcl_unescape(bs), s);
+        
+        if (i == 0)
+            continue; // leading separators get skipped
+        WvDynBuf buf;
+        buf.putstr(WvString("%s %s", head(plain, i), plain.cstr() + i + 1));
+        WVPASSEQ(wvtcl_getword(buf), head(plain, i));
+        WVPASSEQ(wvtcl_getword(buf), plain.cstr() + i + 1);
+    }
+}
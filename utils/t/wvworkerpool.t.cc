@@ -0,0 +1,168 @@
+#include "wvtest.h"
+#include "wvworkerpool.h"
+#include <sys/time.h>
+#include <unistd.h>
+
+class SleepyJob : public WvWorkerJob
+{
+public:
+    int msec;
+    bool *ran;
+
+    SleepyJob(int _msec, bool *_ran = NULL) : msec(_msec), ran(_ran) { }
+    virtual void run()
+    {
+	usleep(msec * 1000);
+	if (ran)
+	    *ran = true;
+    }
+};
+
+
+// Blocks until 'want' of these are running at once, or a second passes.
+class GateJob : public WvWorkerJob
+{
+public:
+    static pthread_mutex_t lock;
+    static pthread_cond_t cond;
+    static int running, want;
+    bool met;
+
+    GateJob() : met(false) { }
+    virtual void run()
+    {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	struct timespec until = { now.tv_sec + 1, now.tv_usec * 1000 };
+
+	pthread_mutex_lock(&lock);
+	running++;
+	pthread_cond_broadcast(&cond);
+	while (running < want)
+	    if (pthread_cond_timedwait(&cond, &lock, &until))
+		break;
+	met = running >= want;
+	pthread_mutex_unlock(&lock);
+    }
+
+    // waits until at least 'n' have started
+    static void wait_running(int n)
+    {
+	pthread_mutex_lock(&lock);
+	while (running < n)
+	    pthread_cond_wait(&cond, &lock);
+	pthread_mutex_unlock(&lock);
+    }
+
+    // lets everyone who's running go
+    static void release()
+    {
+	pthread_mutex_lock(&lock);
+	want = 0;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+    }
+};
+
+pthread_mutex_t GateJob::lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t GateJob::cond = PTHREAD_COND_INITIALIZER;
+int GateJob::running = 0, GateJob::want = 0;
+
+
+WVTEST_MAIN("worker pool")
+{
+    static WvWorkerPool pool(2); // threads might outlive this function
+    WVPASSEQ(pool.getfd(), -1);
+    WVPASS(pool.open());
+    int fd = pool.getfd();
+    WVPASS(fd >= 0);
+
+    bool ran[4] = { false, false, false, false };
+    SleepyJob *jobs[4];
+    for (int i = 0; i < 4; i++)
+    {
+	jobs[i] = new SleepyJob(50, &ran[i]);
+	WVPASS(pool.submit(jobs[i]));
+    }
+    WVFAIL(pool.finished(jobs[3]));
+
+    // the pipe says when something's done
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    struct timeval tv = { 5, 0 };
+    WVPASSEQ(select(fd + 1, &rfds, NULL, NULL, &tv), 1);
+
+    for (int i = 0; i < 4; i++)
+    {
+	pool.wait(jobs[i]);
+	WVPASS(pool.finished(jobs[i]));
+	WVPASS(ran[i]);
+	delete jobs[i];
+    }
+    WVPASSEQ(pool.jobs_run(), 4);
+
+    // nobody's waiting for these anymore: the busy one gets deleted by
+    // its thread once it's done, and the rest right away
+    GateJob::running = 0;
+    GateJob::want = 100; // never, until release()
+    WvWorkerJob *late[4];
+    late[0] = new GateJob;
+    WVPASS(pool.submit(late[0]));
+    GateJob::wait_running(1);
+    for (int i = 1; i < 4; i++)
+    {
+	late[i] = new SleepyJob(0);
+	WVPASS(pool.submit(late[i]));
+    }
+    for (int i = 3; i >= 0; i--)
+	pool.abandon(late[i]);
+
+    pool.close();
+    WVPASSEQ(pool.getfd(), fd); // until the busy thread finishes
+    GateJob::release();
+    for (int i = 0; i < 100 && pool.getfd() >= 0; i++)
+	usleep(10000);
+    WVPASSEQ(pool.getfd(), -1);
+}
+
+
+WVTEST_MAIN("worker pool burst")
+{
+    static WvWorkerPool pool(3);
+    WVPASS(pool.open());
+
+    // leave one thread idle
+    SleepyJob first(0);
+    WVPASS(pool.submit(&first));
+    pool.wait(&first);
+    WVPASS(pool.finished(&first));
+    usleep(10000);
+
+    // submitted all at once, before that thread wakes up: they still
+    // each need a thread of their own.
+    GateJob::running = 0;
+    GateJob::want = 3;
+    GateJob jobs[3];
+    for (int i = 0; i < 3; i++)
+	WVPASS(pool.submit(&jobs[i]));
+    for (int i = 0; i < 3; i++)
+    {
+	pool.wait(&jobs[i]);
+	WVPASS(pool.isdone(&jobs[i]));
+	WVPASS(jobs[i].met);
+    }
+
+    // isdone() leaves the wakeup in the pipe for whoever else needs it
+    int fd = pool.getfd();
+    fd_set rfds;
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    struct timeval tv = { 0, 0 };
+    WVPASSEQ(select(fd + 1, &rfds, NULL, NULL, &tv), 1);
+    WVPASS(pool.finished(&jobs[0]));
+    FD_ZERO(&rfds);
+    FD_SET(fd, &rfds);
+    WVPASSEQ(select(fd + 1, &rfds, NULL, NULL, &tv), 0);
+    pool.close();
+}
@@ -13,6 +13,12 @@
  * combinations.  The '=' (100000) is padding and has no value when decoded.
  */
 #include "wvbase64.h"
+#include "wvsimd.h"
+#include <string.h>
+
+#ifdef WVSIMD_X86
+# include <immintrin.h>
+#endif
 
 // maps codes to the Base64 alphabet
 static char alphabet[67] =
@@ -39,6 +45,278 @@ static int lookup(char ch)
     return -1;
 }
 
+// lookup() for every possible byte, for the block decoder
+static struct Base64Table
+{
+    signed char code[256];
+
+    Base64Table()
+    {
+        for (int i = 0; i < 256; i++)
+            code[i] = lookup(i);
+    }
+} table;
+
+
+/***** Block kernels *****/
+
+// These convert whole groups (3 bytes <-> 4 symbols) at a time from one
+// contiguous chunk of memory to another, and leave the odd bits at the
+// ends to the state machines below.
+
+static void encode_blocks(char *dst, const unsigned char *src, size_t groups)
+{
+    for (; groups; groups--, src += 3, dst += 4)
+    {
+        unsigned int bits = (src[0] << 16) | (src[1] << 8) | src[2];
+        dst[0] = alphabet[bits >> 18];
+        dst[1] = alphabet[(bits >> 12) & 0x3f];
+        dst[2] = alphabet[(bits >> 6) & 0x3f];
+        dst[3] = alphabet[bits & 0x3f];
+    }
+}
+
+
+// returns the number of groups decoded, which is less than 'groups' if
+// padding, whitespace or garbage turned up.
+static size_t decode_blocks(unsigned char *dst, const unsigned char *src,
+                            size_t groups)
+{
+    size_t done;
+    for (done = 0; done < groups; done++, src += 4, dst += 3)
+    {
+        int a = table.code[src[0]], b = table.code[src[1]],
+            c = table.code[src[2]], d = table.code[src[3]];
+        // all valid symbols are < 64; anything else has bit 6 set or is -1
+        if ((a | b | c | d) & ~0x3f)
+            break;
+        unsigned int bits = (a << 18) | (b << 12) | (c << 6) | d;
+        dst[0] = bits >> 16;
+        dst[1] = bits >> 8;
+        dst[2] = bits;
+    }
+    return done;
+}
+
+
+#ifdef WVSIMD_X86
+
+// 12 bytes in, 16 symbols out per step.  Needs 16 readable input bytes.
+__attribute__((target("ssse3")))
+static size_t encode_blocks_ssse3(char *dst, const unsigned char *src,
+                                  size_t groups)
+{
+    size_t done = 0;
+    for (; done + 6 <= groups; done += 4, src += 12, dst += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)src);
+
+        // spread each 3 bytes over 4, then move the 6-bit fields into
+        // place (see Wojciech Mula's base64 notes for how this works)
+        in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                               4, 5, 3, 4, 1, 2, 0, 1));
+        __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+        __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+        __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        __m128i codes = _mm_or_si128(t1, t3);
+
+        // turn 0..63 into the alphabet by adding a per-range offset
+        __m128i range = _mm_subs_epu8(codes, _mm_set1_epi8(51));
+        __m128i caps = _mm_cmpgt_epi8(_mm_set1_epi8(26), codes);
+        range = _mm_or_si128(range, _mm_and_si128(caps, _mm_set1_epi8(13)));
+        __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+        __m128i out = _mm_add_epi8(codes, _mm_shuffle_epi8(offsets, range));
+
+        _mm_storeu_si128((__m128i *)dst, out);
+    }
+    encode_blocks(dst, src, groups - done);
+    return groups;
+}
+
+
+// 16 symbols in, 12 bytes out per step.  Stops at the first group that
+// has anything but plain symbols in it, like decode_blocks().
+__attribute__((target("ssse3")))
+static size_t decode_blocks_ssse3(unsigned char *dst, const unsigned char *src,
+                                  size_t groups)
+{
+    size_t done = 0;
+    for (; done + 4 <= groups; done += 4, src += 16, dst += 12)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)src);
+
+#define RANGE(lo, hi) _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8(lo - 1)), \
+                                    _mm_cmpgt_epi8(_mm_set1_epi8(hi + 1), in))
+        __m128i upper = RANGE('A', 'Z');
+        __m128i lower = RANGE('a', 'z');
+        __m128i digit = RANGE('0', '9');
+#undef RANGE
+        __m128i plus = _mm_cmpeq_epi8(in, _mm_set1_epi8('+'));
+        __m128i slash = _mm_cmpeq_epi8(in, _mm_set1_epi8('/'));
+
+        __m128i valid = _mm_or_si128(_mm_or_si128(upper, lower),
+                          _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+        if (_mm_movemask_epi8(valid) != 0xffff)
+            break;
+
+        __m128i shift = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-'A')),
+                         _mm_and_si128(lower, _mm_set1_epi8(26 - 'a'))),
+            _mm_or_si128(_mm_and_si128(digit, _mm_set1_epi8(52 - '0')),
+                _mm_or_si128(_mm_and_si128(plus, _mm_set1_epi8(62 - '+')),
+                         _mm_and_si128(slash, _mm_set1_epi8(63 - '/')))));
+        __m128i codes = _mm_add_epi8(in, shift);
+
+        // pack four 6-bit codes into each 24-bit group, then squeeze out
+        // the gaps between groups
+        __m128i pairs = _mm_maddubs_epi16(codes, _mm_set1_epi32(0x01400140));
+        __m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+        __m128i out = _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4,
+                            10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+        unsigned char tmp[16];
+        _mm_storeu_si128((__m128i *)tmp, out);
+        memcpy(dst, tmp, 12);
+    }
+    return done + decode_blocks(dst, src, groups - done);
+}
+
+
+// The AVX2 versions do the same as the SSSE3 ones, on two groups of 12
+// bytes or 16 symbols at once, one in each 128-bit lane.
+
+// 24 bytes in, 32 symbols out per step.  Needs 28 readable input bytes.
+__attribute__((target("avx2")))
+static size_t encode_blocks_avx2(char *dst, const unsigned char *src,
+                                 size_t groups)
+{
+    size_t done = 0;
+    for (; done + 10 <= groups; done += 8, src += 24, dst += 32)
+    {
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(
+                _mm_loadu_si128((const __m128i *)src)),
+            _mm_loadu_si128((const __m128i *)(src + 12)), 1);
+
+        in = _mm256_shuffle_epi8(in, _mm256_set_epi8(
+                10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        __m256i codes = _mm256_or_si256(t1, t3);
+
+        __m256i range = _mm256_subs_epu8(codes, _mm256_set1_epi8(51));
+        __m256i caps = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), codes);
+        range = _mm256_or_si256(range,
+                    _mm256_and_si256(caps, _mm256_set1_epi8(13)));
+        __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+            'a' - 26, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+            '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+        __m256i out = _mm256_add_epi8(codes,
+                                      _mm256_shuffle_epi8(offsets, range));
+
+        _mm256_storeu_si256((__m256i *)dst, out);
+    }
+    return done + encode_blocks_ssse3(dst, src, groups - done);
+}
+
+
+// 32 symbols in, 24 bytes out per step.
+__attribute__((target("avx2")))
+static size_t decode_blocks_avx2(unsigned char *dst, const unsigned char *src,
+                                 size_t groups)
+{
+    size_t done = 0;
+    for (; done + 8 <= groups; done += 8, src += 32, dst += 24)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i *)src);
+
+#define RANGE(lo, hi) _mm256_and_si256( \
+            _mm256_cmpgt_epi8(in, _mm256_set1_epi8(lo - 1)), \
+            _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), in))
+        __m256i upper = RANGE('A', 'Z');
+        __m256i lower = RANGE('a', 'z');
+        __m256i digit = RANGE('0', '9');
+#undef RANGE
+        __m256i plus = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('+'));
+        __m256i slash = _mm256_cmpeq_epi8(in, _mm256_set1_epi8('/'));
+
+        __m256i valid = _mm256_or_si256(_mm256_or_si256(upper, lower),
+                          _mm256_or_si256(digit, _mm256_or_si256(plus, slash)));
+        if (_mm256_movemask_epi8(valid) != -1)
+            break;
+
+        __m256i shift = _mm256_or_si256(
+            _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-'A')),
+                _mm256_and_si256(lower, _mm256_set1_epi8(26 - 'a'))),
+            _mm256_or_si256(_mm256_and_si256(digit, _mm256_set1_epi8(52 - '0')),
+                _mm256_or_si256(
+                    _mm256_and_si256(plus, _mm256_set1_epi8(62 - '+')),
+                    _mm256_and_si256(slash, _mm256_set1_epi8(63 - '/')))));
+        __m256i codes = _mm256_add_epi8(in, shift);
+
+        __m256i pairs = _mm256_maddubs_epi16(codes,
+                                             _mm256_set1_epi32(0x01400140));
+        __m256i words = _mm256_madd_epi16(pairs,
+                                          _mm256_set1_epi32(0x00011000));
+        __m256i out = _mm256_shuffle_epi8(words, _mm256_setr_epi8(
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+        unsigned char tmp[32];
+        _mm256_storeu_si256((__m256i *)tmp, out);
+        memcpy(dst, tmp, 12);
+        memcpy(dst + 12, tmp + 16, 12);
+    }
+    return done + decode_blocks_ssse3(dst, src, groups - done);
+}
+
+#endif // WVSIMD_X86
+
+
+static void encode_run(char *dst, const unsigned char *src, size_t groups)
+{
+#ifdef WVSIMD_X86
+    switch (wvsimd_level())
+    {
+    case WVSIMD_AVX2:
+        encode_blocks_avx2(dst, src, groups);
+        return;
+    case WVSIMD_SSSE3:
+        encode_blocks_ssse3(dst, src, groups);
+        return;
+    default:
+        break;
+    }
+#endif
+    encode_blocks(dst, src, groups);
+}
+
+
+static size_t decode_run(unsigned char *dst, const unsigned char *src,
+                         size_t groups)
+{
+#ifdef WVSIMD_X86
+    switch (wvsimd_level())
+    {
+    case WVSIMD_AVX2:
+        return decode_blocks_avx2(dst, src, groups);
+    case WVSIMD_SSSE3:
+        return decode_blocks_ssse3(dst, src, groups);
+    default:
+        break;
+    }
+#endif
+    return decode_blocks(dst, src, groups);
+}
+
 
 /***** WvBase64Encoder *****/
 
@@ -61,6 +339,21 @@ bool WvBase64Encoder::_encode(WvBuf &in, WvBuf &out, bool flush)
     // base 64 encode the entire buffer
     while (in.used() != 0)
     {
+        // do as many whole groups as we can in one go
+        if (state == ATBIT0)
+        {
+            size_t len = in.optgettable();
+            size_t groups = len / 3;
+            if (groups > out.free() / 4)
+                groups = out.free() / 4;
+            if (groups)
+            {
+                const unsigned char *src = in.get(groups * 3);
+                encode_run((char *)out.alloc(groups * 4), src, groups);
+                continue;
+            }
+        }
+
         unsigned char next = in.getch();
         bits = (bits << 8) | next;
         switch (state)
@@ -133,6 +426,26 @@ bool WvBase64Decoder::_encode(WvBuf &in, WvBuf &out, bool flush)
     // base 64 decode the entire buffer
     while (in.used() != 0)
     {
+        // do as many whole groups as we can in one go, until we hit
+        // whitespace or padding
+        if (state == ATBIT0)
+        {
+            size_t len = in.optgettable();
+            size_t groups = len / 4;
+            if (groups > out.free() / 3)
+                groups = out.free() / 3;
+            if (groups)
+            {
+                const unsigned char *src = in.get(groups * 4);
+                unsigned char *dst = out.alloc(groups * 3);
+                size_t done = decode_run(dst, src, groups);
+                out.unalloc((groups - done) * 3);
+                in.unget((groups - done) * 4);
+                if (done)
+                    continue;
+            }
+        }
+
         unsigned char next = in.getch();
         int symbol = lookup(next);
         switch (symbol)
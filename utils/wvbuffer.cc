@@ -5,6 +5,7 @@
  * Specializations of the generic buffering API.
  */
 #include "wvbuf.h"
+#include <string.h>
 
 /***** Specialization for raw memory buffers *****/
 
@@ -43,17 +44,17 @@ WvString WvBufBase<unsigned char>::getstr(size_t len)
 }
 
 
-size_t WvBufBase<unsigned char>::strchr(int ch)
+size_t WvBufBase<unsigned char>::strchr(int ch, size_t start)
 {
-    size_t offset = 0;
+    size_t offset = start;
     size_t avail = used();
     while (offset < avail)
     {
         size_t len = optpeekable(offset);
         const unsigned char *str = peek(offset, len);
-        for (size_t i = 0; i < len; ++i)
-            if (str[i] == ch)
-                return offset + i + 1;
+        const void *found = memchr(str, ch, len);
+        if (found)
+            return offset + ((const unsigned char *)found - str) + 1;
         offset += len;
     }
     return 0;
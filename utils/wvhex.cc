@@ -5,7 +5,13 @@
  * Hex encoder and decoder.
  */
 #include "wvhex.h"
+#include "wvsimd.h"
 #include <ctype.h>
+#include <string.h>
+
+#ifdef WVSIMD_X86
+# include <immintrin.h>
+#endif
 
 
 static inline char tohex(int digit, char alphabase)
@@ -22,6 +28,231 @@ static inline int fromhex(char digit)
     return digit - 'a' + 10;
 }
 
+// fromhex() for every possible byte, or -1 if it isn't a hex digit
+static struct HexTable
+{
+    signed char value[256];
+
+    HexTable()
+    {
+        for (int i = 0; i < 256; i++)
+            value[i] = isxdigit(i) ? fromhex(i) : -1;
+    }
+} table;
+
+
+/***** Block kernels *****/
+
+// Whole runs of bytes to digit pairs and back, from one contiguous chunk
+// of memory to another.
+
+static void encode_blocks(unsigned char *dst, const unsigned char *src,
+                          size_t len, const char *digits)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        *dst++ = digits[src[i] >> 4];
+        *dst++ = digits[src[i] & 15];
+    }
+}
+
+
+// returns the number of bytes decoded, which is less than 'len' if
+// something that isn't a pair of hex digits turned up.
+static size_t decode_blocks(unsigned char *dst, const unsigned char *src,
+                            size_t len)
+{
+    size_t done;
+    for (done = 0; done < len; done++, src += 2)
+    {
+        int hi = table.value[src[0]], lo = table.value[src[1]];
+        if ((hi | lo) < 0)
+            break;
+        dst[done] = hi << 4 | lo;
+    }
+    return done;
+}
+
+
+#ifdef WVSIMD_X86
+
+// Each nibble picks its digit out of the 16-entry table with a shuffle.
+
+// 16 bytes in, 32 digits out per step.
+__attribute__((target("ssse3")))
+static void encode_blocks_ssse3(unsigned char *dst, const unsigned char *src,
+                                size_t len, const char *digits)
+{
+    __m128i table = _mm_loadu_si128((const __m128i *)digits);
+    __m128i mask = _mm_set1_epi8(15);
+    size_t done = 0;
+    for (; done + 16 <= len; done += 16, src += 16, dst += 32)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)src);
+        __m128i hi = _mm_shuffle_epi8(table,
+                        _mm_and_si128(_mm_srli_epi16(in, 4), mask));
+        __m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(in, mask));
+        _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+    }
+    encode_blocks(dst, src, len - done, digits);
+}
+
+
+// Turns 16 digits into their values, or returns false if any of them
+// isn't a digit.  Lowercasing the letters lets one range check do both
+// cases.
+__attribute__((target("ssse3")))
+static inline bool digit_values_ssse3(__m128i in, __m128i &val)
+{
+    __m128i dec = _mm_sub_epi8(in, _mm_set1_epi8('0'));
+    __m128i isdec = _mm_cmpeq_epi8(_mm_min_epu8(dec, _mm_set1_epi8(9)), dec);
+    __m128i alpha = _mm_sub_epi8(_mm_or_si128(in, _mm_set1_epi8(0x20)),
+                                 _mm_set1_epi8('a'));
+    __m128i isalpha = _mm_cmpeq_epi8(
+        _mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+    if (_mm_movemask_epi8(_mm_or_si128(isdec, isalpha)) != 0xffff)
+        return false;
+    val = _mm_or_si128(_mm_and_si128(isdec, dec),
+        _mm_and_si128(isalpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+    return true;
+}
+
+
+// 32 digits in, 16 bytes out per step.
+__attribute__((target("ssse3")))
+static size_t decode_blocks_ssse3(unsigned char *dst, const unsigned char *src,
+                                  size_t len)
+{
+    size_t done = 0;
+    for (; done + 16 <= len; done += 16, src += 32, dst += 16)
+    {
+        __m128i v0, v1;
+        if (!digit_values_ssse3(_mm_loadu_si128((const __m128i *)src), v0)
+            || !digit_values_ssse3(
+                _mm_loadu_si128((const __m128i *)(src + 16)), v1))
+            break;
+        // each pair of digits becomes hi * 16 + lo
+        __m128i mul = _mm_set1_epi16(0x0110);
+        __m128i out = _mm_packus_epi16(_mm_maddubs_epi16(v0, mul),
+                                       _mm_maddubs_epi16(v1, mul));
+        _mm_storeu_si128((__m128i *)dst, out);
+    }
+    return done + decode_blocks(dst, src, len - done);
+}
+
+
+// The AVX2 versions do the same on twice as much at a time.  Unpacking and
+// packing work within 128-bit lanes, so the results get put back in order
+// afterwards.
+
+// 32 bytes in, 64 digits out per step.
+__attribute__((target("avx2")))
+static void encode_blocks_avx2(unsigned char *dst, const unsigned char *src,
+                               size_t len, const char *digits)
+{
+    __m256i table = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)digits));
+    __m256i mask = _mm256_set1_epi8(15);
+    size_t done = 0;
+    for (; done + 32 <= len; done += 32, src += 32, dst += 64)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i *)src);
+        __m256i hi = _mm256_shuffle_epi8(table,
+                        _mm256_and_si256(_mm256_srli_epi16(in, 4), mask));
+        __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(in, mask));
+        __m256i a = _mm256_unpacklo_epi8(hi, lo), b = _mm256_unpackhi_epi8(hi, lo);
+        _mm256_storeu_si256((__m256i *)dst,
+                            _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + 32),
+                            _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    encode_blocks_ssse3(dst, src, len - done, digits);
+}
+
+
+__attribute__((target("avx2")))
+static inline bool digit_values_avx2(__m256i in, __m256i &val)
+{
+    __m256i dec = _mm256_sub_epi8(in, _mm256_set1_epi8('0'));
+    __m256i isdec = _mm256_cmpeq_epi8(
+        _mm256_min_epu8(dec, _mm256_set1_epi8(9)), dec);
+    __m256i alpha = _mm256_sub_epi8(
+        _mm256_or_si256(in, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i isalpha = _mm256_cmpeq_epi8(
+        _mm256_min_epu8(alpha, _mm256_set1_epi8(5)), alpha);
+    if (_mm256_movemask_epi8(_mm256_or_si256(isdec, isalpha)) != -1)
+        return false;
+    val = _mm256_or_si256(_mm256_and_si256(isdec, dec),
+        _mm256_and_si256(isalpha,
+                         _mm256_add_epi8(alpha, _mm256_set1_epi8(10))));
+    return true;
+}
+
+
+// 64 digits in, 32 bytes out per step.
+__attribute__((target("avx2")))
+static size_t decode_blocks_avx2(unsigned char *dst, const unsigned char *src,
+                                 size_t len)
+{
+    size_t done = 0;
+    for (; done + 32 <= len; done += 32, src += 64, dst += 32)
+    {
+        __m256i v0, v1;
+        if (!digit_values_avx2(_mm256_loadu_si256((const __m256i *)src), v0)
+            || !digit_values_avx2(
+                _mm256_loadu_si256((const __m256i *)(src + 32)), v1))
+            break;
+        __m256i mul = _mm256_set1_epi16(0x0110);
+        __m256i out = _mm256_packus_epi16(_mm256_maddubs_epi16(v0, mul),
+                                          _mm256_maddubs_epi16(v1, mul));
+        _mm256_storeu_si256((__m256i *)dst,
+                            _mm256_permute4x64_epi64(out, 0xd8));
+    }
+    return done + decode_blocks_ssse3(dst, src, len - done);
+}
+
+#endif // WVSIMD_X86
+
+
+static void encode_run(unsigned char *dst, const unsigned char *src,
+                       size_t len, const char *digits)
+{
+#ifdef WVSIMD_X86
+    switch (wvsimd_level())
+    {
+    case WVSIMD_AVX2:
+        encode_blocks_avx2(dst, src, len, digits);
+        return;
+    case WVSIMD_SSSE3:
+        encode_blocks_ssse3(dst, src, len, digits);
+        return;
+    default:
+        break;
+    }
+#endif
+    encode_blocks(dst, src, len, digits);
+}
+
+
+static size_t decode_run(unsigned char *dst, const unsigned char *src,
+                         size_t len)
+{
+#ifdef WVSIMD_X86
+    switch (wvsimd_level())
+    {
+    case WVSIMD_AVX2:
+        return decode_blocks_avx2(dst, src, len);
+    case WVSIMD_SSSE3:
+        return decode_blocks_ssse3(dst, src, len);
+    default:
+        break;
+    }
+#endif
+    return decode_blocks(dst, src, len);
+}
+
+
 /***** WvHexEncoder *****/
 
 WvHexEncoder::WvHexEncoder(bool use_uppercase) 
@@ -39,11 +270,20 @@ bool WvHexEncoder::_reset()
 
 bool WvHexEncoder::_encode(WvBuf &in, WvBuf &out, bool flush)
 {
+    char digits[16];
+    for (int i = 0; i < 16; i++)
+        digits[i] = tohex(i, alphabase);
+
+    // convert a contiguous chunk at a time
     while (in.used() != 0)
     {
-        unsigned char byte = in.getch();
-        out.putch(tohex(byte >> 4, alphabase));
-        out.putch(tohex(byte & 15, alphabase));
+        size_t len = in.optgettable();
+        if (len > out.free() / 2)
+            len = out.free() / 2;
+        if (!len)
+            len = 1; // let the buffer complain
+        const unsigned char *src = in.get(len);
+        encode_run(out.alloc(len * 2), src, len, digits);
     }
     return true;
 }
@@ -69,6 +309,25 @@ bool WvHexDecoder::_encode(WvBuf &in, WvBuf &out, bool flush)
 {
     while (in.used() != 0)
     {
+        // convert whole pairs of digits in one go, until we hit something
+        // that isn't one
+        if (!issecond)
+        {
+            size_t len = in.optgettable() / 2;
+            if (len > out.free())
+                len = out.free();
+            if (len)
+            {
+                const unsigned char *src = in.get(len * 2);
+                unsigned char *dst = out.alloc(len);
+                size_t done = decode_run(dst, src, len);
+                out.unalloc(len - done);
+                in.unget((len - done) * 2);
+                if (done)
+                    continue;
+            }
+        }
+
         char ch = (char) in.getch();
         if (isxdigit(ch))
         {
@@ -0,0 +1,136 @@
+/*
+ * Worldvisions Weaver Software:
+ *   Copyright (C) 1997-2002 Net Integration Technologies, Inc.
+ *
+ * Turns log files written by WvLogBinary back into the usual text format,
+ * optionally keeping only some sources or levels.
+ *
+ * Give the rotated files oldest first, eg.
+ *     wvlogdecode debug.wvlog.2 debug.wvlog.1 debug.wvlog
+ */
+#include "wvargs.h"
+#include "wvlogbinary.h"
+#include "wvlogrcv.h"
+#include "wvstrutils.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static int max_level = WvLog::NUM_LOGLEVELS;
+static WvString source_match;
+static bool show_usec = false;
+
+// the line we're in the middle of, if any
+static WvString cur_source;
+static int cur_level = -1;
+static bool at_newline = true;
+
+
+static void end_line()
+{
+    if (!at_newline)
+	fputc('\n', stdout);
+    at_newline = true;
+}
+
+
+static void begin_line(const struct timeval &when)
+{
+    if (!at_newline)
+	return;
+
+    char timestr[40];
+    time_t sec = when.tv_sec;
+    strftime(timestr, sizeof(timestr), "%b %d %H:%M:%S", localtime(&sec));
+    if (show_usec)
+	printf("%s.%06ld", timestr, (long)when.tv_usec);
+    else
+	fputs(timestr, stdout);
+    strftime(timestr, sizeof(timestr), " %Z", localtime(&sec));
+    printf("%s: %s<%s>: ", timestr, cur_source.cstr(),
+	   WvLogRcv::loglevels[cur_level]);
+    at_newline = false;
+}
+
+
+// the same escaping as WvLogRcv::log()
+static void print_message(const WvLogBinaryReader &r)
+{
+    if (r.source != cur_source || r.level != cur_level)
+    {
+	end_line();
+	cur_source = r.source;
+	cur_level = r.level;
+    }
+
+    const unsigned char *cptr = (const unsigned char *)r.text,
+	*end = cptr + r.len;
+    for (; cptr < end; cptr++)
+    {
+	if (*cptr == '\n' || *cptr == '\r')
+	{
+	    end_line();
+	    continue;
+	}
+	begin_line(r.when);
+	if (*cptr == '\t')
+	    fputc(' ', stdout);
+	else if (isprint(*cptr) || *cptr >= 128)
+	    fputc(*cptr, stdout);
+	else
+	    printf("[%02x]", *cptr);
+    }
+}
+
+
+static bool wanted(const WvLogBinaryReader &r)
+{
+    if (r.level > max_level)
+	return false;
+    if (!source_match)
+	return true;
+    WvString lower(r.source);
+    strlwr(lower.edit());
+    return strstr(lower, source_match) != NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+    WvArgs args;
+    args.set_version("wvlogdecode");
+    args.add_option('l', "level", "Only show messages up to this level "
+		    "(0=Critical ... 9=Debug5)", "LEVEL", max_level);
+    args.add_option('s', "source", "Only show sources whose names contain "
+		    "this (case insensitive)", "NAME", source_match);
+    args.add_set_bool_option('u', "usec", "Show microseconds", show_usec);
+    args.add_required_arg("FILE", true);
+
+    WvStringList files;
+    if (!args.process(argc, argv, &files))
+	return 1;
+    if (!!source_match)
+	strlwr(source_match.edit());
+
+    int ret = 0;
+    WvStringList::Iter i(files);
+    for (i.rewind(); i.next(); )
+    {
+	WvLogBinaryReader r(*i);
+	if (!r.isok())
+	{
+	    end_line();
+	    fprintf(stderr, "wvlogdecode: %s: not a binary log file\n",
+		    i->cstr());
+	    ret = 1;
+	    continue;
+	}
+	while (r.next())
+	    if (wanted(r))
+		print_message(r);
+    }
+    end_line();
+
+    return ret;
+}
@@ -0,0 +1,32 @@
+/*
+ * Worldvisions Weaver Software:
+ *   Copyright (C) 1997-2002 Net Integration Technologies, Inc.
+ *
+ * Run-time selection between the plain and SIMD versions of inner loops.
+ */
+#include "wvsimd.h"
+
+static int cpu_level = -1, max_level = WVSIMD_AVX2;
+
+
+WvSimdLevel wvsimd_level()
+{
+    if (cpu_level < 0)
+    {
+	cpu_level = WVSIMD_NONE;
+#ifdef WVSIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	    cpu_level = WVSIMD_AVX2;
+	else if (__builtin_cpu_supports("ssse3"))
+	    cpu_level = WVSIMD_SSSE3;
+#endif
+    }
+    return (WvSimdLevel)(cpu_level < max_level ? cpu_level : max_level);
+}
+
+
+void wvsimd_limit(WvSimdLevel max)
+{
+    max_level = max;
+}
@@ -31,6 +31,7 @@ char *alloca ();
 #include "wvtask.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <sys/mman.h>
 #include <signal.h>
@@ -59,11 +60,16 @@ int WvTask::taskcount, WvTask::numtasks, WvTask::numrunning;
 
 WvTaskMan *WvTaskMan::singleton;
 int WvTaskMan::links, WvTaskMan::magic_number;
-WvTaskList WvTaskMan::all_tasks, WvTaskMan::free_tasks;
+WvTaskList WvTaskMan::all_tasks,
+    WvTaskMan::free_tasks[WvTaskMan::NUM_STACK_CLASSES];
+bool WvTaskMan::release_stacks = false;
+size_t WvTaskMan::stack_bytes, WvTaskMan::stacks_reused,
+    WvTaskMan::stacks_released;
 ucontext_t WvTaskMan::stackmaster_task, WvTaskMan::get_stack_return,
     WvTaskMan::toplevel;
 WvTask *WvTaskMan::current_task, *WvTaskMan::stack_target;
 char *WvTaskMan::stacktop;
+void *WvTaskMan::toplevel_sp;
 
 static int context_return;
 
@@ -74,6 +80,161 @@ static bool use_shared_stack()
 }
 
 
+/***** Fast context switching *****/
+
+// getcontext() and setcontext() save and restore the signal mask, which
+// costs a system call each time.  Tasks don't change their signal masks,
+// so where we know how, we switch tasks by just saving the callee-saved
+// registers on the old stack and popping them off the new one.  Define
+// WVTASK_NO_FAST_SWITCH to always use ucontext instead.
+#if !defined(WVTASK_NO_FAST_SWITCH) && defined(__GNUC__) && defined(__ELF__) \
+    && (defined(__x86_64__) || defined(__aarch64__))
+# define WVTASK_FAST_SWITCH 1
+
+// Saves the registers on the current stack, stores the stack pointer in
+// *save_sp, and resumes whatever was saved at new_sp.
+extern "C" void wvtask_switch(void **save_sp, void *new_sp);
+
+// The first thing a new task runs: calls the function in the second
+// saved register with the argument in the first.  Never returns.
+extern "C" void wvtask_start();
+
+#if defined(__x86_64__)
+__asm__(
+    ".pushsection .text\n"
+    ".globl wvtask_switch\n"
+    ".hidden wvtask_switch\n"
+    ".type wvtask_switch, @function\n"
+    "wvtask_switch:\n"
+    "	pushq %rbp\n"
+    "	pushq %rbx\n"
+    "	pushq %r12\n"
+    "	pushq %r13\n"
+    "	pushq %r14\n"
+    "	pushq %r15\n"
+    "	subq $8, %rsp\n"
+    "	stmxcsr (%rsp)\n"
+    "	fnstcw 4(%rsp)\n"
+    "	movq %rsp, (%rdi)\n"
+    "	movq %rsi, %rsp\n"
+    "	ldmxcsr (%rsp)\n"
+    "	fldcw 4(%rsp)\n"
+    "	addq $8, %rsp\n"
+    "	popq %r15\n"
+    "	popq %r14\n"
+    "	popq %r13\n"
+    "	popq %r12\n"
+    "	popq %rbx\n"
+    "	popq %rbp\n"
+    "	ret\n"
+    ".size wvtask_switch, .-wvtask_switch\n"
+    "\n"
+    ".globl wvtask_start\n"
+    ".hidden wvtask_start\n"
+    ".type wvtask_start, @function\n"
+    "wvtask_start:\n"
+    "	movq %r12, %rdi\n"
+    "	callq *%r13\n"
+    "	ud2\n"
+    ".size wvtask_start, .-wvtask_start\n"
+    ".popsection\n"
+);
+
+// Lays out a new stack so that wvtask_switch() to it "returns" into
+// wvtask_start(), which calls func(arg).  Returns the new stack pointer.
+static void *wvtask_init_stack(void *stack, size_t size,
+			       void (*func)(WvTask *), WvTask *arg)
+{
+    unsigned long top = ((unsigned long)stack + size) & ~15UL;
+    unsigned long *sp = (unsigned long *)(top - 8);
+    *sp-- = (unsigned long)wvtask_start; // return address
+    *sp-- = 0;				// rbp
+    *sp-- = 0;				// rbx
+    *sp-- = (unsigned long)arg;		// r12
+    *sp-- = (unsigned long)func;	// r13
+    *sp-- = 0;				// r14
+    *sp = 0;				// r15
+    sp--;
+    // the default floating point control words
+    ((unsigned int *)sp)[0] = 0x1f80;	// mxcsr
+    ((unsigned int *)sp)[1] = 0x037f;	// x87 control word
+    return sp;
+}
+
+#elif defined(__aarch64__)
+__asm__(
+    ".pushsection .text\n"
+    ".globl wvtask_switch\n"
+    ".hidden wvtask_switch\n"
+    ".type wvtask_switch, %function\n"
+    "wvtask_switch:\n"
+    "	sub sp, sp, #160\n"
+    "	stp x19, x20, [sp, #0]\n"
+    "	stp x21, x22, [sp, #16]\n"
+    "	stp x23, x24, [sp, #32]\n"
+    "	stp x25, x26, [sp, #48]\n"
+    "	stp x27, x28, [sp, #64]\n"
+    "	stp x29, x30, [sp, #80]\n"
+    "	stp d8, d9, [sp, #96]\n"
+    "	stp d10, d11, [sp, #112]\n"
+    "	stp d12, d13, [sp, #128]\n"
+    "	stp d14, d15, [sp, #144]\n"
+    "	mov x9, sp\n"
+    "	str x9, [x0]\n"
+    "	mov sp, x1\n"
+    "	ldp x19, x20, [sp, #0]\n"
+    "	ldp x21, x22, [sp, #16]\n"
+    "	ldp x23, x24, [sp, #32]\n"
+    "	ldp x25, x26, [sp, #48]\n"
+    "	ldp x27, x28, [sp, #64]\n"
+    "	ldp x29, x30, [sp, #80]\n"
+    "	ldp d8, d9, [sp, #96]\n"
+    "	ldp d10, d11, [sp, #112]\n"
+    "	ldp d12, d13, [sp, #128]\n"
+    "	ldp d14, d15, [sp, #144]\n"
+    "	add sp, sp, #160\n"
+    "	ret\n"
+    ".size wvtask_switch, .-wvtask_switch\n"
+    "\n"
+    ".globl wvtask_start\n"
+    ".hidden wvtask_start\n"
+    ".type wvtask_start, %function\n"
+    "wvtask_start:\n"
+    "	mov x0, x19\n"
+    "	blr x20\n"
+    "	brk #0\n"
+    ".size wvtask_start, .-wvtask_start\n"
+    ".popsection\n"
+);
+
+// Lays out a new stack so that wvtask_switch() to it "returns" into
+// wvtask_start(), which calls func(arg).  Returns the new stack pointer.
+static void *wvtask_init_stack(void *stack, size_t size,
+			       void (*func)(WvTask *), WvTask *arg)
+{
+    unsigned long top = ((unsigned long)stack + size) & ~15UL;
+    unsigned long *sp = (unsigned long *)(top - 160);
+    memset(sp, 0, 160);
+    sp[0] = (unsigned long)arg;		// x19
+    sp[1] = (unsigned long)func;	// x20
+    sp[11] = (unsigned long)wvtask_start; // x30 (link register)
+    return sp;
+}
+#endif
+
+#endif // WVTASK_FAST_SWITCH
+
+
+static bool use_fast_switch()
+{
+#ifdef WVTASK_FAST_SWITCH
+    return !use_shared_stack();
+#else
+    return false;
+#endif
+}
+
+
 static void valgrind_fix(char *stacktop)
 {
 #ifdef HAVE_VALGRIND_MEMCHECK_H
@@ -87,7 +248,8 @@ static void valgrind_fix(char *stacktop)
 
 WvTask::WvTask(WvTaskMan &_man, size_t _stacksize) : man(_man)
 {
-    stacksize = _stacksize;
+    // round up to the size class, so any free task in a class will do
+    stacksize = (size_t)1 << WvTaskMan::stack_class(_stacksize);
     running = recycled = false;
     func = NULL;
     userdata = NULL;
@@ -96,6 +258,7 @@ WvTask::WvTask(WvTaskMan &_man, size_t _stacksize) : man(_man)
     numtasks++;
     magic_number = WVTASK_MAGIC;
     stack_magic = NULL;
+    fast_sp = NULL;
     
     man.get_stack(*this, stacksize);
 
@@ -109,6 +272,14 @@ WvTask::~WvTask()
     if (running)
 	numrunning--;
     magic_number = 42;
+    
+    // fast-switching stacks are separate mappings, so we can give them back
+    if (fast_sp)
+    {
+	size_t guard = getpagesize();
+	munmap((char *)stack - guard, stacksize + guard);
+	man.stack_bytes -= stacksize + guard;
+    }
 }
 
 
@@ -129,7 +300,21 @@ void WvTask::recycle()
     
     if (!running && !recycled)
     {
-	man.free_tasks.append(this, true);
+	if (man.release_stacks && fast_sp && man.current_task != this)
+	{
+	    // throw away everything below the task's (idle) stack frame.
+	    size_t page = getpagesize();
+	    char *end = (char *)((unsigned long)fast_sp & ~(page - 1));
+	    if (end > (char *)stack
+		&& madvise(stack, end - (char *)stack, MADV_DONTNEED) == 0)
+	    {
+		*stack_magic = WVTASK_MAGIC; // that was zeroed too
+		man.stacks_released++;
+	    }
+	}
+	
+	// reuse the most recently used stacks first; they're still warm.
+	man.free_tasks[man.stack_class(stacksize)].prepend(this, true);
 	recycled = true;
     }
 }
@@ -179,6 +364,16 @@ WvString WvTaskMan::debugger_tasks_run_cb(WvStringParm cmd, WvStringList &args,
                 i->name);
         result_cb(cmd, result);
     }
+    
+    size_t numfree = 0;
+    for (int c = 0; c < NUM_STACK_CLASSES; c++)
+	numfree += free_tasks[c].count();
+    result.zap();
+    result.append("Tasks: %s total, %s running, %s free",
+		  WvTask::numtasks, WvTask::numrunning, numfree);
+    result.append("Stacks: %s bytes mapped, %s reused, %s released",
+		  stack_bytes, stacks_reused, stacks_released);
+    result_cb(cmd, result);
     return WvString::null;
 }
 
@@ -198,6 +393,11 @@ WvTaskMan::WvTaskMan()
     
     stacktop = (char *)alloca(0);
     
+    // with fast switching, every task lives entirely on its own stack,
+    // so there's no need for a stackmaster.
+    if (use_fast_switch())
+	return;
+    
     context_return = 0;
     assert(getcontext(&get_stack_return) == 0);
     if (context_return == 0)
@@ -212,7 +412,19 @@ WvTaskMan::WvTaskMan()
 WvTaskMan::~WvTaskMan()
 {    
     magic_number = -42;
-    free_tasks.zap();
+    for (int c = 0; c < NUM_STACK_CLASSES; c++)
+	free_tasks[c].zap();
+}
+
+
+int WvTaskMan::stack_class(size_t size)
+{
+    // powers of two, starting at one page
+    int c = 0;
+    while (((size_t)1 << c) < size || ((size_t)1 << c) < (size_t)getpagesize())
+	c++;
+    assert(c < NUM_STACK_CLASSES);
+    return c;
 }
 
 
@@ -222,18 +434,22 @@ WvTask *WvTaskMan::start(WvStringParm name,
 {
     WvTask *t;
     
-    WvTaskList::Iter i(free_tasks);
-    for (i.rewind(); i.next(); )
+    // every task in a class is big enough, so just take the first one
+    for (int c = stack_class(stacksize); c < NUM_STACK_CLASSES; c++)
     {
-	if (i().stacksize >= stacksize)
-	{
-	    t = &i();
-	    i.set_autofree(false);
-	    i.unlink();
-	    t->recycled = false;
-	    t->start(name, func, userdata);
-	    return t;
-	}
+	if (free_tasks[c].isempty())
+	    continue;
+	
+	WvTaskList::Iter i(free_tasks[c]);
+	i.rewind();
+	i.next();
+	t = &i();
+	i.set_autofree(false);
+	i.unlink();
+	t->recycled = false;
+	t->start(name, func, userdata);
+	stacks_reused++;
+	return t;
     }
     
     // if we get here, no matching task was found.
@@ -257,6 +473,20 @@ int WvTaskMan::run(WvTask &task, int val)
         
     WvTask *old_task = current_task;
     current_task = &task;
+    
+#ifdef WVTASK_FAST_SWITCH
+    if (use_fast_switch())
+    {
+	void **sp = old_task ? &old_task->fast_sp : &toplevel_sp;
+	context_return = val;
+	wvtask_switch(sp, task.fast_sp);
+	
+	// someone did yield() (if toplevel) or run() on our old task; done.
+	current_task = old_task;
+	return context_return;
+    }
+#endif
+    
     ucontext_t *state;
     
     if (!old_task)
@@ -317,6 +547,15 @@ int WvTaskMan::yield(int val)
                 (long)current_task->stacksize);
     }
 #endif
+    
+#ifdef WVTASK_FAST_SWITCH
+    if (use_fast_switch())
+    {
+	context_return = val;
+	wvtask_switch(&current_task->fast_sp, toplevel_sp);
+	return context_return;
+    }
+#endif
 		
     context_return = 0;
     assert(getcontext(&current_task->mystate) == 0);
@@ -340,6 +579,31 @@ int WvTaskMan::yield(int val)
 
 void WvTaskMan::get_stack(WvTask &task, size_t size)
 {
+#ifdef WVTASK_FAST_SWITCH
+    if (use_fast_switch())
+    {
+	// an inaccessible guard page below the stack turns an overflow
+	// into a segfault instead of silently scribbling on other memory.
+	size_t guard = getpagesize();
+	char *base = (char *)mmap(NULL, task.stacksize + guard,
+				  PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+				  -1, 0);
+	assert(base != MAP_FAILED);
+	mprotect(base, guard, PROT_NONE);
+	task.stack = base + guard;
+	stack_bytes += task.stacksize + guard;
+	
+	// stacks grow down, so overflows hit the bottom first
+	task.stack_magic = (int *)task.stack;
+	*task.stack_magic = WVTASK_MAGIC;
+	
+	task.fast_sp = wvtask_init_stack(task.stack, task.stacksize,
+					 fast_task_main, &task);
+	return;
+    }
+#endif
+
     context_return = 0;
     assert(getcontext(&get_stack_return) == 0);
     if (context_return == 0)
@@ -466,6 +730,28 @@ void WvTaskMan::call_func(WvTask *task)
 }
 
 
+void WvTaskMan::fast_task_main(WvTask *task)
+{
+    // the equivalent of do_task(), but already on the task's own stack.
+    for (;;)
+    {
+	assert(magic_number == -WVTASK_MAGIC);
+	assert(task->magic_number == WVTASK_MAGIC);
+	
+	if (task->func && task->running)
+	{
+	    call_func(task);
+	    
+	    // the task's function terminated.
+	    task->name = "DEAD";
+	    task->running = false;
+	    task->numrunning--;
+	}
+	yield();
+    }
+}
+
+
 void WvTaskMan::do_task()
 {
     assert(magic_number == -WVTASK_MAGIC);
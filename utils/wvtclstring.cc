@@ -9,43 +9,146 @@
 #include "wvstringmask.h"
 #include "wvtclstring.h"
 #include <climits>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 const WvStringMask WVTCL_NASTY_SPACES(WVTCL_NASTY_SPACES_STR);
 const WvStringMask WVTCL_NASTY_NEWLINES(WVTCL_NASTY_NEWLINES_STR);
 const WvStringMask WVTCL_SPLITCHARS(WVTCL_SPLITCHARS_STR);
 
-static size_t wvtcl_escape(char *dst, const char *s, size_t s_len,
-			   const WvStringMask &nasties, bool *verbatim = NULL)
+/***** Bulk scanning *****/
+
+// {, }, \, and " are always interesting, as well as whatever is in the mask.
+#define WVTCL_SCAN_EXTRA "{}\\\""
+#define WVTCL_SCAN_MAX 16
+
+/**
+ * Finds the next character that is either in a WvStringMask or always
+ * nasty, so that the plain characters in between can be skipped (and
+ * copied) in bulk instead of being looked at one by one.
+ *
+ * WvStringMask doesn't tell us what's in it, so we only know the contents
+ * of the standard masks; for any other mask, this just walks the string
+ * a character at a time like it always used to.
+ */
+class WvTclScanner
 {
-    if (verbatim) *verbatim = false;
+    const WvStringMask &mask;
+    char chars[WVTCL_SCAN_MAX];
+    int nchars; // 0 if we don't know what's in the mask
+
+public:
+    WvTclScanner(const WvStringMask &_mask);
+
+    bool isspecial(char ch) const
+    {
+	switch (ch)
+	{
+	case WVTCL_ALWAYS_NASTY_CASE:
+	    return true;
+	default:
+	    return mask[ch];
+	}
+    }
+
+    /** Returns the offset of the first special character, or 'len'. */
+    size_t find(const char *s, size_t len) const;
+};
+
+
+WvTclScanner::WvTclScanner(const WvStringMask &_mask)
+    : mask(_mask), nchars(0)
+{
+    const char *maskchars = NULL;
+    if (&mask == &WVTCL_NASTY_SPACES)
+	maskchars = WVTCL_NASTY_SPACES_STR;
+    else if (&mask == &WVTCL_NASTY_NEWLINES)
+	maskchars = WVTCL_NASTY_NEWLINES_STR;
+    else if (&mask == &WVTCL_SPLITCHARS)
+	maskchars = WVTCL_SPLITCHARS_STR;
+
+    if (maskchars)
+    {
+	const char *cptr;
+	for (cptr = maskchars; *cptr; cptr++)
+	    chars[nchars++] = *cptr;
+	for (cptr = WVTCL_SCAN_EXTRA; *cptr; cptr++)
+	    chars[nchars++] = *cptr;
+    }
+}
+
+
+size_t WvTclScanner::find(const char *s, size_t len) const
+{
+    size_t i = 0;
+
+    if (nchars)
+    {
+#if defined(__AVX2__)
+	for (; i + 32 <= len; i += 32)
+	{
+	    __m256i block = _mm256_loadu_si256((const __m256i *)(s + i));
+	    __m256i hits = _mm256_setzero_si256();
+	    for (int c = 0; c < nchars; c++)
+		hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block,
+			    _mm256_set1_epi8(chars[c])));
+	    unsigned int bits = _mm256_movemask_epi8(hits);
+	    if (bits)
+		return i + __builtin_ctz(bits);
+	}
+#endif
+#if defined(__SSE2__)
+	for (; i + 16 <= len; i += 16)
+	{
+	    __m128i block = _mm_loadu_si128((const __m128i *)(s + i));
+	    __m128i hits = _mm_setzero_si128();
+	    for (int c = 0; c < nchars; c++)
+		hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block,
+			    _mm_set1_epi8(chars[c])));
+	    unsigned int bits = _mm_movemask_epi8(hits);
+	    if (bits)
+		return i + __builtin_ctz(bits);
+	}
+#endif
+    }
+
+    for (; i < len; i++)
+	if (isspecial(s[i]))
+	    return i;
+    return len;
+}
+
+
+/***** Escaping *****/
+
+/**
+ * Decides how 's' needs to be escaped.  Returns the length of the escaped
+ * string; 'verbatim' is set if no escaping is needed at all, and
+ * 'backslashify' if the string can't simply be put in braces.
+ */
+static size_t wvtcl_escape_scan(const WvTclScanner &scanner,
+				const char *s, size_t s_len,
+				bool &verbatim, bool &backslashify)
+{
+    verbatim = backslashify = false;
 
-    // NULL strings remain such
-    if (s == NULL)
-        return 0;
     // empty strings are just {}
     if (s_len == 0)
-    {
-        if (dst)
-        {
-            dst[0] = '{';
-            dst[1] = '}';
-        }
 	return 2;
-    }
-    
-    bool backslashify = false, inescape = false;
-    int len = 0, unprintables = 0, bracecount = 0;
-    const char *cptr, *cptr_end = s + s_len;
-    
+
+    bool inescape = false;
+    int unprintables = 0, bracecount = 0;
+    const char *cptr = s, *cptr_end = s + s_len;
+
     // figure out which method we need to use: backslashify or embrace.
     // also count the number of unprintable characters we'll need to 
-    // backslashify, if it turns out that's necessary.
-    for (cptr = s; cptr != cptr_end; cptr++)
+    // backslashify, if it turns out that's necessary.  Only the nasty
+    // characters matter, so skip straight from one to the next.
+    for (cptr += scanner.find(cptr, cptr_end - cptr); cptr != cptr_end; )
     {
-        // Assume we do nothing
-        if (dst) dst[len] = *cptr;
-        ++len;
-
 	if (!inescape && *cptr == '{')
 	    bracecount++;
 	else if (!inescape && *cptr == '}')
@@ -53,90 +156,120 @@ static size_t wvtcl_escape(char *dst, const char *s, size_t s_len,
 	if (bracecount < 0)
 	    backslashify = true;
 
-	bool doit = false;
-	switch (*cptr)
-	{
-	case WVTCL_ALWAYS_NASTY_CASE:
-	    doit = true;
-	    break;
-	default:
-	    if (nasties[*cptr])
-		doit = true;
-	}
-	if (doit)
-	    unprintables++;
+	unprintables++;
 
 	if (*cptr == '\\')
 	    inescape = !inescape;
 	else
 	    inescape = false;
+
+	cptr++;
+	size_t skip = scanner.find(cptr, cptr_end - cptr);
+	if (skip)
+	    inescape = false;
+	cptr += skip;
     }
-    
+
     // if the braces aren't balanced, backslashify
     if (bracecount != 0 || inescape)
         backslashify = true;
 
     if (!backslashify && !unprintables)
     {
-        if (verbatim) *verbatim = true;
-	return len; // no work needed!
+	verbatim = true;
+	return s_len; // no work needed!
     }
-    
-    if (backslashify)
+    else if (backslashify)
+	return s_len + unprintables;
+    else
+	return s_len + 2;
+}
+
+
+static size_t wvtcl_escape_write(const WvTclScanner &scanner, char *dst,
+				 const char *s, size_t s_len,
+				 bool verbatim, bool backslashify)
+{
+    if (s_len == 0)
     {
-        if (dst)
-        {
-            len = 0;
-            for (cptr = s; cptr != cptr_end; ++cptr)
-	    {
-		bool doit = false;
-		switch (*cptr)
-		{
-		case WVTCL_ALWAYS_NASTY_CASE:
-		    doit = true;
-		    break;
-		default:
-		    if (nasties[*cptr])
-			doit = true;
-		}
-		if (doit)
-		    dst[len++] = '\\';
+	dst[0] = '{';
+	dst[1] = '}';
+	return 2;
+    }
 
-                dst[len++] = *cptr;
-            }
-            return len;
-        }
-        else return len+unprintables;
+    if (verbatim)
+    {
+	memcpy(dst, s, s_len);
+	return s_len;
+    }
+    else if (backslashify)
+    {
+	// copy the runs of plain characters in one go, and put a backslash
+	// in front of each nasty one.
+	size_t len = 0;
+	const char *cptr = s, *cptr_end = s + s_len;
+	while (cptr != cptr_end)
+	{
+	    size_t run = scanner.find(cptr, cptr_end - cptr);
+	    memcpy(dst + len, cptr, run);
+	    len += run;
+	    cptr += run;
+	    if (cptr == cptr_end)
+		break;
+	    dst[len++] = '\\';
+	    dst[len++] = *cptr++;
+	}
+	return len;
     }
     else
     {
 	// the embrace method: just take the string and put braces around it
-        if (dst)
-        {
-            len = 0;
-            dst[len++] = '{';
-            for (cptr = s; cptr != cptr_end; ++cptr)
-                dst[len++] = *cptr;
-            dst[len++] = '}';
-            return len;
-        }
-        else return len+2;
+	dst[0] = '{';
+	memcpy(dst + 1, s, s_len);
+	dst[s_len + 1] = '}';
+	return s_len + 2;
     }
 }
 
 
+static size_t wvtcl_escape(char *dst, const char *s, size_t s_len,
+			   const WvStringMask &nasties, bool *verbatim = NULL)
+{
+    if (verbatim) *verbatim = false;
+
+    // NULL strings remain such
+    if (s == NULL)
+        return 0;
+
+    WvTclScanner scanner(nasties);
+    bool isverbatim, backslashify;
+    size_t len = wvtcl_escape_scan(scanner, s, s_len,
+				   isverbatim, backslashify);
+    if (verbatim) *verbatim = isverbatim;
+    if (dst)
+	return wvtcl_escape_write(scanner, dst, s, s_len,
+				  isverbatim, backslashify);
+    return len;
+}
+
+
 WvString wvtcl_escape(WvStringParm s, const WvStringMask &nasties)
 {
+    // NULL strings remain such
+    if (s.isnull())
+	return s;
+
     size_t s_len = s.len();
 
-    bool verbatim;
-    size_t len = wvtcl_escape(NULL, s, s_len, nasties, &verbatim);
+    WvTclScanner scanner(nasties);
+    bool verbatim, backslashify;
+    size_t len = wvtcl_escape_scan(scanner, s, s_len, verbatim, backslashify);
     if (verbatim) return s;
 
     WvString result;
-    result.setsize(len);
+    result.setsize(len + 1);
     char *e = result.edit();
-    e += wvtcl_escape(e, s, s_len, nasties);
+    e += wvtcl_escape_write(scanner, e, s, s_len, false, backslashify);
     *e = '\0';
     return result;
 }
@@ -165,7 +298,7 @@ static size_t wvtcl_unescape(char *dst, const char *s, size_t s_len,
     
     bool skipquotes = false;
     // deal with quoted strings by ignoring the quotes _and_ unbackslashifying.
-    if (s[0] == '"' && s[s_len-1] == '"')
+    if (s_len >= 2 && s[0] == '"' && s[s_len-1] == '"')
 	skipquotes = true;
     
     // otherwise, unbackslashify it.
@@ -175,27 +308,34 @@ static size_t wvtcl_unescape(char *dst, const char *s, size_t s_len,
         ++start;
         --end;
     }
+
+    // the common case: nothing to do at all
+    const char *bs = (const char *)memchr(start, '\\', end - start);
+    if (!bs && !skipquotes)
+    {
+	if (verbatim) *verbatim = true;
+	if (dst) memcpy(dst, s, s_len);
+	return s_len;
+    }
+
+    // each backslash eats the character after it, which is copied as-is
     size_t len = 0;
-    bool inescape = false;
-    for (; start != end; ++start)
+    while (start != end)
     {
-        if (*start == '\\')
-        {
-            if (inescape)
-            {
-                if (dst) dst[len] = *start;
-                len++;
-                inescape = false;
-            }
-            else
-                inescape = true;
-        }
-        else
-        {
-            inescape = false;
-            if (dst) dst[len] = *start;
-            len++;
-        }
+	size_t run = (bs ? bs : end) - start;
+	if (dst) memcpy(dst + len, start, run);
+	len += run;
+	start += run;
+	if (start == end)
+	    break;
+
+	start++; // skip the backslash
+	if (start == end)
+	    break;
+	if (dst) dst[len] = *start;
+	len++;
+	start++;
+	bs = (const char *)memchr(start, '\\', end - start);
     }
     return len;
 }
@@ -280,10 +420,25 @@ static size_t wvtcl_getword(char *dst, const char *s, size_t s_len,
     else
 	eptr = sptr;
     
-    // loop over string until something satisfactory is found
-    for (; eptr != origend; eptr++)
+    // loop over string until something satisfactory is found.  Only
+    // splitchars and the always-nasty characters can change anything, so
+    // skip over everything else in bulk.
+    WvTclScanner scanner(splitchars);
+    while (eptr != origend)
     {
-	char ch = *eptr;
+	if (!inescape)
+	{
+	    size_t skip = scanner.find(eptr, origend - eptr);
+	    if (skip)
+	    {
+		incontinuation = false;
+		eptr += skip;
+		if (eptr == origend)
+		    break;
+	    }
+	}
+
+	char ch = *eptr++;
 	
         incontinuation = false;
 	
@@ -319,13 +474,13 @@ static size_t wvtcl_getword(char *dst, const char *s, size_t s_len,
 		if (inquote)
 		{
 		    if (ch == '"')
-		    {
-			eptr++;
 			break;
-		    }
 		}
 		else if (splitchars[ch])
+		{
+		    eptr--;
 		    break;
+		}
 	    }
 	    
 	    // match braces
@@ -0,0 +1,333 @@
+/*
+ * Worldvisions Weaver Software:
+ *   Copyright (C) 1997-2002 Net Integration Technologies, Inc.
+ *
+ * A few background threads for blocking jobs.  See wvworkerpool.h.
+ */
+#include "wvworkerpool.h"
+
+#ifndef WVWORKERPOOL_NO_THREADS
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+WvWorkerPool::WvWorkerPool(int _max_threads)
+    : max_threads(_max_threads), nrun(0), pid(0)
+{
+    // everything else gets set up by the first open() in each process
+}
+
+
+// must be called with the lock held
+void WvWorkerPool::close_pipe()
+{
+    ::close(pipefd[0]);
+    ::close(pipefd[1]);
+    isopen = false;
+}
+
+
+void *WvWorkerPool::thread_main(void *userdata)
+{
+    WvWorkerPool &pool = *(WvWorkerPool *)userdata;
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;)
+    {
+	while (!pool.todo && !pool.quit)
+	{
+	    pool.idle++;
+	    pthread_cond_wait(&pool.cond, &pool.lock);
+	    pool.idle--;
+	}
+	if (pool.quit)
+	    break;
+
+	WvWorkerJob *job = pool.todo;
+	pool.todo = job->next;
+	pool.queued--;
+	pthread_mutex_unlock(&pool.lock);
+
+	job->run();
+
+	pthread_mutex_lock(&pool.lock);
+	pool.nrun++;
+	job->done = true;
+	if (job->orphaned)
+	    delete job;
+	pthread_cond_broadcast(&pool.done_cond);
+	if (pool.isopen && ::write(pool.pipefd[1], "", 1) < 0)
+	    ; // the pipe is full, so the main thread will wake up anyway
+    }
+
+    // the last one out cleans up, unless close() already did
+    if (!--pool.threads && pool.isopen)
+	pool.close_pipe();
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+
+bool WvWorkerPool::open()
+{
+    if (pid != getpid())
+    {
+	// first time, or we forked, and the threads didn't come along with
+	// us.  Anything they were doing belongs to our parent.
+	if (pid && isopen)
+	{
+	    ::close(pipefd[0]);
+	    ::close(pipefd[1]);
+	}
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+	todo = todo_tail = NULL;
+	threads = idle = queued = users = 0;
+	isopen = quit = false;
+	pid = getpid();
+    }
+
+    pthread_mutex_lock(&lock);
+    quit = false;
+    if (!isopen && pipe(pipefd) == 0)
+    {
+	for (int i = 0; i < 2; i++)
+	{
+	    fcntl(pipefd[i], F_SETFD, FD_CLOEXEC);
+	    fcntl(pipefd[i], F_SETFL, O_NONBLOCK);
+	}
+	isopen = true;
+    }
+    bool ok = isopen;
+    if (ok)
+	users++;
+    pthread_mutex_unlock(&lock);
+    return ok;
+}
+
+
+void WvWorkerPool::close()
+{
+    if (pid != getpid())
+	return;
+
+    pthread_mutex_lock(&lock);
+    if (users && !--users)
+    {
+	quit = true;
+	pthread_cond_broadcast(&cond);
+
+	// nobody's going to run these now
+	while (todo)
+	{
+	    WvWorkerJob *job = todo;
+	    todo = job->next;
+	    job->done = true;
+	    if (job->orphaned)
+		delete job;
+	}
+	queued = 0;
+	pthread_cond_broadcast(&done_cond);
+
+	// if nobody's in the middle of a job, don't wait for them
+	if (isopen && idle == threads)
+	    close_pipe();
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+
+bool WvWorkerPool::submit(WvWorkerJob *job)
+{
+    if (pid != getpid())
+	return false;
+
+    pthread_mutex_lock(&lock);
+    if (!isopen)
+    {
+	pthread_mutex_unlock(&lock);
+	return false;
+    }
+
+    job->done = job->orphaned = false;
+    job->next = NULL;
+    if (todo)
+	todo_tail->next = job;
+    else
+	todo = job;
+    todo_tail = job;
+    queued++;
+
+    // an idle thread that's been signalled but hasn't woken up yet still
+    // counts as idle, so compare against everything that's waiting: a
+    // burst of submits shouldn't all line up behind one thread.
+    if (queued > idle && threads < max_threads)
+    {
+	// the threads shouldn't get any of our signals
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+
+	pthread_t t;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&t, &attr, thread_main, this) == 0)
+	    threads++;
+	pthread_attr_destroy(&attr);
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+    if (idle)
+	pthread_cond_signal(&cond);
+
+    // with no threads at all, the job is the only thing in the queue
+    bool ok = threads > 0;
+    if (!ok)
+    {
+	todo = todo_tail = NULL;
+	queued = 0;
+    }
+    pthread_mutex_unlock(&lock);
+    return ok;
+}
+
+
+bool WvWorkerPool::finished(WvWorkerJob *job)
+{
+    if (pid != getpid())
+    {
+	// the thread doing it stayed with our parent
+	job->done = true;
+	return true;
+    }
+
+    pthread_mutex_lock(&lock);
+    char buf[64];
+    while (isopen && ::read(pipefd[0], buf, sizeof(buf)) > 0)
+	;
+    bool done = job->done;
+    pthread_mutex_unlock(&lock);
+    return done;
+}
+
+
+bool WvWorkerPool::isdone(WvWorkerJob *job)
+{
+    if (pid != getpid())
+	return true; // see finished()
+
+    pthread_mutex_lock(&lock);
+    bool done = job->done;
+    pthread_mutex_unlock(&lock);
+    return done;
+}
+
+
+void WvWorkerPool::wait(WvWorkerJob *job)
+{
+    if (pid != getpid())
+	return;
+
+    pthread_mutex_lock(&lock);
+    while (!job->done)
+	pthread_cond_wait(&done_cond, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+
+void WvWorkerPool::abandon(WvWorkerJob *job)
+{
+    if (pid != getpid())
+    {
+	delete job; // the copy in our parent is still someone's problem
+	return;
+    }
+
+    pthread_mutex_lock(&lock);
+    WvWorkerJob **prev = &todo, *last = NULL;
+    while (*prev && *prev != job)
+    {
+	last = *prev;
+	prev = &(*prev)->next;
+    }
+    if (*prev)
+    {
+	// never started, so nobody else knows about it
+	*prev = job->next;
+	if (todo_tail == job)
+	    todo_tail = last;
+	queued--;
+	job->done = true;
+    }
+    if (job->done)
+	delete job;
+    else
+	job->orphaned = true;
+    pthread_mutex_unlock(&lock);
+}
+
+
+int WvWorkerPool::getfd() const
+{
+    return (pid == getpid() && isopen) ? pipefd[0] : -1;
+}
+
+#else // WVWORKERPOOL_NO_THREADS
+
+// no threads: nothing can be submitted, so callers do it themselves.
+
+WvWorkerPool::WvWorkerPool(int _max_threads)
+    : max_threads(_max_threads), nrun(0)
+{
+}
+
+
+bool WvWorkerPool::open()
+{
+    return false;
+}
+
+
+void WvWorkerPool::close()
+{
+}
+
+
+bool WvWorkerPool::submit(WvWorkerJob *job)
+{
+    return false;
+}
+
+
+bool WvWorkerPool::finished(WvWorkerJob *job)
+{
+    return true;
+}
+
+
+bool WvWorkerPool::isdone(WvWorkerJob *job)
+{
+    return true;
+}
+
+
+void WvWorkerPool::wait(WvWorkerJob *job)
+{
+}
+
+
+void WvWorkerPool::abandon(WvWorkerJob *job)
+{
+    delete job;
+}
+
+
+int WvWorkerPool::getfd() const
+{
+    return -1;
+}
+
+#endif // WVWORKERPOOL_NO_THREADS